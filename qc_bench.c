@@ -0,0 +1,284 @@
+/* Copyright IBM Corp. 2020 */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "query_capacity.h"
+
+#define DEFAULT_ITERATIONS	1000
+#define NUM_ATTR_IDS		(qc_ziip_effective_capacity_layer + 1)
+
+
+enum bench_op {
+	BENCH_OPEN,
+	BENCH_QUERY,
+	BENCH_EXPORT,
+	BENCH_CLOSE,
+	BENCH_NUM_OPS
+};
+
+static const char *op_names[BENCH_NUM_OPS] = {
+	"qc_open", "qc_get_attribute_*", "qc_export_json", "qc_close"
+};
+
+/* Count allocations by interposing the glibc allocator. Note that handles
+   might be opened using multiple threads, see QC_PARALLEL_OPEN. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static unsigned long num_allocs;
+static unsigned long num_alloc_bytes;
+
+static void count_alloc(size_t size) {
+	__atomic_add_fetch(&num_allocs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&num_alloc_bytes, size, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size) {
+	count_alloc(size);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	count_alloc(nmemb * size);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	count_alloc(size);
+	return __libc_realloc(ptr, size);
+}
+
+// used for the STHYI buffer
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+	void *p;
+
+	if (alignment % sizeof(void *) || (alignment & (alignment - 1)))
+		return EINVAL;
+	count_alloc(size);
+	if ((p = __libc_memalign(alignment, size)) == NULL)
+		return ENOMEM;
+	*memptr = p;
+
+	return 0;
+}
+
+static unsigned long long now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_ull(const void *a, const void *b) {
+	unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(unsigned long long *samples, int num, int pct) {
+	return samples[(num - 1) * pct / 100] / 1000.;
+}
+
+static void print_help() {
+	printf("\n");
+	printf("Usage: qc_bench [-i <N>] [-h] [<dump>*]\n");
+	printf("\n");
+	printf("Measure the performance of qclib on the live system, or replay specified dumps\n");
+	printf("instead (requires compilation with CONFIG_DUMP_READING).\n");
+	printf("\n");
+	printf("  -h, --help             Print usage information and exit\n");
+	printf("  -i, --iterations <N>   Run N iterations per dump (default: %d)\n", DEFAULT_ITERATIONS);
+	printf("\n");
+}
+
+/* Determine the type of all attributes of all layers, so we can query them
+   with the matching function later on. Returns the number of layers. */
+static int get_attr_types(void *hdl, char **types) {
+	int rc, layers, layer, id, ival;
+	const char *sval;
+	float fval;
+
+	layers = qc_get_num_layers(hdl, &rc);
+	if (rc || layers < 1)
+		return -1;
+	if ((*types = malloc(layers * NUM_ATTR_IDS)) == NULL)
+		return -1;
+	for (layer = 0; layer < layers; layer++) {
+		for (id = 0; id < NUM_ATTR_IDS; id++) {
+			if (qc_get_attribute_int(hdl, id, layer, &ival) > 0)
+				(*types)[layer * NUM_ATTR_IDS + id] = 'i';
+			else if (qc_get_attribute_string(hdl, id, layer, &sval) > 0)
+				(*types)[layer * NUM_ATTR_IDS + id] = 's';
+			else if (qc_get_attribute_float(hdl, id, layer, &fval) > 0)
+				(*types)[layer * NUM_ATTR_IDS + id] = 'f';
+			else
+				(*types)[layer * NUM_ATTR_IDS + id] = '\0';
+		}
+	}
+
+	return layers;
+}
+
+static int query_attrs(void *hdl, int layers, const char *types) {
+	int layer, id, ival, rc = 0;
+	const char *sval;
+	float fval;
+
+	for (layer = 0; layer < layers; layer++) {
+		for (id = 0; id < NUM_ATTR_IDS; id++) {
+			switch (types[layer * NUM_ATTR_IDS + id]) {
+			case 'i': rc = qc_get_attribute_int(hdl, id, layer, &ival);
+				  break;
+			case 's': rc = qc_get_attribute_string(hdl, id, layer, &sval);
+				  break;
+			case 'f': rc = qc_get_attribute_float(hdl, id, layer, &fval);
+				  break;
+			default:  continue;
+			}
+			if (rc != 1)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int run_bench(const char *dump, int iterations) {
+	unsigned long long *samples[BENCH_NUM_OPS] = { NULL }, start;
+	unsigned long allocs = 0, alloc_bytes = 0, total_allocs = 0, total_alloc_bytes = 0;
+	int i, op, rc, layers = 0, ret = 1;
+	char *types = NULL, *buf = NULL;
+	size_t size, len;
+	void *hdl;
+
+	if (dump)
+		setenv("QC_USE_DUMP", dump, 1);
+	printf("%s, %d iterations\n", dump ? dump : "live system", iterations);
+	for (op = 0; op < BENCH_NUM_OPS; op++) {
+		if ((samples[op] = malloc(iterations * sizeof(unsigned long long))) == NULL)
+			goto out;
+	}
+	// warm up, and size the buffers
+	hdl = qc_open(&rc);
+	if (rc || !hdl) {
+		printf("  Error: qc_open() failed, rc=%d\n", rc);
+		qc_close(hdl);
+		goto out;
+	}
+	layers = get_attr_types(hdl, &types);
+	if (layers < 0 || qc_export_json_buf(hdl, NULL, 0, &size, 0) < 0 || (buf = malloc(++size)) == NULL) {
+		printf("  Error: Failed to prepare benchmark\n");
+		qc_close(hdl);
+		goto out;
+	}
+	qc_close(hdl);
+
+	for (i = 0; i < iterations; i++) {
+		allocs = __atomic_load_n(&num_allocs, __ATOMIC_RELAXED);
+		alloc_bytes = __atomic_load_n(&num_alloc_bytes, __ATOMIC_RELAXED);
+		start = now();
+		hdl = qc_open(&rc);
+		samples[BENCH_OPEN][i] = now() - start;
+		total_allocs += __atomic_load_n(&num_allocs, __ATOMIC_RELAXED) - allocs;
+		total_alloc_bytes += __atomic_load_n(&num_alloc_bytes, __ATOMIC_RELAXED) - alloc_bytes;
+		if (rc || !hdl) {
+			printf("  Error: qc_open() failed in iteration %d, rc=%d\n", i, rc);
+			qc_close(hdl);
+			goto out;
+		}
+		start = now();
+		rc = query_attrs(hdl, layers, types);
+		samples[BENCH_QUERY][i] = now() - start;
+		if (rc) {
+			printf("  Error: Attribute query failed in iteration %d\n", i);
+			qc_close(hdl);
+			goto out;
+		}
+		start = now();
+		rc = qc_export_json_buf(hdl, buf, size, &len, 0);
+		samples[BENCH_EXPORT][i] = now() - start;
+		start = now();
+		qc_close(hdl);
+		samples[BENCH_CLOSE][i] = now() - start;
+		if (rc) {
+			printf("  Error: qc_export_json_buf() failed in iteration %d, rc=%d\n", i, rc);
+			goto out;
+		}
+	}
+
+	printf("  %-20s %10s %10s %10s %10s\n", "Operation [us]", "p50", "p90", "p99", "max");
+	for (op = 0; op < BENCH_NUM_OPS; op++) {
+		qsort(samples[op], iterations, sizeof(unsigned long long), cmp_ull);
+		printf("  %-20s %10.1f %10.1f %10.1f %10.1f\n", op_names[op],
+		       percentile(samples[op], iterations, 50), percentile(samples[op], iterations, 90),
+		       percentile(samples[op], iterations, 99), percentile(samples[op], iterations, 100));
+	}
+	printf("  Allocations per open (mean): %.1f (%.0f bytes), layers: %d, JSON size: %zd bytes\n",
+	       (double)total_allocs / iterations, (double)total_alloc_bytes / iterations, layers, len);
+	ret = 0;
+
+out:
+	for (op = 0; op < BENCH_NUM_OPS; op++)
+		free(samples[op]);
+	free(types);
+	free(buf);
+
+	return ret;
+}
+
+int main(int argc, char **argv) {
+	static struct option long_options[] = {
+		{ "help",	no_argument,	   NULL, 'h'},
+		{ "iterations",	required_argument, NULL, 'i'},
+		{ 0,		0,		   0,	 0  }
+	};
+	int c, rc = 0, iterations = DEFAULT_ITERATIONS;
+	struct rusage ru;
+	char *end;
+	void *hdl;
+
+	while ((c = getopt_long(argc, argv, "hi:", long_options, NULL)) != EOF) {
+		switch (c) {
+		case 'h': print_help();
+			  return 0;
+		case 'i': iterations = strtol(optarg, &end, 10);
+			  if (*end != '\0' || iterations <= 0) {
+				fprintf(stderr, "Error: Invalid number of iterations '%s'\n", optarg);
+				return 1;
+			  }
+			  break;
+		default:  print_help();
+			  return 1;
+		}
+	}
+	// measure the data sources only
+	unsetenv("QC_USE_SHM");
+	unsetenv("QC_DEBUG");
+	unsetenv("QC_CHECK_CONSISTENCY");
+
+	if (optind < argc) {
+		hdl = qc_open_from_dump(NULL, &rc);
+		qc_close(hdl);
+		if (rc == -ENOTSUP) {
+			fprintf(stderr, "Error: Replaying dumps requires compilation with CONFIG_DUMP_READING\n");
+			return 1;
+		}
+		rc = 0;
+		for (; optind < argc; optind++)
+			rc += run_bench(argv[optind], iterations);
+	} else
+		rc = run_bench(NULL, iterations);
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+		printf("Peak RSS: %ld kB\n", ru.ru_maxrss);
+
+	return rc;
+}
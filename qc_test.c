@@ -1,9 +1,14 @@
 /* Copyright IBM Corp. 2013, 2019 */
 
 #include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "query_capacity.h"
 
@@ -79,6 +84,12 @@ const char *attr2char(enum qc_attr_id id) {
 	case qc_mobility_enabled: return "qc_mobility_enabled";
 	case qc_has_secure: return "qc_has_secure";
 	case qc_secure: return "qc_secure";
+	case qc_cp_effective_capacity: return "qc_cp_effective_capacity";
+	case qc_cp_effective_capacity_layer: return "qc_cp_effective_capacity_layer";
+	case qc_ifl_effective_capacity: return "qc_ifl_effective_capacity";
+	case qc_ifl_effective_capacity_layer: return "qc_ifl_effective_capacity_layer";
+	case qc_ziip_effective_capacity: return "qc_ziip_effective_capacity";
+	case qc_ziip_effective_capacity_layer: return "qc_ziip_effective_capacity_layer";
 	case qc_has_multiple_cpu_types: return "qc_has_multiple_cpu_types";
 	case qc_cp_dispatch_limithard: return "qc_cp_dispatch_limithard";
 	case qc_ifl_dispatch_limithard: return "qc_ifl_dispatch_limithard";
@@ -322,6 +333,635 @@ int sanity_checks(void *hdl, int layers) {
 	return 0;
 }
 
+// Refresh the handle, expecting no changes unless running on live data
+void verify_refresh(void *hdl, int layers, int live) {
+	int rc, changed, i;
+
+	rc = qc_refresh(NULL, QC_REFRESH_ALL, &changed);
+	if (rc >= 0) {
+		printf("Error: qc_refresh(NULL, QC_REFRESH_ALL, &changed) worked\n");
+		err_cnt++;
+	}
+	rc = qc_refresh(hdl, 0x100, NULL);
+	if (rc >= 0) {
+		printf("Error: qc_refresh(hdl, 0x100, NULL) worked\n");
+		err_cnt++;
+	}
+	rc = qc_refresh(hdl, QC_REFRESH_ALL, &changed);
+	if (rc != 0) {
+		printf("Error: qc_refresh() failed, rc=%d\n", rc);
+		err_cnt++;
+		return;
+	}
+	if (live)
+		return;
+	if (changed) {
+		printf("Error: qc_refresh() reported %d changed attribute(s)\n", changed);
+		err_cnt++;
+	}
+	if (qc_get_num_layers(hdl, &rc) != layers) {
+		printf("Error: Number of layers changed in qc_refresh()\n");
+		err_cnt++;
+	}
+	for (i = 0; i < layers; ++i) {
+		if (qc_get_attribute_changed(hdl, qc_layer_type, i) != 0) {
+			printf("Error: qc_get_attribute_changed(hdl, qc_layer_type, %d) failed\n", i);
+			err_cnt++;
+		}
+	}
+	if (qc_get_attribute_changed(hdl, 78923, 0) >= 0) {
+		printf("Error: qc_get_attribute_changed(hdl, 78923, 0) worked\n");
+		err_cnt++;
+	}
+}
+
+// Verify that all attributes of 'hdl2' match the ones of 'hdl'
+static void compare_hdls(void *hdl, void *hdl2, int layers, const char *what) {
+	int rc, rc2, i, id, ival, ival2;
+	const char *str, *str2;
+	float fval, fval2;
+
+	if (qc_get_num_layers(hdl2, &rc) != layers) {
+		printf("Error: Number of layers differs for %s\n", what);
+		err_cnt++;
+		return;
+	}
+	for (i = 0; i < layers; ++i) {
+		for (id = 0; id <= qc_ziip_effective_capacity_layer; ++id) {
+			rc = qc_get_attribute_int(hdl, id, i, &ival);
+			rc2 = qc_get_attribute_int(hdl2, id, i, &ival2);
+			if (rc != rc2 || (rc > 0 && ival != ival2)) {
+				printf("Error: Attribute %s differs in layer %d for %s\n", attr2char(id), i, what);
+				err_cnt++;
+			}
+			rc = qc_get_attribute_float(hdl, id, i, &fval);
+			rc2 = qc_get_attribute_float(hdl2, id, i, &fval2);
+			if (rc != rc2 || (rc > 0 && fval != fval2)) {
+				printf("Error: Attribute %s differs in layer %d for %s\n", attr2char(id), i, what);
+				err_cnt++;
+			}
+			rc = qc_get_attribute_string(hdl, id, i, &str);
+			rc2 = qc_get_attribute_string(hdl2, id, i, &str2);
+			if (rc != rc2 || (rc > 0 && strcmp(str, str2))) {
+				printf("Error: Attribute %s differs in layer %d for %s\n", attr2char(id), i, what);
+				err_cnt++;
+			}
+		}
+	}
+}
+
+// Verify that statistics are accounted for, both per handle and process-wide
+void verify_stats(void *hdl) {
+	struct qc_stats stats, stats2, pstats;
+	int rc;
+
+	if ((rc = qc_get_stats(hdl, NULL)) != -EINVAL) {
+		printf("Error: qc_get_stats(hdl, NULL) returned rc=%d\n", rc);
+		err_cnt++;
+	}
+	if ((rc = qc_get_stats((void *)0x1, &stats)) >= 0) {
+		printf("Error: qc_get_stats() with invalid handle worked\n");
+		err_cnt++;
+	}
+	if ((rc = qc_get_stats(hdl, &stats)) != 0) {
+		printf("Error: qc_get_stats() failed, rc=%d\n", rc);
+		err_cnt++;
+		return;
+	}
+	if (stats.num_gathers < 1 || stats.bytes_read == 0 || stats.num_buf_allocs == 0 ||
+	    stats.time[QC_STATS_OPEN_SYSINFO] == 0 || stats.time_total < stats.time[QC_STATS_POSTPROCESSING]) {
+		printf("Error: qc_get_stats() returned implausible data\n");
+		err_cnt++;
+	}
+	if (qc_refresh(hdl, QC_REFRESH_SYSINFO, NULL) != 0 || qc_get_stats(hdl, &stats2) != 0 ||
+	    qc_get_stats(NULL, &pstats) != 0) {
+		printf("Error: Failed to refresh and retrieve statistics\n");
+		err_cnt++;
+		return;
+	}
+	if (stats2.num_gathers <= stats.num_gathers || stats2.bytes_read <= stats.bytes_read ||
+	    stats2.time_total <= stats.time_total) {
+		printf("Error: qc_refresh() was not accounted for in statistics\n");
+		err_cnt++;
+	}
+	if (pstats.num_gathers < stats2.num_gathers || pstats.bytes_read < stats2.bytes_read) {
+		printf("Error: Process-wide statistics are lower than statistics of a handle\n");
+		err_cnt++;
+	}
+}
+
+// Record a couple of samples, verifying that the ring retains the most recent ones only
+void verify_history(void *hdl, int layers) {
+	enum qc_attr_id ids[] = { qc_layer_type_num, qc_num_cpu_configured };
+	struct qc_history_sample samples[5];
+	struct qc_history_summary summary;
+	int rc, i, type;
+
+	if (qc_history_get(hdl, qc_layer_type_num, 0, samples, 5) != -ENODATA) {
+		printf("Error: qc_history_get() worked without history\n");
+		err_cnt++;
+	}
+	if (qc_history_enable(NULL, NULL, 0, 3) >= 0 || qc_history_enable(hdl, NULL, 0, -1) >= 0 ||
+	    qc_history_enable(hdl, ids, 0, 3) >= 0 || qc_history_enable(hdl, NULL, 0, INT_MAX) >= 0 ||
+	    qc_history_enable(hdl, ids, INT_MAX, 3) >= 0) {
+		printf("Error: qc_history_enable() with invalid parameters worked\n");
+		err_cnt++;
+	}
+	if ((rc = qc_history_enable(hdl, ids, sizeof(ids) / sizeof(ids[0]), 3)) != 0) {
+		printf("Error: qc_history_enable() failed, rc=%d\n", rc);
+		err_cnt++;
+		return;
+	}
+	for (i = 0; i < 4; i++) {
+		if ((rc = qc_refresh(hdl, QC_REFRESH_ALL, NULL)) != 0) {
+			printf("Error: qc_refresh() failed, rc=%d\n", rc);
+			err_cnt++;
+		}
+	}
+	if ((rc = qc_history_get(hdl, qc_layer_type_num, layers - 1, samples, 5)) != 3) {
+		printf("Error: qc_history_get() returned %d sample(s) instead of 3\n", rc);
+		err_cnt++;
+	}
+	for (i = 1; i < rc; i++) {
+		if (samples[i].time > samples[i - 1].time) {
+			printf("Error: qc_history_get() returned samples out of order\n");
+			err_cnt++;
+		}
+	}
+	if (qc_get_attribute_int(hdl, qc_layer_type_num, layers - 1, &type) != 1 ||
+	    qc_history_summary(hdl, qc_layer_type_num, layers - 1, 0, &summary) != 0 || summary.num != 3 ||
+	    summary.min != type || summary.max != type || summary.avg != type || summary.first > summary.last) {
+		printf("Error: qc_history_summary() returned unexpected data\n");
+		err_cnt++;
+	}
+	if (qc_history_summary(hdl, qc_layer_name, 0, 0, &summary) != 0 || summary.num != 0) {
+		printf("Error: qc_history_summary() returned data of an attribute not recorded\n");
+		err_cnt++;
+	}
+	if ((rc = qc_history_enable(hdl, NULL, 0, 0)) != 0 ||
+	    qc_history_summary(hdl, qc_layer_type_num, 0, 0, &summary) != -ENODATA) {
+		printf("Error: Failed to disable history, rc=%d\n", rc);
+		err_cnt++;
+	}
+}
+
+static void watch_cb(void *hdl, const struct qc_attr_change *changes, int num, void *data) {
+	*(int *)data += num;
+}
+
+// Run a watcher for a couple of intervals, expecting no changes unless running on live data
+void verify_watch(int live) {
+	enum qc_attr_id ids[] = { qc_num_cpu_total, qc_num_ifl_total };
+	void *watcher;
+	int rc, num = 0;
+
+	if (qc_watch_start(0, QC_REFRESH_ALL, NULL, 0, watch_cb, &num, &rc) || rc != -EINVAL) {
+		printf("Error: qc_watch_start() with interval 0 returned rc=%d\n", rc);
+		err_cnt++;
+	}
+	if (qc_watch_start(10, 0x100, NULL, 0, watch_cb, &num, &rc) || rc != -EINVAL) {
+		printf("Error: qc_watch_start() with invalid flags returned rc=%d\n", rc);
+		err_cnt++;
+	}
+	if (qc_watch_start(10, QC_REFRESH_ALL, NULL, 0, NULL, &num, &rc) || rc != -EINVAL) {
+		printf("Error: qc_watch_start() without callback returned rc=%d\n", rc);
+		err_cnt++;
+	}
+	if (qc_watch_stop(NULL) >= 0) {
+		printf("Error: qc_watch_stop(NULL) worked\n");
+		err_cnt++;
+	}
+	if (qc_watch_stop(&num) != -EINVAL) {
+		printf("Error: qc_watch_stop() with a bogus watcher worked\n");
+		err_cnt++;
+	}
+	watcher = qc_watch_start(10, QC_REFRESH_ALL, ids, sizeof(ids) / sizeof(ids[0]), watch_cb, &num, &rc);
+	if (!watcher || rc) {
+		printf("Error: qc_watch_start() failed, rc=%d\n", rc);
+		err_cnt++;
+		return;
+	}
+	usleep(50000);
+	if ((rc = qc_watch_stop(watcher)) != 0) {
+		printf("Error: qc_watch_stop() failed, rc=%d\n", rc);
+		err_cnt++;
+	}
+	if (qc_watch_stop(watcher) != -EINVAL) {
+		printf("Error: qc_watch_stop() of a stopped watcher worked\n");
+		err_cnt++;
+	}
+	if (!live && num) {
+		printf("Error: Watcher reported %d changed attribute(s)\n", num);
+		err_cnt++;
+	}
+}
+
+// Publish data of 'hdl' and verify that a handle using the published data is identical
+void verify_publish(void *hdl, int layers) {
+	char path[] = "/tmp/qc_test-XXXXXX", link[32];
+	struct stat sb;
+	char *prev;
+	void *hdl2;
+	int rc;
+
+	if (qc_publish(NULL, path, 0) >= 0) {
+		printf("Error: qc_publish(NULL, path, 0) worked\n");
+		err_cnt++;
+	}
+	if (qc_publish(hdl, NULL, 0) >= 0) {
+		printf("Error: qc_publish(hdl, NULL, 0) worked\n");
+		err_cnt++;
+	}
+	rc = mkstemp(path);
+	if (rc < 0) {
+		printf("Error: Could not create temporary file\n");
+		err_cnt++;
+		return;
+	}
+	close(rc);
+	// files writable by others are replaced
+	chmod(path, 0666);
+	if ((rc = qc_publish(hdl, path, 0)) != 0) {
+		printf("Error: qc_publish() failed, rc=%d\n", rc);
+		err_cnt++;
+		unlink(path);
+		return;
+	}
+	if (stat(path, &sb) || (sb.st_mode & 0777) != 0644) {
+		printf("Error: qc_publish() did not replace file with permissions 0666\n");
+		err_cnt++;
+	}
+	// symlinks are never followed
+	snprintf(link, sizeof(link), "%s.lnk", path);
+	if (symlink(path, link) == 0) {
+		if (qc_publish(hdl, link, 0) >= 0) {
+			printf("Error: qc_publish() to a symlink worked\n");
+			err_cnt++;
+		}
+		unlink(link);
+	}
+	if ((prev = getenv("QC_USE_SHM")) != NULL)
+		prev = strdup(prev);
+	setenv("QC_USE_SHM", path, 1);
+	hdl2 = qc_open(&rc);
+	if (prev)
+		setenv("QC_USE_SHM", prev, 1);
+	else
+		unsetenv("QC_USE_SHM");
+	free(prev);
+	unlink(path);
+	if (rc != 0 || !hdl2) {
+		printf("Error: qc_open() with published data failed, rc=%d\n", rc);
+		err_cnt++;
+		return;
+	}
+	compare_hdls(hdl, hdl2, layers, "published data");
+	qc_close(hdl2);
+}
+
+void verify_snapshot(void *hdl, int layers) {
+	char *buf = NULL;
+	size_t len, len2;
+	void *hdl2;
+	int rc;
+
+	if (qc_save_snapshot(NULL, NULL, 0, &len) >= 0) {
+		printf("Error: qc_save_snapshot(NULL, ...) worked\n");
+		err_cnt++;
+	}
+	if ((rc = qc_save_snapshot(hdl, NULL, 0, &len)) != 1) {
+		printf("Error: qc_save_snapshot() failed to determine size, rc=%d\n", rc);
+		err_cnt++;
+		return;
+	}
+	if ((buf = malloc(len)) == NULL)
+		return;
+	if ((rc = qc_save_snapshot(hdl, buf, len, &len2)) != 0 || len2 != len) {
+		printf("Error: qc_save_snapshot() failed, rc=%d\n", rc);
+		err_cnt++;
+		goto out;
+	}
+	if ((hdl2 = qc_open_from_snapshot(buf, len - 1, &rc)) != NULL || rc >= 0) {
+		printf("Error: qc_open_from_snapshot() with truncated snapshot worked\n");
+		err_cnt++;
+		qc_close(hdl2);
+	}
+	if ((hdl2 = qc_open_from_snapshot(buf, len, &rc)) == NULL || rc != 0) {
+		printf("Error: qc_open_from_snapshot() failed, rc=%d\n", rc);
+		err_cnt++;
+		goto out;
+	}
+	compare_hdls(hdl, hdl2, layers, "snapshot");
+	if (qc_refresh(hdl2, QC_REFRESH_ALL, NULL) >= 0) {
+		printf("Error: qc_refresh() of a snapshot worked\n");
+		err_cnt++;
+	}
+	qc_close(hdl2);
+	// layer type embedded in the CEC layer data, following the 24 byte header and 16 byte layer header
+	*(int *)(buf + 40) = QC_LAYER_TYPE_LPAR;
+	if ((hdl2 = qc_open_from_snapshot(buf, len, &rc)) != NULL || rc >= 0) {
+		printf("Error: qc_open_from_snapshot() with inconsistent layer type worked\n");
+		err_cnt++;
+		qc_close(hdl2);
+	}
+
+out:
+	free(buf);
+}
+
+static void *close_thread(void *hdl) {
+	qc_close(hdl);
+
+	return NULL;
+}
+
+#define STRESS_THREADS	8
+
+struct stress_args {
+	const char *buf;	// snapshot to open handles from
+	size_t len;
+	int layers;
+	int idx;		// index in 'stress_tokens'
+	int errors;
+};
+
+// Tokens of the handles opened by stress_thread(), possibly closed already
+static void *stress_tokens[STRESS_THREADS];
+
+// Open and close handles, using the handles of the other threads meanwhile
+static void *stress_thread(void *arg) {
+	struct stress_args *args = arg;
+	void *hdl;
+	int i, j, rc;
+
+	for (i = 0; i < 1000; i++) {
+		if ((hdl = qc_open_from_snapshot(args->buf, args->len, &rc)) == NULL) {
+			args->errors++;
+			break;
+		}
+		__atomic_store_n(&stress_tokens[args->idx], hdl, __ATOMIC_RELAXED);
+		for (j = 0; j < STRESS_THREADS; j++) {
+			if (qc_get_num_layers(__atomic_load_n(&stress_tokens[j], __ATOMIC_RELAXED), &rc) != args->layers &&
+			    rc != -EFAULT)
+				args->errors++;
+		}
+		qc_close(hdl);
+	}
+
+	return NULL;
+}
+
+// Verify that closing a handle concurrently from multiple threads while in use is safe
+void verify_close(void *hdl, int layers) {
+	struct stress_args args[STRESS_THREADS];
+	pthread_t threads[STRESS_THREADS];
+	char *buf = NULL;
+	int i, j, rc;
+	void *hdl2;
+	size_t len;
+
+	if (qc_save_snapshot(hdl, NULL, 0, &len) != 1 || (buf = malloc(len)) == NULL ||
+	    qc_save_snapshot(hdl, buf, len, &len) != 0) {
+		printf("Error: qc_save_snapshot() failed\n");
+		err_cnt++;
+		goto out;
+	}
+	for (i = 0; i < 100; i++) {
+		if ((hdl2 = qc_open_from_snapshot(buf, len, &rc)) == NULL) {
+			printf("Error: qc_open_from_snapshot() failed, rc=%d\n", rc);
+			err_cnt++;
+			goto out;
+		}
+		for (j = 0; j < 2; j++) {
+			if (pthread_create(&threads[j], NULL, close_thread, hdl2)) {
+				qc_close(hdl2);
+				goto out;
+			}
+		}
+		// use the handle until it is gone
+		while (qc_get_num_layers(hdl2, &rc) == layers);
+		for (j = 0; j < 2; j++)
+			pthread_join(threads[j], NULL);
+		if (rc != -EFAULT) {
+			printf("Error: qc_get_num_layers() on a closed handle returned rc=%d\n", rc);
+			err_cnt++;
+		}
+	}
+	// open, use and close handles concurrently, including handles being closed by others
+	for (i = 0; i < STRESS_THREADS; i++) {
+		args[i].buf = buf;
+		args[i].len = len;
+		args[i].layers = layers;
+		args[i].idx = i;
+		args[i].errors = 0;
+		if (pthread_create(&threads[i], NULL, stress_thread, &args[i]))
+			break;
+	}
+	for (j = 0; j < i; j++) {
+		pthread_join(threads[j], NULL);
+		if (args[j].errors) {
+			printf("Error: %d concurrent handle operation(s) failed in thread %d\n", args[j].errors, j);
+			err_cnt++;
+		}
+	}
+
+out:
+	free(buf);
+}
+
+// Verify that opening the dump in QC_USE_DUMP from memory provides identical data
+void verify_dump(void *hdl, int layers) {
+	struct qc_dump dump;
+	const char *dir;
+	void *hdl2;
+	int rc;
+
+	if ((dir = getenv("QC_USE_DUMP")) == NULL)
+		return;
+	if ((hdl2 = qc_open_from_dump(NULL, &rc)) != NULL || rc >= 0) {
+		printf("Error: qc_open_from_dump(NULL, ...) worked\n");
+		err_cnt++;
+		qc_close(hdl2);
+	}
+	if (rc == -ENOTSUP)
+		return;
+	if (qc_read_dump("/nonexistent", &dump) >= 0) {
+		printf("Error: qc_read_dump() with invalid path worked\n");
+		err_cnt++;
+	}
+	if ((rc = qc_read_dump(dir, &dump)) != 0) {
+		printf("Error: qc_read_dump() failed, rc=%d\n", rc);
+		err_cnt++;
+		return;
+	}
+	if ((hdl2 = qc_open_from_dump(&dump, &rc)) == NULL || rc != 0) {
+		printf("Error: qc_open_from_dump() failed, rc=%d\n", rc);
+		err_cnt++;
+		goto out;
+	}
+	compare_hdls(hdl, hdl2, layers, "in-memory dump");
+	qc_close(hdl2);
+
+out:
+	qc_free_dump(&dump);
+}
+
+// Read the content of stream 'fp' into a newly allocated buffer
+static char *read_stream(FILE *fp) {
+	char *buf;
+	long len;
+
+	if (fseek(fp, 0, SEEK_END) || (len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET))
+		return NULL;
+	if ((buf = malloc(len + 1)) == NULL)
+		return NULL;
+	if (fread(buf, 1, len, fp) != (size_t)len) {
+		free(buf);
+		return NULL;
+	}
+	buf[len] = '\0';
+
+	return buf;
+}
+
+// Verify that all variants of the JSON export produce identical output
+void verify_json(void *hdl) {
+	int rc, flags, flag_sets[] = { 0, QC_JSON_COMPACT, QC_JSON_ALL };
+	char *buf = NULL, *str, small[16];
+	size_t len, len2;
+	unsigned int i;
+	FILE *fp;
+
+	if (qc_export_json_buf(NULL, NULL, 0, &len, 0) >= 0) {
+		printf("Error: qc_export_json_buf(NULL, ...) worked\n");
+		err_cnt++;
+	}
+	if (qc_export_json_buf(hdl, NULL, 0, &len, ~QC_JSON_ALL) >= 0) {
+		printf("Error: qc_export_json_buf() with invalid flags worked\n");
+		err_cnt++;
+	}
+	for (i = 0; i < sizeof(flag_sets) / sizeof(flag_sets[0]); i++) {
+		flags = flag_sets[i];
+		if ((rc = qc_export_json_buf(hdl, NULL, 0, &len, flags)) != 1) {
+			printf("Error: qc_export_json_buf() failed to determine size, rc=%d\n", rc);
+			err_cnt++;
+			return;
+		}
+		buf = malloc(len + 1);
+		if (!buf)
+			return;
+		if ((rc = qc_export_json_buf(hdl, buf, len + 1, &len2, flags)) != 0 || len2 != len || strlen(buf) != len) {
+			printf("Error: qc_export_json_buf() failed, rc=%d\n", rc);
+			err_cnt++;
+			goto out;
+		}
+		if ((rc = qc_export_json_buf(hdl, small, sizeof(small), &len2, flags)) != 1 || len2 != len ||
+		    strncmp(small, buf, sizeof(small) - 1) || small[sizeof(small) - 1] != '\0') {
+			printf("Error: qc_export_json_buf() with small buffer failed, rc=%d\n", rc);
+			err_cnt++;
+		}
+		if ((flags & QC_JSON_COMPACT) && strchr(buf, '\n')) {
+			printf("Error: qc_export_json_buf() output not compact\n");
+			err_cnt++;
+		}
+		if (!flags && buf[len - 1] != '\n') {
+			printf("Error: qc_export_json_buf() output lacks trailing newline\n");
+			err_cnt++;
+		}
+		if ((fp = tmpfile()) == NULL)
+			goto out;
+		if ((rc = qc_export_json_file(hdl, fp, flags)) != 0 || (str = read_stream(fp)) == NULL) {
+			printf("Error: qc_export_json_file() failed, rc=%d\n", rc);
+			err_cnt++;
+		} else {
+			if (strcmp(str, buf)) {
+				printf("Error: qc_export_json_file() output differs\n");
+				err_cnt++;
+			}
+			free(str);
+		}
+		fclose(fp);
+		if ((fp = tmpfile()) == NULL)
+			goto out;
+		if ((rc = qc_export_json_fd(hdl, fileno(fp), flags)) != 0 || (str = read_stream(fp)) == NULL) {
+			printf("Error: qc_export_json_fd() failed, rc=%d\n", rc);
+			err_cnt++;
+		} else {
+			if (strcmp(str, buf)) {
+				printf("Error: qc_export_json_fd() output differs\n");
+				err_cnt++;
+			}
+			free(str);
+		}
+		fclose(fp);
+		free(buf);
+		buf = NULL;
+	}
+
+out:
+	free(buf);
+}
+
+// Verify that qc_get_attributes() matches the individual qc_get_attribute_*() calls
+void verify_batch(void *hdl, int layers) {
+	int rc, i, id, num = 0, ival;
+	struct qc_attr_req *reqs;
+	const char *str;
+	float fval;
+
+	if (qc_get_attributes(NULL, NULL, 0) >= 0) {
+		printf("Error: qc_get_attributes(NULL, NULL, 0) worked\n");
+		err_cnt++;
+	}
+	// include one layer beyond the top, and request in descending order to cover lookups
+	reqs = malloc((layers + 1) * (qc_ziip_effective_capacity_layer + 1) * 3 * sizeof(struct qc_attr_req));
+	if (!reqs)
+		return;
+	for (i = layers; i >= 0; --i) {
+		for (id = 0; id <= qc_ziip_effective_capacity_layer; ++id) {
+			reqs[num].id = id;
+			reqs[num].layer = i;
+			reqs[num++].type = QC_ATTR_TYPE_INT;
+			reqs[num].id = id;
+			reqs[num].layer = i;
+			reqs[num++].type = QC_ATTR_TYPE_FLOAT;
+			reqs[num].id = id;
+			reqs[num].layer = i;
+			reqs[num++].type = QC_ATTR_TYPE_STRING;
+		}
+	}
+	if ((rc = qc_get_attributes(hdl, reqs, num)) != 0) {
+		printf("Error: qc_get_attributes() failed, rc=%d\n", rc);
+		err_cnt++;
+		goto out;
+	}
+	for (i = 0; i < num; ++i) {
+		switch (reqs[i].type) {
+		case QC_ATTR_TYPE_INT:
+			rc = qc_get_attribute_int(hdl, reqs[i].id, reqs[i].layer, &ival);
+			if (rc != reqs[i].rc || ival != reqs[i].value.i)
+				break;
+			continue;
+		case QC_ATTR_TYPE_FLOAT:
+			rc = qc_get_attribute_float(hdl, reqs[i].id, reqs[i].layer, &fval);
+			if (rc != reqs[i].rc || fval != reqs[i].value.f)
+				break;
+			continue;
+		case QC_ATTR_TYPE_STRING:
+			rc = qc_get_attribute_string(hdl, reqs[i].id, reqs[i].layer, &str);
+			if (rc != reqs[i].rc || str != reqs[i].value.s)
+				break;
+			continue;
+		}
+		printf("Error: qc_get_attributes() differs for attribute %s in layer %d\n",
+			attr2char(reqs[i].id), reqs[i].layer);
+		err_cnt++;
+	}
+
+out:
+	free(reqs);
+}
+
 void print_int_attr(void *hdl, enum qc_attr_id id, char *src, int layer, int indent) {
 	int rc, val;
 	float f;
@@ -471,6 +1111,21 @@ void print_string_attr(void *hdl, enum qc_attr_id id, char *src, int layer, int
 	}
 }
 
+// Effective capacities are only computed for the topmost layer
+void print_effective_capacity(void *hdl, int layer, int indent) {
+	int rc;
+
+	if (layer != qc_get_num_layers(hdl, &rc) - 1)
+		return;
+	print_break();
+	print_int_attr(hdl, qc_cp_effective_capacity, "n/a", layer, indent);
+	print_int_attr(hdl, qc_cp_effective_capacity_layer, "n/a", layer, indent);
+	print_int_attr(hdl, qc_ifl_effective_capacity, "n/a", layer, indent);
+	print_int_attr(hdl, qc_ifl_effective_capacity_layer, "n/a", layer, indent);
+	print_int_attr(hdl, qc_ziip_effective_capacity, "n/a", layer, indent);
+	print_int_attr(hdl, qc_ziip_effective_capacity_layer, "n/a", layer, indent);
+}
+
 void print_cec_information(void *hdl, int layer, int indent) {
 	print_header(indent, layer, "CEC");
 	indent += 2;
@@ -586,6 +1241,8 @@ void print_lpar_information(void *hdl, int layer, int indent) {
 	print_int_attr(hdl, qc_ziip_absolute_capping, "  V", layer, indent);
 	print_int_attr(hdl, qc_ziip_weight_capping, "  V", layer, indent);
 
+	print_effective_capacity(hdl, layer, indent);
+
 	// check an attribute that only exists at a different layer
 	verify_nonexistence(hdl, qc_secondary_capability, layer);
 }
@@ -625,6 +1282,8 @@ void print_zvmhyp_information(void *hdl, int layer, int indent) {
 	print_int_attr(hdl, qc_num_ifl_threads, "  V", layer, indent);
 	print_int_attr(hdl, qc_num_ziip_threads, "  V", layer, indent);
 
+	print_effective_capacity(hdl, layer, indent);
+
 	// check an attribute that only exists at a different layer
 	verify_nonexistence(hdl, qc_cp_absolute_capping, layer);
 }
@@ -751,6 +1410,8 @@ void print_zoszcxserver_information(void *hdl, int layer, int indent) {
 	print_break();
 	print_int_attr(hdl, qc_has_multiple_cpu_types,	"  V", layer, indent);
 
+	print_effective_capacity(hdl, layer, indent);
+
 	// check an attribute that only exists at a different layer
 	verify_nonexistence(hdl, qc_cp_absolute_capping, layer);
 }
@@ -802,6 +1463,8 @@ void print_zvmguest_information(void *hdl, int layer, int indent) {
 	print_break();
 	print_int_attr(hdl, qc_has_multiple_cpu_types,	"  V", layer, indent);
 
+	print_effective_capacity(hdl, layer, indent);
+
 	// check an attribute that only exists at a different layer
 	verify_nonexistence(hdl, qc_cp_absolute_capping, layer);
 }
@@ -829,6 +1492,8 @@ void print_kvmhyp_information(void *hdl, int layer, int indent) {
 	print_int_attr(hdl, qc_num_ifl_dedicated,	"S V", layer, indent);
 	print_int_attr(hdl, qc_num_ifl_shared,		"S V", layer, indent);
 
+	print_effective_capacity(hdl, layer, indent);
+
 	// check an attribute that only exists at a different layer
 	verify_nonexistence(hdl, qc_cp_absolute_capping, layer);
 }
@@ -862,6 +1527,8 @@ void print_kvmguest_information(void *hdl, int layer, int indent) {
 	print_break();
 	print_int_attr(hdl, qc_ifl_dispatch_type,	"SHV", layer, indent);
 
+	print_effective_capacity(hdl, layer, indent);
+
 	// check an attribute that only exists at a different layer
 	verify_nonexistence(hdl, qc_cp_absolute_capping, layer);
 }
@@ -976,6 +1643,16 @@ static void *run_test(int quiet, int fulltest) {
 			err_cnt++;
 		}
 	}
+	verify_refresh(hdl, layers, fulltest);
+	verify_stats(hdl);
+	verify_history(hdl, layers);
+	verify_watch(fulltest);
+	verify_publish(hdl, layers);
+	verify_batch(hdl, layers);
+	verify_json(hdl);
+	verify_snapshot(hdl, layers);
+	verify_close(hdl, layers);
+	verify_dump(hdl, layers);
 	if (fulltest) {
 		// finally, get another handle before closing the existing one
 		if (get_handle(&hdl2, &layers, quiet) != 0)
@@ -0,0 +1,110 @@
+/* Copyright IBM Corp. 2020 */
+
+#include <signal.h>
+#include <unistd.h>
+
+#include "zhypinfo.h"
+
+#define QCD_DEFAULT_FILE	"/dev/shm/qclib"
+#define QCD_DEFAULT_INTERVAL	10
+
+
+static volatile sig_atomic_t stop = 0;
+
+static void handle_signal(int sig) {
+	stop = 1;
+}
+
+static void print_help() {
+	printf("\n");
+	printf("Usage: qcd [OPTIONS]\n");
+	printf("\n");
+	printf("Periodically publish capacity data for use by other processes.\n");
+	printf("\n");
+	printf("  -d, --debug          Increase debug level\n");
+	printf("  -f, --file <FILE>    Publish to FILE (default: %s)\n", QCD_DEFAULT_FILE);
+	printf("  -h, --help           Print usage information and exit\n");
+	printf("  -i, --interval <N>   Refresh data every N seconds (default: %d)\n", QCD_DEFAULT_INTERVAL);
+	printf("  -v, --version        Print version information\n");
+	printf("\n");
+}
+
+static void print_version() {
+	printf("qcd utility, qclib-%s\n", QC_VERSION);
+}
+
+int main(int argc, char **argv) {
+	static struct option long_options[] = {
+		{ "debug",		no_argument,	   NULL, 'd'},
+		{ "file",		required_argument, NULL, 'f'},
+		{ "help",		no_argument,	   NULL, 'h'},
+		{ "interval",		required_argument, NULL, 'i'},
+		{ "version",		no_argument,	   NULL, 'v'},
+		{ 0,			0,		   0,	 0  }
+	};
+	int layers, rc = 0, dbg = 0, interval = QCD_DEFAULT_INTERVAL;
+	const char *file = QCD_DEFAULT_FILE;
+	struct sigaction sa;
+	void *hdl = NULL;
+	char *end;
+	int c;
+
+	setenv("QC_DEBUG_CONSOLE", "1", 1);
+
+	while ((c = getopt_long(argc, argv, "df:hi:v", long_options, NULL)) != EOF) {
+		switch (c) {
+		case 'd': dbg++;
+			  break;
+		case 'f': file = optarg;
+			  break;
+		case 'h': print_help();
+			  return 0;
+		case 'i': interval = strtol(optarg, &end, 10);
+			  if (*end != '\0' || interval <= 0) {
+				fprintf(stderr, "Error: Invalid interval '%s'\n", optarg);
+				return 1;
+			  }
+			  break;
+		case 'v': print_version();
+			  return 0;
+		default:  print_help();
+			  return 1;
+		}
+	}
+	if (dbg == 1)
+		setenv("QC_DEBUG", "1", 1);
+	if (dbg > 1)
+		setenv("QC_DEBUG", "2", 1);
+	// we are the source of the published data, so don't consume it
+	unsetenv("QC_USE_SHM");
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if ((rc = get_handle(&hdl, &layers)) != 0)
+		goto out;
+	while (!stop) {
+		// readers consider data stale once we missed a few updates
+		if ((rc = qc_publish(hdl, file, 3 * interval)) != 0) {
+			fprintf(stderr, "Error: Could not publish capacity data to '%s', rc=%d\n", file, rc);
+			goto out;
+		}
+		do {
+			sleep(interval);
+			if (stop)
+				break;
+			rc = qc_refresh(hdl, QC_REFRESH_ALL, NULL);
+			if (rc)
+				fprintf(stderr, "Warning: Could not refresh capacity data, rc=%d\n", rc);
+		} while (rc);
+	}
+	unlink(file);
+	rc = 0;
+
+out:
+	qc_close(hdl);
+
+	return rc;
+}
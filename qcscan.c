@@ -0,0 +1,458 @@
+/* Copyright IBM Corp. 2020 */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "zhypinfo.h"
+
+#define QCSCAN_MAX_THREADS	256
+
+
+enum qcscan_format {
+	QCSCAN_CSV,
+	QCSCAN_JSON
+};
+
+struct qcscan_job {
+	char	*path;
+	int	 tarball;	// 'path' is a tarball as created by qc_dump
+	int	 rc;
+	char	*out;		// rows of all layers
+	size_t	 out_len;
+};
+
+struct qcscan_column {
+	const char		*name;
+	enum qc_attr_id		 id;
+	enum qc_attr_type	 type;
+};
+
+static const struct qcscan_column columns[] = {
+	{"layer_type",		qc_layer_type,		QC_ATTR_TYPE_STRING},
+	{"layer_category",	qc_layer_category,	QC_ATTR_TYPE_STRING},
+	{"layer_name",		qc_layer_name,		QC_ATTR_TYPE_STRING},
+	{"num_core_total",	qc_num_core_total,	QC_ATTR_TYPE_INT},
+	{"num_cpu_total",	qc_num_cpu_total,	QC_ATTR_TYPE_INT},
+	{"num_cpu_dedicated",	qc_num_cpu_dedicated,	QC_ATTR_TYPE_INT},
+	{"num_cpu_shared",	qc_num_cpu_shared,	QC_ATTR_TYPE_INT},
+	{"num_cp_total",	qc_num_cp_total,	QC_ATTR_TYPE_INT},
+	{"num_ifl_total",	qc_num_ifl_total,	QC_ATTR_TYPE_INT},
+	{"num_ziip_total",	qc_num_ziip_total,	QC_ATTR_TYPE_INT},
+	{"cp_capped_capacity",	qc_cp_capped_capacity,	QC_ATTR_TYPE_INT},
+	{"ifl_capped_capacity",	qc_ifl_capped_capacity,	QC_ATTR_TYPE_INT},
+	{"ziip_capped_capacity", qc_ziip_capped_capacity, QC_ATTR_TYPE_INT},
+	{"cp_absolute_capping",	qc_cp_absolute_capping,	QC_ATTR_TYPE_INT},
+	{"ifl_absolute_capping", qc_ifl_absolute_capping, QC_ATTR_TYPE_INT},
+	{"capping",		qc_capping,		QC_ATTR_TYPE_STRING},
+	{"capability",		qc_capability,		QC_ATTR_TYPE_FLOAT},
+};
+#define QCSCAN_NUM_COLUMNS	(sizeof(columns) / sizeof(columns[0]))
+
+static struct qcscan_job *jobs;
+static unsigned int num_jobs;
+static unsigned int max_jobs;
+static unsigned int next_job;	// next job to be picked up by a worker
+static enum qcscan_format format = QCSCAN_CSV;
+static int add_failed;
+
+
+static void print_help() {
+	printf("\n");
+	printf("Usage: qcscan [OPTIONS] <PATH>...\n");
+	printf("\n");
+	printf("Print capacity data of all layers in qclib dumps found in PATHs.\n");
+	printf("\n");
+	printf("  -d, --debug          Increase debug level\n");
+	printf("  -h, --help           Print usage information and exit\n");
+	printf("  -j, --json           Print data in JSON format (default: CSV)\n");
+	printf("  -t, --threads <N>    Process dumps with N threads (default: number of CPUs)\n");
+	printf("  -v, --version        Print version information\n");
+	printf("\n");
+}
+
+static void print_version() {
+	printf("qcscan utility, qclib-%s\n", QC_VERSION);
+}
+
+static int add_job(const char *path, int tarball) {
+	struct qcscan_job *tmp;
+
+	if (num_jobs == max_jobs) {
+		max_jobs = max_jobs ? 2 * max_jobs : 64;
+		if ((tmp = realloc(jobs, max_jobs * sizeof(struct qcscan_job))) == NULL)
+			return -1;
+		jobs = tmp;
+	}
+	memset(&jobs[num_jobs], 0, sizeof(struct qcscan_job));
+	if ((jobs[num_jobs].path = strdup(path)) == NULL)
+		return -1;
+	jobs[num_jobs++].tarball = tarball;
+
+	return 0;
+}
+
+static int is_tarball(const char *path) {
+	static const char *exts[] = { ".tgz", ".tar.gz", ".tar" };
+	size_t len = strlen(path), ext_len;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(exts) / sizeof(exts[0]); i++) {
+		ext_len = strlen(exts[i]);
+		if (len > ext_len && strcmp(path + len - ext_len, exts[i]) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+// Dump directories always include the content of /proc/sysinfo
+static int is_dump_dir(const char *path) {
+	char fname[PATH_MAX + sizeof("/sysinfo")];
+
+	snprintf(fname, sizeof(fname), "%s/sysinfo", path);
+
+	return access(fname, R_OK) == 0;
+}
+
+static int add_path(const char *path, const struct stat *sb, int type, struct FTW *ftw) {
+	int rc = 0;
+
+	if (type == FTW_D && is_dump_dir(path)) {
+		rc = add_job(path, 0);
+		type = FTW_SKIP_SUBTREE;
+	} else if (type == FTW_F && is_tarball(path))
+		rc = add_job(path, 1);
+	else if (type == FTW_DNR)
+		fprintf(stderr, "Warning: Could not read directory '%s'\n", path);
+	if (rc) {
+		add_failed = 1;
+		return FTW_STOP;
+	}
+
+	return type == FTW_SKIP_SUBTREE ? FTW_SKIP_SUBTREE : FTW_CONTINUE;
+}
+
+static int remove_path(const char *path, const struct stat *sb, int type, struct FTW *ftw) {
+	return remove(path);
+}
+
+// Tarballs might come from elsewhere, so accept plain files and directories only
+static int check_path(const char *path, const struct stat *sb, int type, struct FTW *ftw) {
+	if ((type != FTW_F && type != FTW_D) || (type == FTW_F && !S_ISREG(sb->st_mode))) {
+		fprintf(stderr, "Error: '%s' is neither a regular file nor a directory\n", path);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Extract tarball 'path' into a new temporary directory 'tmp', and return the
+   location of the dump therein in 'dir' */
+static int extract_tarball(const char *path, char *tmp, char *dir, size_t dir_len) {
+	char *argv[] = { "tar", "--no-same-owner", "--no-same-permissions", "-xf", (char *)path, "-C", tmp, NULL };
+	struct dirent *de;
+	int status, rc = 0;
+	DIR *dp;
+	pid_t pid;
+
+	if (posix_spawnp(&pid, "tar", NULL, NULL, argv, environ))
+		return -1;
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+		return -2;
+	if (nftw(tmp, check_path, 16, FTW_PHYS))
+		return -5;
+	// qc_dump packs the dump directory, not its content
+	if ((dp = opendir(tmp)) == NULL)
+		return -3;
+	rc = -4;
+	while ((de = readdir(dp)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(dir, dir_len, "%s/%s", tmp, de->d_name);
+		if (is_dump_dir(dir)) {
+			rc = 0;
+			break;
+		}
+	}
+	closedir(dp);
+
+	return rc;
+}
+
+static void print_str(FILE *fp, const char *str) {
+	const char *c;
+
+	if (format == QCSCAN_JSON) {
+		fputc('"', fp);
+		for (c = str; *c; c++) {
+			if (*c == '"' || *c == '\\')
+				fprintf(fp, "\\%c", *c);
+			else if ((unsigned char)*c < 0x20)
+				fprintf(fp, "\\u%04x", *c);
+			else
+				fputc(*c, fp);
+		}
+		fputc('"', fp);
+		return;
+	}
+	if (!strpbrk(str, ",\"\n")) {
+		fputs(str, fp);
+		return;
+	}
+	fputc('"', fp);
+	for (c = str; *c; c++) {
+		if (*c == '"')
+			fputc('"', fp);
+		fputc(*c, fp);
+	}
+	fputc('"', fp);
+}
+
+static void print_header(void) {
+	unsigned int i;
+
+	if (format == QCSCAN_JSON) {
+		printf("[");
+		return;
+	}
+	printf("dump,layer");
+	for (i = 0; i < QCSCAN_NUM_COLUMNS; i++)
+		printf(",%s", columns[i].name);
+	printf("\n");
+}
+
+static void print_row(FILE *fp, struct qcscan_job *job, int layer, struct qc_attr_req *reqs) {
+	unsigned int i;
+
+	if (format == QCSCAN_JSON) {
+		// the separator is dropped for the first row when printing
+		fprintf(fp, ",\n  {\"dump\": ");
+		print_str(fp, job->path);
+		fprintf(fp, ", \"layer\": %d", layer);
+	} else {
+		print_str(fp, job->path);
+		fprintf(fp, ",%d", layer);
+	}
+	for (i = 0; i < QCSCAN_NUM_COLUMNS; i++) {
+		if (format == QCSCAN_JSON)
+			fprintf(fp, ", \"%s\": ", columns[i].name);
+		else
+			fputc(',', fp);
+		if (reqs[i].rc <= 0) {
+			if (format == QCSCAN_JSON)
+				fprintf(fp, "null");
+			continue;
+		}
+		switch (columns[i].type) {
+		case QC_ATTR_TYPE_INT:
+			fprintf(fp, "%d", reqs[i].value.i);
+			break;
+		case QC_ATTR_TYPE_FLOAT:
+			fprintf(fp, "%f", reqs[i].value.f);
+			break;
+		case QC_ATTR_TYPE_STRING:
+			print_str(fp, reqs[i].value.s);
+			break;
+		}
+	}
+	fprintf(fp, format == QCSCAN_JSON ? "}" : "\n");
+}
+
+static void process_job(struct qcscan_job *job) {
+	struct qc_attr_req reqs[QCSCAN_NUM_COLUMNS];
+	char tmp[PATH_MAX] = "", dir[PATH_MAX];
+	const char *path = job->path;
+	int rc, layer, layers;
+	struct qc_dump dump;
+	void *hdl = NULL;
+	unsigned int i;
+	FILE *fp;
+
+	if (job->tarball) {
+		snprintf(tmp, sizeof(tmp), "%s/qcscan-XXXXXX", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+		if (!mkdtemp(tmp)) {
+			tmp[0] = '\0';
+			job->rc = -errno;
+			return;
+		}
+		if ((job->rc = extract_tarball(job->path, tmp, dir, sizeof(dir))) != 0)
+			goto out;
+		path = dir;
+	}
+	if ((job->rc = qc_read_dump(path, &dump)) != 0)
+		goto out;
+	hdl = qc_open_from_dump(&dump, &job->rc);
+	qc_free_dump(&dump);
+	if (job->rc)
+		goto out;
+	layers = qc_get_num_layers(hdl, &rc);
+	if (rc) {
+		job->rc = rc;
+		goto out;
+	}
+	if ((fp = open_memstream(&job->out, &job->out_len)) == NULL) {
+		job->rc = -errno;
+		goto out;
+	}
+	for (layer = 0; layer < layers; layer++) {
+		for (i = 0; i < QCSCAN_NUM_COLUMNS; i++) {
+			reqs[i].id = columns[i].id;
+			reqs[i].layer = layer;
+			reqs[i].type = columns[i].type;
+		}
+		if ((job->rc = qc_get_attributes(hdl, reqs, QCSCAN_NUM_COLUMNS)) != 0)
+			break;
+		print_row(fp, job, layer, reqs);
+	}
+	fclose(fp);
+
+out:
+	qc_close(hdl);
+	if (tmp[0])
+		nftw(tmp, remove_path, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static void *worker(void *arg) {
+	unsigned int i;
+
+	while ((i = __atomic_fetch_add(&next_job, 1, __ATOMIC_RELAXED)) < num_jobs)
+		process_job(&jobs[i]);
+
+	return NULL;
+}
+
+static int cmp_jobs(const void *a, const void *b) {
+	return strcmp(((const struct qcscan_job *)a)->path, ((const struct qcscan_job *)b)->path);
+}
+
+int main(int argc, char **argv) {
+	static struct option long_options[] = {
+		{ "debug",		no_argument,	   NULL, 'd'},
+		{ "help",		no_argument,	   NULL, 'h'},
+		{ "json",		no_argument,	   NULL, 'j'},
+		{ "threads",		required_argument, NULL, 't'},
+		{ "version",		no_argument,	   NULL, 'v'},
+		{ 0,			0,		   0,	 0  }
+	};
+	pthread_t threads[QCSCAN_MAX_THREADS];
+	int rc = 0, dbg = 0, failed = 0, rows = 0, skip;
+	long num_threads = 0;
+	unsigned int i;
+	struct stat sb;
+	char *end;
+	int c;
+
+	setenv("QC_DEBUG_CONSOLE", "1", 1);
+
+	while ((c = getopt_long(argc, argv, "dhjt:v", long_options, NULL)) != EOF) {
+		switch (c) {
+		case 'd': dbg++;
+			  break;
+		case 'h': print_help();
+			  return 0;
+		case 'j': format = QCSCAN_JSON;
+			  break;
+		case 't': num_threads = strtol(optarg, &end, 10);
+			  if (*end != '\0' || num_threads <= 0 || num_threads > QCSCAN_MAX_THREADS) {
+				fprintf(stderr, "Error: Invalid number of threads '%s'\n", optarg);
+				return 1;
+			  }
+			  break;
+		case 'v': print_version();
+			  return 0;
+		default:  print_help();
+			  return 1;
+		}
+	}
+	if (optind == argc) {
+		fprintf(stderr, "Error: No path specified\n");
+		print_help();
+		return 1;
+	}
+	if (dbg == 1)
+		setenv("QC_DEBUG", "1", 1);
+	if (dbg > 1)
+		setenv("QC_DEBUG", "2", 1);
+	// dumps are passed to the library explicitly
+	unsetenv("QC_USE_DUMP");
+	unsetenv("QC_USE_SHM");
+	qc_open_from_dump(NULL, &rc);
+	if (rc == -ENOTSUP) {
+		fprintf(stderr, "Error: qclib was compiled without support for reading dumps\n");
+		return 1;
+	}
+	rc = 0;
+
+	for (; optind < argc; optind++) {
+		if (stat(argv[optind], &sb)) {
+			fprintf(stderr, "Error: Could not access '%s': %s\n", argv[optind], strerror(errno));
+			rc = 1;
+			goto out;
+		}
+		if (S_ISDIR(sb.st_mode))
+			nftw(argv[optind], add_path, 64, FTW_PHYS | FTW_ACTIONRETVAL);
+		else if (add_job(argv[optind], 1))
+			add_failed = 1;
+		if (add_failed) {
+			fprintf(stderr, "Error: Failed to allocate memory\n");
+			rc = 1;
+			goto out;
+		}
+	}
+	// workers finish in arbitrary order, so sort to get stable output
+	qsort(jobs, num_jobs, sizeof(struct qcscan_job), cmp_jobs);
+
+	if (!num_threads)
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_threads > QCSCAN_MAX_THREADS)
+		num_threads = QCSCAN_MAX_THREADS;
+	if (num_threads > num_jobs)
+		num_threads = num_jobs;
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, worker, NULL))
+			break;
+	}
+	// process the remaining jobs ourselves, in particular if we failed to start any thread
+	worker(NULL);
+	num_threads = i;
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	print_header();
+	for (i = 0; i < num_jobs; i++) {
+		if (jobs[i].rc) {
+			fprintf(stderr, "Error: Could not process dump '%s', rc=%d\n", jobs[i].path, jobs[i].rc);
+			failed++;
+		}
+		// emit partial data, too
+		if (jobs[i].out_len) {
+			skip = format == QCSCAN_JSON && !rows;
+			fwrite(jobs[i].out + skip, 1, jobs[i].out_len - skip, stdout);
+			rows = 1;
+		}
+	}
+	if (format == QCSCAN_JSON)
+		printf("\n]\n");
+	if (failed) {
+		fprintf(stderr, "%d of %u dump(s) could not be processed\n", failed, num_jobs);
+		rc = 2;
+	}
+
+out:
+	for (i = 0; i < num_jobs; i++) {
+		free(jobs[i].path);
+		free(jobs[i].out);
+	}
+	free(jobs);
+
+	return rc;
+}
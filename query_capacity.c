@@ -3,33 +3,57 @@
 #define _GNU_SOURCE
 
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
 
 #include "query_capacity_data.h"
 
+#define QC_DEFAULT_RETRIES	2
+#define QC_MAX_RETRIES		10
+#define QC_MAX_RETRY_DELAY	1000	// in milliseconds
+
 
 long  qc_dbg_level;
 FILE *qc_dbg_file;
 char *qc_dbg_dump_dir;
-int   qc_dbg_indent;
+__thread int qc_dbg_indent;	// thread-local, as data sources may be opened concurrently
 char *qc_dbg_use_dump;
 int   qc_dbg_console;
 int   qc_consistency_check_requested;
 static char	    *qc_dbg_file_name;
 static long	     qc_dbg_autodump;
 static unsigned int  qc_dbg_dump_idx;
-static iconv_t	     qc_cd = (iconv_t)-1;
-
-struct qc_reg_hdl {
-	struct qc_handle	*hdl;
-	struct qc_reg_hdl	*next;
+static long	     qc_dbg_ring_size;
+static struct qc_stats qc_stats;	// cumulative statistics of all handles
+
+/*
+ * Registry of open handles. Callers don't receive a pointer to a handle, but a
+ * token encoding the index of the registry slot and the slot's generation,
+ * which is bumped whenever the slot is released. Hence tokens can be validated
+ * in constant time and without any locks, and become invalid once closed.
+ * Each API call holds a reference on the slot, and qc_close() waits for all
+ * other references to be dropped before freeing the handle.
+ * Segments of slots are allocated on demand and never freed.
+ */
+#define QC_REG_SEG_SLOTS	4096
+#define QC_REG_NUM_SEGS		256
+#define QC_REG_NUM_SLOTS	(QC_REG_SEG_SLOTS * QC_REG_NUM_SEGS)
+#define QC_REG_IDX_BITS		20	// bits required to hold an index < QC_REG_NUM_SLOTS
+// Slots are retired before the generation in the token wraps, e.g. with 32 bit pointers
+#define QC_REG_MAX_GEN		((UINTPTR_MAX >> QC_REG_IDX_BITS) - 1)
+#define QC_REG_RETIRED		((struct qc_handle *)1)
+
+struct qc_reg_slot {
+	struct qc_handle	*hdl;	// NULL if free, QC_REG_RETIRED if never to be used again
+	unsigned long		 gen;
+	unsigned int		 refs;	// API calls currently using 'hdl'
 };
 
-static struct qc_reg_hdl *qc_hdls = NULL;
-
-static void __attribute__((destructor)) qc_destructor(void) {
-	if (qc_cd != (iconv_t)-1)
-		iconv_close(qc_cd);
-}
+static struct qc_reg_slot *qc_reg_segs[QC_REG_NUM_SEGS];
+static unsigned int	   qc_reg_hint;	// index to start the search for a free slot at
 
 /* Update dbg_level from environment variable */
 static void qc_update_dbg_level(void) {
@@ -63,12 +87,121 @@ static void qc_update_dbg_level(void) {
 	}
 }
 
-static void qc_debug_deinit(void *hdl) {
+/*
+ * Ring buffer for log messages, see QC_DEBUG_RING. Writers claim a record by
+ * incrementing qc_dbg_ring_head, and mark it as complete by setting its
+ * sequence number, so no locks are required. Records still being written
+ * when the ring wraps around are skipped, and their new message is dropped. While writing, they are counted
+ * in qc_dbg_ring_writers, so the ring is only freed once nobody uses it
+ * anymore. The timestamp is only converted when the ring buffer is written to
+ * the log file.
+ */
+#ifndef CLOCK_REALTIME_COARSE
+#define CLOCK_REALTIME_COARSE	CLOCK_REALTIME
+#endif
+#define QC_DBG_REC_LEN		200
+#define QC_DBG_REC_BUSY		(~0UL)	// sequence number of a record being written
+
+struct qc_dbg_rec {
+	unsigned long	 seq;	// position + 1 once complete
+	struct timespec	 ts;
+	void		*hdl;
+	char		 msg[QC_DBG_REC_LEN];
+};
+
+struct qc_dbg_rec *qc_dbg_ring;
+static unsigned long   qc_dbg_ring_head;	// position of next record to write
+static unsigned long   qc_dbg_ring_tail;	// position of next record to flush
+static unsigned long   qc_dbg_ring_writers;	// number of qc_debug_ring_add() in progress
+static pthread_mutex_t qc_dbg_ring_lock = PTHREAD_MUTEX_INITIALIZER;	// serializes flushing
+static pthread_mutex_t qc_dbg_lock = PTHREAD_MUTEX_INITIALIZER;	// serializes (de-)initialization
+
+void qc_debug_ring_add(void *hdl, const char *fmt, ...) {
+	struct qc_dbg_rec *ring, *rec;
+	unsigned long pos, seq;
+	va_list args;
+	int len;
+
+	// pairs with the fence in _qc_debug_deinit(): either it waits for us, or we see the ring is gone
+	__atomic_add_fetch(&qc_dbg_ring_writers, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if ((ring = __atomic_load_n(&qc_dbg_ring, __ATOMIC_ACQUIRE)) == NULL)
+		goto out;
+	pos = __atomic_fetch_add(&qc_dbg_ring_head, 1, __ATOMIC_RELAXED);
+	rec = &ring[pos % qc_dbg_ring_size];
+	seq = __atomic_load_n(&rec->seq, __ATOMIC_RELAXED);
+	if (seq == QC_DBG_REC_BUSY ||
+	    !__atomic_compare_exchange_n(&rec->seq, &seq, QC_DBG_REC_BUSY, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+		goto out;	// another writer still uses the record
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	clock_gettime(CLOCK_REALTIME_COARSE, &rec->ts);
+	rec->hdl = hdl;
+	va_start(args, fmt);
+	len = vsnprintf(rec->msg, sizeof(rec->msg), fmt, args);
+	va_end(args);
+	if (len >= (int)sizeof(rec->msg))
+		rec->msg[sizeof(rec->msg) - 2] = '\n';	// truncated
+	__atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+out:
+	__atomic_sub_fetch(&qc_dbg_ring_writers, 1, __ATOMIC_RELEASE);
+}
+
+// Write all complete records of 'ring' to the log file, requires qc_dbg_ring_lock to be held
+static void _qc_debug_ring_flush(struct qc_dbg_rec *ring) {
+	struct qc_dbg_rec rec, *slot;
+	unsigned long pos, head;
+	struct tm tm;
+
+	if (!ring)
+		return;
+	head = __atomic_load_n(&qc_dbg_ring_head, __ATOMIC_ACQUIRE);
+	pos = qc_dbg_ring_tail;
+	if (head - pos > (unsigned long)qc_dbg_ring_size) {
+		fprintf(qc_dbg_file, "Warning: Log ring buffer overflow, %lu message(s) lost\n",
+			head - pos - qc_dbg_ring_size);
+		pos = head - qc_dbg_ring_size;
+	}
+	for (; pos < head; pos++) {
+		slot = &ring[pos % qc_dbg_ring_size];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+			continue;	// still in progress or overwritten already
+		memcpy(&rec, slot, sizeof(rec));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != pos + 1)
+			continue;
+		rec.msg[sizeof(rec.msg) - 1] = '\0';
+		localtime_r(&rec.ts.tv_sec, &tm);
+		fprintf(qc_dbg_file, "%02d/%02d,%02d:%02d:%02d,%-10p: %s", tm.tm_mon + 1, tm.tm_mday,
+			tm.tm_hour, tm.tm_min, tm.tm_sec, rec.hdl, rec.msg);
+	}
+	qc_dbg_ring_tail = head;
+	fflush(qc_dbg_file);
+}
+
+static void qc_debug_ring_flush(void) {
+	pthread_mutex_lock(&qc_dbg_ring_lock);
+	_qc_debug_ring_flush(__atomic_load_n(&qc_dbg_ring, __ATOMIC_ACQUIRE));
+	pthread_mutex_unlock(&qc_dbg_ring_lock);
+}
+
+static void _qc_debug_deinit(void *hdl) {
+	struct qc_dbg_rec *ring;
+
 	qc_update_dbg_level();
+	qc_debug_ring_flush();
 	if (qc_dbg_level <= 0 && qc_dbg_autodump <= 0 && qc_dbg_file) {
 		qc_dbg_level = 1;	// temporarily set, or qc_debug won't print anything
 		qc_debug(hdl, "Log level set to %ld, closing\n", qc_dbg_level);
 		qc_dbg_level = 0;
+		pthread_mutex_lock(&qc_dbg_ring_lock);
+		ring = __atomic_exchange_n(&qc_dbg_ring, NULL, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		// writers that got hold of the ring finish before we free it
+		while (__atomic_load_n(&qc_dbg_ring_writers, __ATOMIC_ACQUIRE))
+			sched_yield();
+		_qc_debug_ring_flush(ring);
+		free(ring);
+		pthread_mutex_unlock(&qc_dbg_ring_lock);
 		fclose(qc_dbg_file);
 		qc_dbg_file = NULL;
 		free(qc_dbg_dump_dir);
@@ -82,6 +215,12 @@ static void qc_debug_deinit(void *hdl) {
 	qc_dbg_use_dump = NULL;
 }
 
+static void qc_debug_deinit(void *hdl) {
+	pthread_mutex_lock(&qc_dbg_lock);
+	_qc_debug_deinit(hdl);
+	pthread_mutex_unlock(&qc_dbg_lock);
+}
+
 #define QC_DBGFILE		"/tmp/qclib-XXXXXX"
 static int qc_debug_file_init(void) {
 	int fd;
@@ -163,9 +302,11 @@ static void qc_debug_close_dump_dir(struct qc_handle *hdl) {
    closed in qc_close_configuration() when qc_dbg_level is <=0, so that it's left up to the user
    to decide whether a single file is used all the time or individual files created for each
    invocation of the library. */
-static int qc_debug_init(void) {
+static int _qc_debug_init(void) {
 	static int init = 0;
-	char *path = NULL;
+	char *path = NULL, *s, *end;
+	struct qc_dbg_rec *ring;
+	long size;
 	int rc = 0;
 
 	if (!init) {
@@ -189,6 +330,14 @@ static int qc_debug_init(void) {
 		}
 		qc_debug(NULL, "Log level set to %ld\n", qc_dbg_level);
 	}
+	if (qc_dbg_level > 0 && !qc_dbg_ring && (s = getenv("QC_DEBUG_RING")) != NULL) {
+		size = strtol(s, &end, 10);
+		if (end != s && size > 0 && (ring = calloc(size, sizeof(struct qc_dbg_rec)))) {
+			qc_dbg_ring_size = size;
+			__atomic_store_n(&qc_dbg_ring, ring, __ATOMIC_RELEASE);
+			qc_debug(NULL, "Logging to ring buffer of %ld messages\n", size);
+		}
+	}
 	if (qc_dbg_use_dump) {
 		// usage of dump file requested - any error in here is fatal
 		if (access(qc_dbg_use_dump, R_OK | X_OK) == -1) {
@@ -229,6 +378,18 @@ out_err:
 	return rc;
 }
 
+// Handles might be opened and closed in multiple threads at the same time
+static int qc_debug_init(void) {
+	int rc;
+
+	pthread_mutex_lock(&qc_dbg_lock);
+	rc = _qc_debug_init();
+	pthread_mutex_unlock(&qc_dbg_lock);
+
+	return rc;
+}
+
+#ifndef CONFIG_NO_DEBUG
 void qc_debug_indent_inc(void) {
 	qc_dbg_indent += 2;
 }
@@ -236,6 +397,7 @@ void qc_debug_indent_inc(void) {
 void qc_debug_indent_dec(void) {
 	qc_dbg_indent -= 2;
 }
+#endif
 
 void qc_mark_dump_incomplete(struct qc_handle *hdl, char *missing_component) {
 	int rc;
@@ -252,103 +414,179 @@ void qc_mark_dump_incomplete(struct qc_handle *hdl, char *missing_component) {
 	free(cmd);
 }
 
+/* EBCDIC (IBM-1047) to ISO8859-1 translation table */
+static const unsigned char qc_ebcdic_1047[256] = {
+	0x00, 0x01, 0x02, 0x03, 0x9c, 0x09, 0x86, 0x7f,
+	0x97, 0x8d, 0x8e, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x10, 0x11, 0x12, 0x13, 0x9d, 0x85, 0x08, 0x87,
+	0x18, 0x19, 0x92, 0x8f, 0x1c, 0x1d, 0x1e, 0x1f,
+	0x80, 0x81, 0x82, 0x83, 0x84, 0x0a, 0x17, 0x1b,
+	0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x05, 0x06, 0x07,
+	0x90, 0x91, 0x16, 0x93, 0x94, 0x95, 0x96, 0x04,
+	0x98, 0x99, 0x9a, 0x9b, 0x14, 0x15, 0x9e, 0x1a,
+	0x20, 0xa0, 0xe2, 0xe4, 0xe0, 0xe1, 0xe3, 0xe5,
+	0xe7, 0xf1, 0xa2, 0x2e, 0x3c, 0x28, 0x2b, 0x7c,
+	0x26, 0xe9, 0xea, 0xeb, 0xe8, 0xed, 0xee, 0xef,
+	0xec, 0xdf, 0x21, 0x24, 0x2a, 0x29, 0x3b, 0x5e,
+	0x2d, 0x2f, 0xc2, 0xc4, 0xc0, 0xc1, 0xc3, 0xc5,
+	0xc7, 0xd1, 0xa6, 0x2c, 0x25, 0x5f, 0x3e, 0x3f,
+	0xf8, 0xc9, 0xca, 0xcb, 0xc8, 0xcd, 0xce, 0xcf,
+	0xcc, 0x60, 0x3a, 0x23, 0x40, 0x27, 0x3d, 0x22,
+	0xd8, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67,
+	0x68, 0x69, 0xab, 0xbb, 0xf0, 0xfd, 0xfe, 0xb1,
+	0xb0, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70,
+	0x71, 0x72, 0xaa, 0xba, 0xe6, 0xb8, 0xc6, 0xa4,
+	0xb5, 0x7e, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+	0x79, 0x7a, 0xa1, 0xbf, 0xd0, 0x5b, 0xde, 0xae,
+	0xac, 0xa3, 0xa5, 0xb7, 0xa9, 0xa7, 0xb6, 0xbc,
+	0xbd, 0xbe, 0xdd, 0xa8, 0xaf, 0x5d, 0xb4, 0xd7,
+	0x7b, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47,
+	0x48, 0x49, 0xad, 0xf4, 0xf6, 0xf2, 0xf3, 0xf5,
+	0x7d, 0x4a, 0x4b, 0x4c, 0x4d, 0x4e, 0x4f, 0x50,
+	0x51, 0x52, 0xb9, 0xfb, 0xfc, 0xf9, 0xfa, 0xff,
+	0x5c, 0xf7, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+	0x59, 0x5a, 0xb2, 0xd4, 0xd6, 0xd2, 0xd3, 0xd5,
+	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+	0x38, 0x39, 0xb3, 0xdb, 0xdc, 0xd9, 0xda, 0x9f
+};
+
 /* Convert EBCDIC input to ASCII in place, removing trailing whitespace */
 int qc_ebcdic_to_ascii(struct qc_handle *hdl, char *inbuf, size_t insz) {
-	char *outbuf, *outbuf_start, *inbuf_start = inbuf;
-	size_t len, outsz = insz, insz_orig, outsz_orig;
-	int rc = 0;
+	unsigned char *buf = (unsigned char *)inbuf;
+	size_t i;
 
-	if (!(outbuf_start = malloc(outsz))) {
-		qc_debug(hdl, "Error: Failed to alloc tmp buffer of size %zd for iconv\n", outsz);
-		rc = -1;
-		goto out;
-	}
-	outbuf = outbuf_start;
-	insz_orig = insz;
-	outsz_orig = outsz;
-	len = iconv(qc_cd, &inbuf, &insz, &outbuf, &outsz);
-	if (len == (size_t)(-1)) {
-		qc_debug(hdl, "Error: iconv conversion failed: %s\n", strerror(errno));
-		rc = -2;
-		goto out;
-	}
-
-	// remove trailing whitespace
-	for (len = 0; len < outsz_orig - outsz; ++len)
-		if (outbuf_start[len] == ' ') {
-			outbuf_start[len] = '\0';
-			len++;
+	for (i = 0; i < insz; ++i) {
+		buf[i] = qc_ebcdic_1047[buf[i]];
+		if (buf[i] == ' ') {
+			buf[i] = '\0';
 			break;
 		}
-
-	if (len > insz_orig) {
-		qc_debug(hdl, "Error: iconv result exceeds target buffer (%zd > %zd)\n",
-				len, insz);
-		rc = -3;
-		goto out;
 	}
-	memcpy(inbuf_start, outbuf_start, len);
-
-out:
-       	free(outbuf_start);
 
-	return rc;
+	return 0;
 }
 
-static int qc_hdl_register(struct qc_handle *hdl) {
-	struct qc_reg_hdl *entry;
+// Generation 0 yields an invalid token, catching bogus pointers like 0x1
+static void *qc_reg_token(unsigned int idx, unsigned long gen) {
+	return (void *)(((uintptr_t)(gen + 1) << QC_REG_IDX_BITS) | idx);
+}
 
-	entry = malloc(sizeof(struct qc_reg_hdl));
-	if (!entry) {
-		qc_debug(hdl, "Error: Failed register hdl\n");
-		return -1;
+static struct qc_reg_slot *qc_reg_get_slot(unsigned int idx, int alloc) {
+	struct qc_reg_slot **seg = &qc_reg_segs[idx / QC_REG_SEG_SLOTS], *new, *cur;
+
+	cur = __atomic_load_n(seg, __ATOMIC_ACQUIRE);
+	if (!cur && alloc) {
+		new = calloc(QC_REG_SEG_SLOTS, sizeof(struct qc_reg_slot));
+		if (!new)
+			return NULL;
+		// somebody else might have been faster
+		if (__atomic_compare_exchange_n(seg, &cur, new, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			cur = new;
+		else
+			free(new);
 	}
-	entry->hdl = hdl;
-	if (qc_hdls)
-		entry->next = qc_hdls;
-	else
-		entry->next = NULL;
-	qc_hdls = entry;
 
-	return 0;
+	return cur ? &cur[idx % QC_REG_SEG_SLOTS] : NULL;
 }
 
-static void qc_hdl_unregister(struct qc_handle *hdl) {
-	struct qc_reg_hdl *entry, *prev = NULL;
-
-	for (entry = qc_hdls; entry != NULL; prev = entry, entry = entry->next) {
-		if (entry->hdl == hdl) {
-			if (prev && entry->next)
-				prev->next = entry->next;
-			else if (!prev)
-				qc_hdls = entry->next;
-			else
-				prev->next = NULL;
-			free(entry);
-			break;
+// Returns the token to pass to callers, or NULL if registration failed
+static void *qc_hdl_register(struct qc_handle *hdl) {
+	struct qc_reg_slot *slot;
+	struct qc_handle *cur;
+	unsigned int i, idx;
+
+	idx = __atomic_load_n(&qc_reg_hint, __ATOMIC_RELAXED);
+	for (i = 0; i < QC_REG_NUM_SLOTS; i++, idx = (idx + 1) % QC_REG_NUM_SLOTS) {
+		slot = qc_reg_get_slot(idx, 1);
+		if (!slot) {
+			qc_debug(hdl, "Error: Failed to allocate registry segment\n");
+			return NULL;
+		}
+		cur = NULL;
+		if (__atomic_compare_exchange_n(&slot->hdl, &cur, hdl, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			__atomic_store_n(&qc_reg_hint, (idx + 1) % QC_REG_NUM_SLOTS, __ATOMIC_RELAXED);
+			return qc_reg_token(idx, __atomic_load_n(&slot->gen, __ATOMIC_ACQUIRE));
 		}
 	}
-	return;
+	qc_debug(hdl, "Error: Failed to register hdl, too many open handles\n");
+
+	return NULL;
 }
 
-static int qc_hdl_verify(struct qc_handle *hdl, const char *func) {
-	struct qc_reg_hdl *entry;
+// Returns the slot for 'token', or NULL if invalid
+static struct qc_reg_slot *qc_hdl_lookup(void *token) {
+	struct qc_reg_slot *slot;
+	struct qc_handle *hdl;
+	unsigned int idx;
 
-	if (!hdl)
-		return -1;
-	for (entry = qc_hdls; entry != NULL; entry = entry->next) {
-		if (entry->hdl == hdl)
-			return 0;
+	idx = (uintptr_t)token & ((1 << QC_REG_IDX_BITS) - 1);
+	if (idx >= QC_REG_NUM_SLOTS || (slot = qc_reg_get_slot(idx, 0)) == NULL)
+		return NULL;
+	hdl = __atomic_load_n(&slot->hdl, __ATOMIC_ACQUIRE);
+	if (!hdl || hdl == QC_REG_RETIRED || qc_reg_token(idx, __atomic_load_n(&slot->gen, __ATOMIC_ACQUIRE)) != token)
+		return NULL;
+
+	return slot;
+}
+
+// Drop the reference acquired by qc_hdl_verify()
+static void qc_hdl_put(void *token) {
+	struct qc_reg_slot *slot;
+
+	slot = qc_reg_get_slot((uintptr_t)token & ((1 << QC_REG_IDX_BITS) - 1), 0);
+	__atomic_sub_fetch(&slot->refs, 1, __ATOMIC_RELEASE);
+}
+
+/* Invalidate 'token', which the caller holds a reference on, and wait for all
+   other references to be dropped. Returns the handle to free, or NULL if
+   somebody else closed the handle concurrently. */
+static struct qc_handle *qc_hdl_unregister(void *token) {
+	unsigned int idx = (uintptr_t)token & ((1 << QC_REG_IDX_BITS) - 1);
+	struct qc_reg_slot *slot = qc_reg_get_slot(idx, 0);
+	struct qc_handle *hdl = __atomic_load_n(&slot->hdl, __ATOMIC_ACQUIRE);
+	unsigned long gen = (uintptr_t)token >> QC_REG_IDX_BITS;
+
+	// tokens hold the generation + 1, see qc_reg_token()
+	gen--;
+	if (!__atomic_compare_exchange_n(&slot->gen, &gen, gen + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		qc_hdl_put(token);
+		return NULL;
+	}
+	// pairs with the fence in qc_hdl_verify(): either they see the new generation, or we see their reference
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&slot->refs, __ATOMIC_ACQUIRE) > 1)
+		sched_yield();
+	// late verifiers undo their own references once they see the new generation
+	__atomic_sub_fetch(&slot->refs, 1, __ATOMIC_RELEASE);
+	if (gen + 1 >= QC_REG_MAX_GEN) {
+		qc_debug(hdl, "Retire registry slot %u\n", idx);
+		__atomic_store_n(&slot->hdl, QC_REG_RETIRED, __ATOMIC_RELEASE);
+	} else {
+		__atomic_store_n(&slot->hdl, NULL, __ATOMIC_RELEASE);
+		__atomic_store_n(&qc_reg_hint, idx, __ATOMIC_RELAXED);
 	}
-	qc_debug(NULL, "Error: %s() called with unknown handle %p\n", func, hdl);
 
-	return -1;
+	return hdl;
 }
 
-// De-alloc hdl, leaving out the actual handle
-static void qc_hdl_reinit(struct qc_handle *hdl) {
-	qc_hdl_prune(hdl);
-	qc_hdl_unregister(hdl);
+/* Returns the handle for 'token' with a reference held, which must be dropped
+   with qc_hdl_put(), or NULL if invalid */
+static struct qc_handle *qc_hdl_verify(void *token, const char *func) {
+	struct qc_reg_slot *slot;
+
+	if (!token)
+		return NULL;
+	if ((slot = qc_hdl_lookup(token)) != NULL) {
+		__atomic_add_fetch(&slot->refs, 1, __ATOMIC_SEQ_CST);
+		// the handle might have been closed in the meantime, see qc_hdl_unregister()
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (qc_hdl_lookup(token) == slot)
+			return __atomic_load_n(&slot->hdl, __ATOMIC_ACQUIRE);
+		__atomic_sub_fetch(&slot->refs, 1, __ATOMIC_RELEASE);
+	}
+	qc_debug(NULL, "Error: %s() called with unknown handle %p\n", func, token);
+
+	return NULL;
 }
 
 /** Verifies that either a and (b or c), or none are set. I.e. if only one of the attributes is set, then that's an error */
@@ -423,13 +661,125 @@ static int qc_verify(struct qc_handle *hdl, enum qc_attr_id a, enum qc_attr_id b
 	return 0;
 }
 
+enum qc_rule_op {
+	QC_RULE_END = 0,
+	QC_RULE_LE,	// a + b + c <= d, see qc_verify()
+	QC_RULE_EQ,	// a + b + c = d, see qc_verify()
+	QC_RULE_CAPPED,	// see qc_verify_capped_capacity()
+};
+
+// Consistency rule; unused attributes are set to ATTR_UNDEF
+struct qc_rule {
+	enum qc_rule_op	op;
+	enum qc_attr_id	a, b, c, d;
+};
+
+static const struct qc_rule qc_cec_rules[] = {
+	{ QC_RULE_LE,	qc_num_core_dedicated,	qc_num_core_shared,	ATTR_UNDEF,		qc_num_core_total },
+	{ QC_RULE_LE,	qc_num_core_configured,	qc_num_core_standby,	qc_num_core_reserved,	qc_num_core_total },
+	{ QC_RULE_LE,	qc_num_cp_total,	qc_num_ifl_total,	ATTR_UNDEF,		qc_num_core_total },
+	{ QC_RULE_EQ,	qc_num_ifl_dedicated,	qc_num_cp_dedicated,	ATTR_UNDEF,		qc_num_core_dedicated },
+	{ QC_RULE_EQ,	qc_num_ifl_shared,	qc_num_cp_shared,	ATTR_UNDEF,		qc_num_core_shared },
+	{ QC_RULE_EQ,	qc_num_cp_dedicated,	qc_num_cp_shared,	ATTR_UNDEF,		qc_num_cp_total },
+	{ QC_RULE_EQ,	qc_num_ifl_dedicated,	qc_num_ifl_shared,	ATTR_UNDEF,		qc_num_ifl_total },
+	{ QC_RULE_EQ,	qc_num_ziip_dedicated,	qc_num_ziip_shared,	ATTR_UNDEF,		qc_num_ziip_total },
+	{ QC_RULE_END }
+};
+
+static const struct qc_rule qc_lpar_rules[] = {
+	{ QC_RULE_LE,	qc_num_core_dedicated,	qc_num_core_shared,	qc_num_core_reserved,	qc_num_core_total },
+	{ QC_RULE_LE,	qc_num_core_configured,	qc_num_core_standby,	qc_num_core_reserved,	qc_num_core_total },
+	{ QC_RULE_EQ,	qc_num_cp_dedicated,	qc_num_cp_shared,	ATTR_UNDEF,		qc_num_cp_total },
+	{ QC_RULE_EQ,	qc_num_ifl_dedicated,	qc_num_ifl_shared,	ATTR_UNDEF,		qc_num_ifl_total },
+	{ QC_RULE_EQ,	qc_num_ziip_dedicated,	qc_num_ziip_shared,	ATTR_UNDEF,		qc_num_ziip_total },
+	{ QC_RULE_END }
+};
+
+static const struct qc_rule qc_zvm_hv_rules[] = {
+	{ QC_RULE_EQ,	qc_num_core_dedicated,	qc_num_core_shared,	qc_num_core_reserved,	qc_num_core_total },
+	{ QC_RULE_EQ,	qc_num_cp_total,	qc_num_ifl_total,	ATTR_UNDEF,		qc_num_core_total },
+	{ QC_RULE_EQ,	qc_num_cp_dedicated,	qc_num_ifl_dedicated,	ATTR_UNDEF,		qc_num_core_dedicated },
+	{ QC_RULE_EQ,	qc_num_cp_shared,	qc_num_ifl_shared,	ATTR_UNDEF,		qc_num_core_shared },
+	{ QC_RULE_EQ,	qc_num_cp_dedicated,	qc_num_cp_shared,	ATTR_UNDEF,		qc_num_cp_total },
+	{ QC_RULE_EQ,	qc_num_ifl_dedicated,	qc_num_ifl_shared,	ATTR_UNDEF,		qc_num_ifl_total },
+	{ QC_RULE_EQ,	qc_num_ziip_dedicated,	qc_num_ziip_shared,	ATTR_UNDEF,		qc_num_ziip_total },
+	{ QC_RULE_END }
+};
+
+static const struct qc_rule qc_pool_rules[] = {
+	{ QC_RULE_CAPPED, qc_cp_capped_capacity,	qc_cp_capacity_cap,	qc_cp_limithard_cap,	ATTR_UNDEF },
+	{ QC_RULE_CAPPED, qc_ifl_capped_capacity,	qc_ifl_capacity_cap,	qc_ifl_limithard_cap,	ATTR_UNDEF },
+	{ QC_RULE_CAPPED, qc_ziip_capped_capacity,	qc_ziip_capacity_cap,	qc_ziip_limithard_cap,	ATTR_UNDEF },
+	{ QC_RULE_END }
+};
+
+// Note: z/VM doesn't add qc_num_cpu_reserved when calculating qc_num_cpu_total
+static const struct qc_rule qc_zvm_guest_rules[] = {
+	{ QC_RULE_EQ,	qc_num_cpu_dedicated,	qc_num_cpu_shared,	ATTR_UNDEF,		qc_num_cpu_total },
+	{ QC_RULE_EQ,	qc_num_cpu_configured,	qc_num_cpu_standby,	qc_num_cpu_reserved,	qc_num_cpu_total },
+	{ QC_RULE_EQ,	qc_num_cp_total,	qc_num_ifl_total,	ATTR_UNDEF,		qc_num_cpu_total },
+	{ QC_RULE_EQ,	qc_num_cp_dedicated,	qc_num_ifl_dedicated,	ATTR_UNDEF,		qc_num_cpu_dedicated },
+	{ QC_RULE_EQ,	qc_num_cp_shared,	qc_num_ifl_shared,	ATTR_UNDEF,		qc_num_cpu_shared },
+	{ QC_RULE_EQ,	qc_num_cp_dedicated,	qc_num_cp_shared,	ATTR_UNDEF,		qc_num_cp_total },
+	{ QC_RULE_EQ,	qc_num_ifl_dedicated,	qc_num_ifl_shared,	ATTR_UNDEF,		qc_num_ifl_total },
+	{ QC_RULE_EQ,	qc_num_ziip_dedicated,	qc_num_ziip_shared,	ATTR_UNDEF,		qc_num_ziip_total },
+	{ QC_RULE_END }
+};
+
+static const struct qc_rule qc_kvm_hv_rules[] = {
+	{ QC_RULE_EQ,	qc_num_core_shared,	qc_num_core_dedicated,	qc_num_core_reserved,	qc_num_core_total },
+	{ QC_RULE_EQ,	qc_num_cp_dedicated,	qc_num_cp_shared,	ATTR_UNDEF,		qc_num_cp_total },
+	{ QC_RULE_EQ,	qc_num_ifl_dedicated,	qc_num_ifl_shared,	ATTR_UNDEF,		qc_num_ifl_total },
+	{ QC_RULE_EQ,	qc_num_ziip_dedicated,	qc_num_ziip_shared,	ATTR_UNDEF,		qc_num_ziip_total },
+	{ QC_RULE_END }
+};
+
+static const struct qc_rule qc_kvm_guest_rules[] = {
+	{ QC_RULE_EQ,	qc_num_cpu_configured,	qc_num_cpu_standby,	qc_num_cpu_reserved,	qc_num_cpu_total },
+	{ QC_RULE_EQ,	qc_num_cpu_shared,	qc_num_cpu_dedicated,	qc_num_cpu_reserved,	qc_num_cpu_total },
+	{ QC_RULE_EQ,	qc_num_ifl_dedicated,	qc_num_ifl_shared,	ATTR_UNDEF,		qc_num_ifl_total },
+	{ QC_RULE_EQ,	qc_num_ifl_dedicated,	ATTR_UNDEF,		ATTR_UNDEF,		0 },
+	{ QC_RULE_EQ,	qc_num_ifl_shared,	ATTR_UNDEF,		ATTR_UNDEF,		qc_num_cpu_configured },
+	{ QC_RULE_END }
+};
+
+// Consistency rules indexed by layer type
+static const struct qc_rule *qc_rules[] = {
+	[QC_LAYER_TYPE_CEC] = qc_cec_rules,
+	[QC_LAYER_TYPE_LPAR] = qc_lpar_rules,
+	[QC_LAYER_TYPE_ZVM_HYPERVISOR] = qc_zvm_hv_rules,
+	[QC_LAYER_TYPE_ZVM_CPU_POOL] = qc_pool_rules,
+	[QC_LAYER_TYPE_ZVM_GUEST] = qc_zvm_guest_rules,
+	[QC_LAYER_TYPE_KVM_HYPERVISOR] = qc_kvm_hv_rules,
+	[QC_LAYER_TYPE_KVM_GUEST] = qc_kvm_guest_rules,
+	[QC_LAYER_TYPE_ZOS_TENANT_RESOURCE_GROUP] = qc_pool_rules,
+};
+
+// Returns the data sources that attribute 'id' was retrieved from, as a mask of enum qc_refresh_flags
+static int qc_attr_src_flags(struct qc_handle *hdl, enum qc_attr_id id) {
+	if (id == ATTR_UNDEF)
+		return 0;
+	switch (qc_get_attr_value_src_int(hdl, id)) {
+	case ATTR_SRC_SYSINFO:	return QC_REFRESH_SYSINFO;
+	case ATTR_SRC_HYPFS:	return QC_REFRESH_HYPFS;
+	case ATTR_SRC_STHYI:	return QC_REFRESH_STHYI;
+	case ATTR_SRC_SYSFS:	return QC_REFRESH_SYSFS;
+	default:		return QC_REFRESH_ALL;	// e.g. post-processed, origin unknown
+	}
+}
+
 // Check consistency of data across data sources, as well as consistency of data within each data source.
-// Returns 0 in case of success, <0 for errors, and >0 in case the data is inconsistent.
-static int qc_consistency_check(struct qc_handle *hdl) {
+// Returns 0 in case of success, <0 for errors, and >0 in case the data is inconsistent, with 'flags'
+// set to the data sources that the attributes of the failed rule originate from.
+static int qc_consistency_check(struct qc_handle *hdl, int *flags) {
+	unsigned long long start, elapsed;
+	const struct qc_rule *rule = NULL;
+	struct qc_handle *root = hdl;
 	int *etype, rc = 0;
 
 	if (!qc_consistency_check_requested)
 		return 0;
+	start = qc_stats_now();
 	qc_debug(hdl, "Run consistency check\n");
 	qc_debug_indent_inc();
 	for (; hdl; hdl = hdl->next) {
@@ -437,78 +787,29 @@ static int qc_consistency_check(struct qc_handle *hdl) {
 			rc = -1;
 			goto out;
 		}
-
-		switch (*etype) {
-		case QC_LAYER_TYPE_CEC:
-			if ((rc = qc_verify(hdl, qc_num_core_dedicated, qc_num_core_shared,	ATTR_UNDEF,	      	qc_num_core_total, 0)) ||
-			    (rc = qc_verify(hdl, qc_num_core_configured, qc_num_core_standby,	qc_num_core_reserved, 	qc_num_core_total, 0)) ||
-			    (rc = qc_verify(hdl, qc_num_cp_total,	 qc_num_ifl_total,	ATTR_UNDEF,     	qc_num_core_total, 0)) ||
-			    (rc = qc_verify(hdl, qc_num_ifl_dedicated,	 qc_num_cp_dedicated,	ATTR_UNDEF,		qc_num_core_dedicated, 1)) ||
-			    (rc = qc_verify(hdl, qc_num_ifl_shared,	 qc_num_cp_shared,	ATTR_UNDEF,		qc_num_core_shared, 1)) ||
-			    (rc = qc_verify(hdl, qc_num_cp_dedicated,    qc_num_cp_shared,	ATTR_UNDEF,	      	qc_num_cp_total,  1)) ||
-			    (rc = qc_verify(hdl, qc_num_ifl_dedicated,   qc_num_ifl_shared,	ATTR_UNDEF,	      	qc_num_ifl_total, 1)) ||
-			    (rc = qc_verify(hdl, qc_num_ziip_dedicated,  qc_num_ziip_shared,	ATTR_UNDEF,	      	qc_num_ziip_total, 1)))
-				goto out;
-			break;
-		case QC_LAYER_TYPE_LPAR:
-			if ((rc = qc_verify(hdl, qc_num_core_dedicated,  qc_num_core_shared,	qc_num_core_reserved,	qc_num_core_total, 0)) ||
-			    (rc = qc_verify(hdl, qc_num_core_configured, qc_num_core_standby,	qc_num_core_reserved,	qc_num_core_total, 0)) ||
-			    (rc = qc_verify(hdl, qc_num_cp_dedicated,	 qc_num_cp_shared,	ATTR_UNDEF,		qc_num_cp_total,  1)) ||
-			    (rc = qc_verify(hdl, qc_num_ifl_dedicated,   qc_num_ifl_shared,	ATTR_UNDEF,		qc_num_ifl_total, 1)) ||
-			    (rc = qc_verify(hdl, qc_num_ziip_dedicated,  qc_num_ziip_shared,	ATTR_UNDEF,		qc_num_ziip_total, 1)))
-				goto out;
-			break;
-		case QC_LAYER_TYPE_ZVM_HYPERVISOR:
-			if ((rc = qc_verify(hdl, qc_num_core_dedicated, qc_num_core_shared,	qc_num_core_reserved,	qc_num_core_total,	1)) ||
-			    (rc = qc_verify(hdl, qc_num_cp_total,       qc_num_ifl_total,	ATTR_UNDEF,		qc_num_core_total,	1)) ||
-			    (rc = qc_verify(hdl, qc_num_cp_dedicated,   qc_num_ifl_dedicated,	ATTR_UNDEF,		qc_num_core_dedicated,	1)) ||
-			    (rc = qc_verify(hdl, qc_num_cp_shared,      qc_num_ifl_shared,	ATTR_UNDEF,		qc_num_core_shared,	1)) ||
-			    (rc = qc_verify(hdl, qc_num_cp_dedicated,   qc_num_cp_shared,	ATTR_UNDEF,		qc_num_cp_total,	  1)) ||
-			    (rc = qc_verify(hdl, qc_num_ifl_dedicated,  qc_num_ifl_shared,	ATTR_UNDEF,		qc_num_ifl_total,	  1)) ||
-			    (rc = qc_verify(hdl, qc_num_ziip_dedicated,	qc_num_ziip_shared,	ATTR_UNDEF,		qc_num_ziip_total,	  1)))
-				goto out;
-			break;
-		case QC_LAYER_TYPE_ZVM_CPU_POOL:
-		case QC_LAYER_TYPE_ZOS_TENANT_RESOURCE_GROUP:
-			if ((rc = qc_verify_capped_capacity(hdl,	qc_cp_capped_capacity,	qc_cp_capacity_cap,	qc_cp_limithard_cap)) ||
-			    (rc = qc_verify_capped_capacity(hdl,	qc_ifl_capped_capacity,	qc_ifl_capacity_cap,	qc_ifl_limithard_cap)) ||
-			    (rc = qc_verify_capped_capacity(hdl,	qc_ziip_capped_capacity, qc_ziip_capacity_cap,	qc_ziip_limithard_cap)))
-				goto out;
-			break;
-		case QC_LAYER_TYPE_ZVM_GUEST:
-			// Note: z/VM doesn't add qc_num_cpu_reserved when calculating qc_num_cpu_total
-			if ((rc = qc_verify(hdl, qc_num_cpu_dedicated,  qc_num_cpu_shared,	ATTR_UNDEF,		qc_num_cpu_total,	1)) ||
-			    (rc = qc_verify(hdl, qc_num_cpu_configured, qc_num_cpu_standby,	qc_num_cpu_reserved,	qc_num_cpu_total,	1)) ||
-			    (rc = qc_verify(hdl, qc_num_cp_total,       qc_num_ifl_total,	ATTR_UNDEF,		qc_num_cpu_total,	1)) ||
-			    (rc = qc_verify(hdl, qc_num_cp_dedicated,   qc_num_ifl_dedicated,	ATTR_UNDEF,		qc_num_cpu_dedicated,	1)) ||
-			    (rc = qc_verify(hdl, qc_num_cp_shared,      qc_num_ifl_shared,	ATTR_UNDEF,		qc_num_cpu_shared,	1)) ||
-			    (rc = qc_verify(hdl, qc_num_cp_dedicated,   qc_num_cp_shared,	ATTR_UNDEF,		qc_num_cp_total,	1)) ||
-			    (rc = qc_verify(hdl, qc_num_ifl_dedicated,  qc_num_ifl_shared,	ATTR_UNDEF,		qc_num_ifl_total,	1)) ||
-			    (rc = qc_verify(hdl, qc_num_ziip_dedicated,	qc_num_ziip_shared,	ATTR_UNDEF,		qc_num_ziip_total,	1)))
-				goto out;
-			break;
-		case QC_LAYER_TYPE_KVM_HYPERVISOR:
-			if ((rc = qc_verify(hdl, qc_num_core_shared, 	qc_num_core_dedicated,	qc_num_core_reserved,	qc_num_core_total, 1)) ||
-			(rc = qc_verify(hdl, qc_num_cp_dedicated,	qc_num_cp_shared,	ATTR_UNDEF,		qc_num_cp_total, 1)) ||
-			    (rc = qc_verify(hdl, qc_num_ifl_dedicated,	qc_num_ifl_shared,	ATTR_UNDEF,		qc_num_ifl_total, 1)) ||
-			    (rc = qc_verify(hdl, qc_num_ziip_dedicated,	qc_num_ziip_shared,	ATTR_UNDEF,		qc_num_ziip_total, 1)))
-				goto out;
-			break;
-		case QC_LAYER_TYPE_KVM_GUEST:
-			if ((rc = qc_verify(hdl, qc_num_cpu_configured, qc_num_cpu_standby,	qc_num_cpu_reserved,	qc_num_cpu_total,	   1)) ||
-			    (rc = qc_verify(hdl, qc_num_cpu_shared, 	qc_num_cpu_dedicated,	qc_num_cpu_reserved,	qc_num_cpu_total,	   1)) ||
-			    (rc = qc_verify(hdl, qc_num_ifl_dedicated,	qc_num_ifl_shared,	ATTR_UNDEF,		qc_num_ifl_total,	   1)) ||
-			    (rc = qc_verify(hdl, qc_num_ifl_dedicated,	ATTR_UNDEF,		ATTR_UNDEF,		0,			   1)) ||
-			    (rc = qc_verify(hdl, qc_num_ifl_shared,	ATTR_UNDEF,		ATTR_UNDEF,		qc_num_cpu_configured, 1)))
+		if (*etype < 0 || *etype >= (int)(sizeof(qc_rules) / sizeof(qc_rules[0])) || !qc_rules[*etype])
+			continue;
+		for (rule = qc_rules[*etype]; rule->op != QC_RULE_END; rule++) {
+			if (rule->op == QC_RULE_CAPPED)
+				rc = qc_verify_capped_capacity(hdl, rule->a, rule->b, rule->c);
+			else
+				rc = qc_verify(hdl, rule->a, rule->b, rule->c, rule->d, rule->op == QC_RULE_EQ);
+			if (rc)
 				goto out;
-			break;
-		default: break;
 		}
 	}
 
 out:
-	if (rc)
+	if (rc > 0) {
+		*flags = qc_attr_src_flags(hdl, rule->a) | qc_attr_src_flags(hdl, rule->b) |
+			 qc_attr_src_flags(hdl, rule->c) | qc_attr_src_flags(hdl, rule->d);
+		qc_debug(hdl, "Warning: Consistency check failed at rule %d of layer %d, sources 0x%x\n",
+			 (int)(rule - qc_rules[*etype]), hdl->layer_no, *flags);
+	} else if (rc)
 		qc_debug(hdl, "Warning: Consistency check failed\n");
+	elapsed = qc_stats_now() - start;
+	qc_stats_add(root, time[QC_STATS_CONSISTENCY_CHECK], elapsed);
+	qc_stats_add(root, time_total, elapsed);
 	qc_debug_indent_dec();
 
 	return rc;
@@ -766,16 +1067,184 @@ fail:
 	return -1;
 }
 
-static void *_qc_open(struct qc_handle *hdl, int *rc) {
-	// sysinfo needs to be handled first, or our LGM check later on will have loopholes
-	// sysfs needs to be handled last, as part of the attributes apply to top-most layer only
-	struct qc_data_src *src, *sources[] = {&sysinfo, &hypfs, &sthyi, &sysfs, NULL};
-	struct qc_handle *lparhdl;
+struct qc_eff_cap {
+	int dispatch_type;		// value of qc_*_dispatch_type referring to this CPU type
+	enum qc_attr_id num_total;
+	enum qc_attr_id caps[3];
+	enum qc_attr_id dispatch_id;
+	enum qc_attr_id eff_id;
+	enum qc_attr_id eff_layer_id;
+};
+
+static const struct qc_eff_cap eff_caps[] = {
+	{0, qc_num_cp_total, {qc_cp_absolute_capping, qc_cp_weight_capping, qc_cp_capped_capacity},
+	 qc_cp_dispatch_type, qc_cp_effective_capacity, qc_cp_effective_capacity_layer},
+	{3, qc_num_ifl_total, {qc_ifl_absolute_capping, qc_ifl_weight_capping, qc_ifl_capped_capacity},
+	 qc_ifl_dispatch_type, qc_ifl_effective_capacity, qc_ifl_effective_capacity_layer},
+	{5, qc_num_ziip_total, {qc_ziip_absolute_capping, qc_ziip_weight_capping, qc_ziip_capped_capacity},
+	 qc_ziip_dispatch_type, qc_ziip_effective_capacity, qc_ziip_effective_capacity_layer},
+};
+
+#define QC_NUM_EFF_CAPS		(int)(sizeof(eff_caps) / sizeof(eff_caps[0]))
+
+// Returns the limit that layer 'hdl' imposes on CPU type 'cur', or -1 if none
+static int qc_get_eff_cap_limit(struct qc_handle *hdl, int cur) {
+	int limit = -1;
+	int i, *val;
+
+	switch (*(int *)(hdl->layer)) {
+	case QC_LAYER_TYPE_KVM_GUEST:
+		// KVM guests ain't got no CPs and zIIPs
+		if (eff_caps[cur].num_total != qc_num_ifl_total)
+			return 0;
+		break;
+	case QC_LAYER_TYPE_ZOS_ZCX_SERVER:
+		if (eff_caps[cur].num_total == qc_num_ifl_total)
+			return 0;
+		break;
+	default:
+		break;
+	}
+	if ((val = qc_get_attr_value_int(hdl, eff_caps[cur].num_total)))
+		limit = *val * 0x10000;
+	for (i = 0; i < 3; i++) {
+		// a capping of 0 means no capping
+		if ((val = qc_get_attr_value_int(hdl, eff_caps[cur].caps[i])) && *val > 0 &&
+		    (limit < 0 || *val < limit))
+			limit = *val;
+	}
+
+	return limit;
+}
+
+/* Determine the upper bound of capacity available to the topmost layer per
+   CPU type, and which layer imposes it. We follow the layers downwards, mapping
+   the CPU type to the one it is dispatched on whenever a layer tells us. */
+static int qc_post_process_effective_capacity(struct qc_handle *hdl) {
+	struct qc_handle *top = qc_hdl_get_top(hdl), *root = qc_hdl_get_root(hdl);
+	int type, cur, i, *val, eff, limit, layer_no;
+
+	switch (*(int *)(top->layer)) {
+	case QC_LAYER_TYPE_LPAR:
+	case QC_LAYER_TYPE_ZVM_HYPERVISOR:
+	case QC_LAYER_TYPE_ZVM_GUEST:
+	case QC_LAYER_TYPE_ZOS_ZCX_SERVER:
+	case QC_LAYER_TYPE_KVM_HYPERVISOR:
+	case QC_LAYER_TYPE_KVM_GUEST:
+		break;
+	default:
+		return 0;
+	}
+	qc_debug(top, "Post processing: Compute effective capacity\n");
+	qc_debug_indent_inc();
+	for (type = 0; type < QC_NUM_EFF_CAPS; type++) {
+		eff = -1;
+		layer_no = -1;
+		cur = type;
+		for (hdl = top; hdl; hdl = (hdl == root ? NULL : qc_hdl_get_prev(hdl))) {
+			if ((limit = qc_get_eff_cap_limit(hdl, cur)) >= 0 && (eff < 0 || limit < eff)) {
+				eff = limit;
+				layer_no = hdl->layer_no;
+			}
+			// 0xff and unknown values leave the CPU type unchanged
+			if ((val = qc_get_attr_value_int(hdl, eff_caps[cur].dispatch_id))) {
+				for (i = 0; i < QC_NUM_EFF_CAPS; i++) {
+					if (eff_caps[i].dispatch_type == *val) {
+						cur = i;
+						break;
+					}
+				}
+			}
+		}
+		if (eff < 0)
+			continue;
+		if (qc_set_attr_int(top, eff_caps[type].eff_id, eff, ATTR_SRC_POSTPROC) ||
+		    qc_set_attr_int(top, eff_caps[type].eff_layer_id, layer_no, ATTR_SRC_POSTPROC)) {
+			qc_debug_indent_dec();
+			return -1;
+		}
+	}
+	qc_debug_indent_dec();
+
+	return 0;
+}
+
+// sysinfo needs to be handled first, or our LGM check later on will have loopholes
+// sysfs needs to be handled last, as part of the attributes apply to top-most layer only
+// Note: Order must match enum qc_refresh_flags
+static struct qc_data_src *qc_srcs[QC_NUM_SRCS + 1] = {&sysinfo, &hypfs, &sthyi, &sysfs, NULL};
+
+struct qc_open_req {
+	struct qc_handle	*hdl;
+	struct qc_data_src	*src;
+	int			 idx;	// index of 'src' in qc_srcs
+	char			**priv;
+	int			 rc;
+	pthread_t		 thread;
+	int			 threaded;
+};
+
+unsigned long long qc_stats_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void qc_stats_add_offset(struct qc_handle *hdl, size_t offset, unsigned long long val) {
+	// data sources might be opened concurrently
+	__atomic_add_fetch((unsigned long long *)((char *)&qc_stats + offset), val, __ATOMIC_RELAXED);
+	if (hdl)
+		__atomic_add_fetch((unsigned long long *)((char *)&hdl->root->stats + offset), val,
+				   __ATOMIC_RELAXED);
+}
+
+static void *qc_open_src(void *arg) {
+	struct qc_open_req *req = arg;
+	unsigned long long start;
+
+	start = qc_stats_now();
+	req->rc = req->src->open(req->hdl, req->priv);
+	qc_stats_add(req->hdl, time[QC_STATS_OPEN_SYSINFO + req->idx], qc_stats_now() - start);
+
+	return NULL;
+}
+
+// Opens the data sources in 'reqs' concurrently, running the first one in the calling thread
+static void qc_open_srcs_parallel(struct qc_open_req *reqs, int num) {
 	int i;
 
-	qc_debug(hdl, "_qc_open()\n");
+	for (i = 1; i < num; i++)
+		reqs[i].threaded = !pthread_create(&reqs[i].thread, NULL, qc_open_src, &reqs[i]);
+	qc_open_src(&reqs[0]);
+	for (i = 1; i < num; i++) {
+		if (reqs[i].threaded)
+			pthread_join(reqs[i].thread, NULL);
+		else
+			qc_open_src(&reqs[i]);	// thread creation failed, fall back to sequential
+	}
+}
+
+// Retrieve data from the sources as indicated by 'flags', and re-use previously
+// retrieved data for all others. If the data turns out inconsistent (*rc>0),
+// 'flags' is set to the sources to retrieve data from again.
+static void *_qc_open(struct qc_handle *hdl, int *rc, int *flags) {
+	unsigned long long start = qc_stats_now(), pstart;
+	struct qc_open_req reqs[QC_NUM_SRCS];
+	int i, num = 0, req_flags = *flags;
+	struct qc_handle *lparhdl;
+	struct qc_data_src *src;
+
+	qc_debug(hdl, "_qc_open(flags=0x%x)\n", req_flags);
 	qc_debug_indent_inc();
 	*rc = 0;
+	*flags = QC_REFRESH_ALL;
+	if (hdl) {
+		// release layers of a previous attempt for reuse
+		qc_hdl_release(hdl, hdl->next);
+		hdl->next = NULL;
+	}
 	if (qc_hdl_new(NULL, &hdl, 0, QC_LAYER_TYPE_CEC) ||
 	    qc_hdl_new(hdl, &lparhdl, 1, QC_LAYER_TYPE_LPAR)) {
 		*rc = -1;
@@ -784,30 +1253,60 @@ static void *_qc_open(struct qc_handle *hdl, int *rc) {
 	hdl->next = lparhdl;
 	lparhdl->root = hdl->root;
 
-	// open all data sources
-	for (i = 0; (src = sources[i]) != NULL; i++)
-		if (src->open(hdl, &src->priv))
+	// open all requested data sources
+	for (i = 0; (src = qc_srcs[i]) != NULL; i++) {
+		if (!(req_flags & (1 << i)) && hdl->priv[i])
+			continue;
+		src->close(hdl, hdl->priv[i]);
+		hdl->priv[i] = NULL;
+		memset(&reqs[num], 0, sizeof(struct qc_open_req));
+		reqs[num].hdl = hdl;
+		reqs[num].src = src;
+		reqs[num].idx = i;
+		reqs[num].priv = &hdl->priv[i];
+		num++;
+	}
+	if (hdl->parallel_open && num > 1) {
+		qc_open_srcs_parallel(reqs, num);
+	} else {
+		for (i = 0; i < num; i++)
+			qc_open_src(&reqs[i]);
+	}
+	for (i = 0; i < num; i++)
+		if (reqs[i].rc)
 			*rc = -2;	// don't exit on error immediately, so we collect all data for a dump later on
 	if (*rc)
 		goto out;
 
-	// verify that we weren't migrated
-	if ((*rc = sysinfo.lgm_check(hdl, sysinfo.priv)) != 0)
+	// verify that we weren't migrated, even if re-using sysinfo data: if we were, all sources
+	// need to be retrieved again, as indicated by *flags
+	if (num && (*rc = sysinfo.lgm_check(hdl, hdl->priv[0])) != 0)
 		goto out;
 
 	// process data sources
-	for (i = 0; (src = sources[i]) != NULL; i++) {
+	for (i = 0; (src = qc_srcs[i]) != NULL; i++) {
+		pstart = qc_stats_now();
+		*rc = src->process(hdl, hdl->priv[i]);
+		qc_stats_add(hdl, time[QC_STATS_PROCESS_SYSINFO + i], qc_stats_now() - pstart);
 		// Return values >0 will be left as is and passed back to caller
-		if ((*rc = src->process(hdl, src->priv)) < 0) {
+		if (*rc < 0) {
 			*rc = -3;	// match errors to a value that we can identify
 			goto out;
 		}
-		if (*rc)
+		if (*rc) {
+			*flags = 1 << i;	// data of the other sources remains usable
 			goto out;
+		}
 	}
 
-	if (qc_post_processing(hdl)) {
-		*rc = -4;
+	pstart = qc_stats_now();
+	*rc = qc_post_processing(hdl) || qc_post_process_effective_capacity(hdl) ? -4 : 0;
+	qc_stats_add(hdl, time[QC_STATS_POSTPROCESSING], qc_stats_now() - pstart);
+	if (*rc)
+		goto out;
+
+	if (qc_hdl_index_layers(hdl)) {
+		*rc = -1;
 		goto out;
 	}
 
@@ -826,30 +1325,65 @@ out:
 		qc_debug(hdl, "Create dump\n");
 		qc_debug_indent_inc();
 		if (qc_debug_open_dump_dir(hdl) == 0) {	// get a new dump directory
-			for (i = 0; (src = sources[i]) != NULL; i++)
-				src->dump(hdl, src->priv);
+			for (i = 0; (src = qc_srcs[i]) != NULL; i++)
+				src->dump(hdl, hdl ? hdl->priv[i] : NULL);
 			qc_debug_close_dump_dir(hdl);
 		} else
 			qc_debug(hdl, "Failed, could not open directory\n");
 		qc_debug_indent_dec();
 	}
-
-	// Close all data sources
-	for (i = 0; (src = sources[i]) != NULL; i++)
-		src->close(hdl, src->priv);
-	if (hdl)
-		// nothing else we can do if registration fails
-		qc_hdl_register(hdl);
+	qc_stats_add(hdl, num_gathers, 1);
+	qc_stats_add(hdl, time_total, qc_stats_now() - start);
 	qc_debug(hdl, "Return rc=%d\n", *rc);
 	qc_debug_indent_dec();
 
 	return hdl;
 }
 
+// Wait before retry number 'retry' to retrieve data from the sources in 'flags'
+static void qc_retry_wait(struct qc_handle *hdl, int retry, int flags) {
+	unsigned long long start, elapsed;
+	struct timespec ts;
+	long delay;
+
+	qc_debug(hdl, "Warning: Gathering data failed, retry %d (flags=0x%x)\n", retry, flags);
+	qc_stats_add(hdl, num_retries, 1);
+	if (hdl->root->retry_delay <= 0)
+		return;
+	// exponential backoff, giving concurrent changes (e.g. CPU hotplug) time to complete
+	delay = hdl->root->retry_delay;
+	while (--retry > 0 && delay < QC_MAX_RETRY_DELAY)
+		delay *= 2;
+	if (delay > QC_MAX_RETRY_DELAY)
+		delay = QC_MAX_RETRY_DELAY;
+	ts.tv_sec = delay / 1000;
+	ts.tv_nsec = (delay % 1000) * 1000000;
+	start = qc_stats_now();
+	while (nanosleep(&ts, &ts) && errno == EINTR);
+	// waiting counts towards the total time, too
+	elapsed = qc_stats_now() - start;
+	qc_stats_add(hdl, time[QC_STATS_RETRY_WAIT], elapsed);
+	qc_stats_add(hdl, time_total, elapsed);
+}
+
+// Release all resources of 'hdl'
+static void _qc_close(struct qc_handle *hdl) {
+	int i;
+
+	qc_debug_deinit(hdl);
+	for (i = 0; qc_srcs[i] != NULL; i++)
+		qc_srcs[i]->close(hdl, hdl->priv[i]);
+	free(hdl->shm);
+	qc_history_free(hdl);
+	qc_hdl_free(hdl);
+}
+
 __attribute__ ((visibility ("default"))) void *qc_open(int *rc) {
 	struct qc_handle *hdl = NULL;
+	void *token = NULL;
+	int i, flags;
 	char *s, *end;
-	int i;
+	long l;
 
 	*rc = 0;
 	if (qc_debug_init()) {
@@ -859,106 +1393,502 @@ __attribute__ ((visibility ("default"))) void *qc_open(int *rc) {
 	qc_debug(hdl, "qc_open()\n");
 	qc_debug_indent_inc();
 
-	if (qc_cd == (iconv_t)-1) {
-		qc_debug(hdl, "Initialize iconv\n");
-		qc_cd = iconv_open("ISO8859-1", "IBM-1047");
-		if (qc_cd == (iconv_t)-1) {
-			qc_debug(hdl, "Error: iconv setup failed: %s\n", strerror(errno));
-			*rc = -2;
-			goto out;
-		}
-	}
-
 	if ((s = getenv("QC_CHECK_CONSISTENCY")) != NULL) {
 		qc_consistency_check_requested = strtol(s, &end, 10);
 		if (end == s || qc_consistency_check_requested < 0)
 			qc_consistency_check_requested = 0;
 	}
+	// settings are kept in the handle, as they are used by qc_refresh() in other threads, too
+	if (qc_hdl_new(NULL, &hdl, 0, QC_LAYER_TYPE_CEC)) {
+		*rc = -1;
+		goto out;
+	}
+	if ((s = getenv("QC_PARALLEL_OPEN")) != NULL) {
+		l = strtol(s, &end, 10);
+		hdl->parallel_open = end != s && l > 0;
+	}
+	hdl->retries = QC_DEFAULT_RETRIES;
+	if ((s = getenv("QC_RETRIES")) != NULL) {
+		l = strtol(s, &end, 10);
+		if (end != s && l >= 0)
+			hdl->retries = l > QC_MAX_RETRIES ? QC_MAX_RETRIES : l;
+	}
+	if ((s = getenv("QC_RETRY_DELAY")) != NULL) {
+		l = strtol(s, &end, 10);
+		if (end != s && l > 0)
+			hdl->retry_delay = l > QC_MAX_RETRY_DELAY ? QC_MAX_RETRY_DELAY : l;
+	}
 
-	/* Since we retrieve data from multiple sources, CPU hotplugging provides a chance for
-	 * inconsistent data. If we detect that, we retry up to a total of 3 times before
-	 * giving up. */
-	for (i = 0; i < 3; ++i) {
-		if (i > 0) {
-			qc_debug(hdl, "Warning: Gathering data failed, retry %d\n", i);
-			qc_hdl_reinit(hdl);
+	// use data published by another process if available
+	if ((s = getenv("QC_USE_SHM")) != NULL && *s) {
+		if (qc_shm_attach(&hdl, s) == 0) {
+			hdl->shm = strdup(s);	// if this fails, qc_refresh() will gather data itself
+			goto out_reg;
 		}
-		hdl = _qc_open(hdl, rc);
+		qc_debug(hdl, "Published data not usable, gathering data\n");
+	}
+
+	/* Since we retrieve data from multiple sources, CPU hotplugging provides a chance for
+	 * inconsistent data. If we detect that, we retry up to QC_RETRIES times before
+	 * giving up, re-collecting only the sources involved in an inconsistency. */
+	for (i = 0, flags = QC_REFRESH_ALL; i <= hdl->retries; ++i) {
+		if (i > 0)
+			qc_retry_wait(hdl, i, flags);
+		hdl = _qc_open(hdl, rc, &flags);
 		if (*rc > 0)
 			continue;
-		if (*rc < 0 || ((*rc = qc_consistency_check(hdl)) <= 0))
+		if (*rc < 0 || ((*rc = qc_consistency_check(hdl, &flags)) <= 0))
 			break;
 	}
 	if (*rc > 0)
 		qc_debug(hdl, "Error: Unable to retrieve consistent data, giving up\n");
+out_reg:
+	if (hdl && !*rc && (token = qc_hdl_register(hdl)) == NULL)
+		*rc = -5;
 
 out:
-	qc_debug(hdl, "Return %p, rc=%d\n", *rc ? NULL : hdl, *rc);
+	qc_debug(hdl, "Return %p, rc=%d\n", *rc ? NULL : token, *rc);
 	qc_debug_indent_dec();
 	if (*rc) {
-		qc_close(hdl);
-		hdl = NULL;
+		if (hdl)
+			_qc_close(hdl);
+		token = NULL;
 	}
 
-	return hdl;
+	return token;
+}
+
+__attribute__ ((visibility ("default"))) void *qc_open_from_snapshot(const char *buf, size_t len, int *rc) {
+	struct qc_handle *hdl = NULL;
+	void *token = NULL;
+
+	*rc = 0;
+	if (qc_debug_init()) {
+		*rc = -1;
+		goto out;
+	}
+	qc_debug(hdl, "qc_open_from_snapshot(len=%zd)\n", len);
+	qc_debug_indent_inc();
+	if (!buf)
+		*rc = -EINVAL;
+	else if (qc_hdl_deserialize(&hdl, buf, len))
+		*rc = -2;
+	else {
+		hdl->frozen = 1;
+		if ((token = qc_hdl_register(hdl)) == NULL)
+			*rc = -5;
+	}
+
+out:
+	qc_debug(hdl, "Return %p, rc=%d\n", *rc ? NULL : token, *rc);
+	qc_debug_indent_dec();
+	if (*rc) {
+		if (hdl)
+			_qc_close(hdl);
+		token = NULL;
+	}
+
+	return token;
+}
+
+__attribute__ ((visibility ("default"))) void *qc_open_from_dump(const struct qc_dump *dump, int *rc) {
+	struct qc_handle *hdl = NULL;
+	void *token = NULL;
+#ifdef CONFIG_DUMP_READING
+	int flags = QC_REFRESH_ALL;
+#endif
+
+	*rc = 0;
+	if (qc_debug_init()) {
+		*rc = -1;
+		goto out;
+	}
+	qc_debug(hdl, "qc_open_from_dump()\n");
+	qc_debug_indent_inc();
+#ifdef CONFIG_DUMP_READING
+	if (!dump) {
+		*rc = -EINVAL;
+		goto out;
+	}
+	// the data sources need to find the dump in the root handle
+	if (qc_hdl_new(NULL, &hdl, 0, QC_LAYER_TYPE_CEC)) {
+		*rc = -1;
+		goto out;
+	}
+	hdl->dump = dump;
+	// data is static, so there is no point in retrying
+	hdl = _qc_open(hdl, rc, &flags);
+	hdl->dump = NULL;
+	hdl->frozen = 1;
+	if (!*rc)
+		*rc = qc_consistency_check(hdl, &flags);
+	if (!*rc && (token = qc_hdl_register(hdl)) == NULL)
+		*rc = -5;
+#else
+	qc_debug(hdl, "Error: Dump reading not supported\n");
+	*rc = -ENOTSUP;
+#endif
+
+out:
+	qc_debug(hdl, "Return %p, rc=%d\n", *rc ? NULL : token, *rc);
+	qc_debug_indent_dec();
+	if (*rc) {
+		if (hdl)
+			_qc_close(hdl);
+		token = NULL;
+	}
+
+	return token;
+}
+
+/* Read file 'name' in directory 'dfd' into a newly allocated, null-terminated buffer.
+   Returns 0 on success or if the file does not exist, and <0 otherwise. */
+/* Open relative path 'name' within directory 'dfd' without following links in
+   any of its components. Returns the fd, or -1 with errno set. */
+static int qc_openat_nofollow(int dfd, const char *name, int flags) {
+	char comp[NAME_MAX + 1];
+	int fd, err, cur = dfd;
+	const char *end;
+
+	while ((end = strchr(name, '/')) != NULL) {
+		if (end - name > NAME_MAX || (end - name == 2 && !strncmp(name, "..", 2))) {
+			errno = EINVAL;
+			fd = -1;
+			goto out;
+		}
+		memcpy(comp, name, end - name);
+		comp[end - name] = '\0';
+		fd = openat(cur, comp, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (fd < 0)
+			goto out;
+		if (cur != dfd)
+			close(cur);
+		cur = fd;
+		name = end + 1;
+	}
+	fd = openat(cur, name, flags | O_NOFOLLOW);
+
+out:
+	if (cur != dfd) {
+		err = errno;
+		close(cur);
+		errno = err;
+	}
+
+	return fd;
+}
+
+static int qc_read_dump_file(int dfd, const char *name, const char **buf, size_t *len) {
+	size_t pos = 0;
+	struct stat sb;
+	ssize_t lrc;
+	char *data;
+	int fd;
+
+	// dumps might come from elsewhere: don't follow links or block on fifos
+	if ((fd = qc_openat_nofollow(dfd, name, O_RDONLY | O_CLOEXEC | O_NONBLOCK)) < 0)
+		return errno == ENOENT ? 0 : -errno;
+	if (fstat(fd, &sb)) {
+		lrc = -errno;
+		close(fd);
+		return lrc;
+	}
+	if (!S_ISREG(sb.st_mode)) {
+		qc_debug(NULL, "Error: '%s' is not a regular file\n", name);
+		close(fd);
+		return -EINVAL;
+	}
+	if ((data = malloc(sb.st_size + 1)) == NULL) {
+		close(fd);
+		return -ENOMEM;
+	}
+	while (pos < (size_t)sb.st_size && (lrc = read(fd, data + pos, sb.st_size - pos)) != 0) {
+		if (lrc < 0) {
+			if (errno == EINTR)
+				continue;
+			lrc = -errno;
+			free(data);
+			close(fd);
+			return lrc;
+		}
+		pos += lrc;
+	}
+	close(fd);
+	data[pos] = '\0';
+	*buf = data;
+	if (len)
+		*len = pos;
+	qc_debug(NULL, "Read %zd bytes from '%s'\n", pos, name);
+
+	return 0;
 }
 
-__attribute__ ((visibility ("default"))) void qc_close(void *hdl) {
-	if (qc_hdl_verify(hdl, "qc_close"))
+__attribute__ ((visibility ("default"))) int qc_read_dump(const char *path, struct qc_dump *dump) {
+	int dfd = -1, rc = 0;
+
+	if (!dump)
+		return -EINVAL;
+	memset(dump, 0, sizeof(*dump));
+	if (qc_debug_init())
+		return -1;
+	qc_debug(NULL, "qc_read_dump(path=%s)\n", path ? path : "<null>");
+	qc_debug_indent_inc();
+	if (!path) {
+		rc = -EINVAL;
+		goto out;
+	}
+	if ((dfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+		rc = -errno;
+		qc_debug(NULL, "Error: Failed to open '%s': %s\n", path, strerror(-rc));
+		goto out;
+	}
+	if (faccessat(dfd, QC_DUMP_INCOMPLETE, R_OK, 0) == 0) {
+		qc_debug(NULL, "Error: Dump at %s is incomplete, cannot use\n", path);
+		rc = -ENODATA;
+		goto out;
+	}
+	if ((rc = qc_read_dump_file(dfd, "sysinfo", &dump->sysinfo, &dump->sysinfo_len)) ||
+	    (rc = qc_read_dump_file(dfd, "sthyi", &dump->sthyi, &dump->sthyi_len)) ||
+	    (rc = qc_read_dump_file(dfd, "s390_hypfs/diag_204", &dump->diag_204, &dump->diag_204_len)) ||
+	    (rc = qc_read_dump_file(dfd, "s390_hypfs/diag_2fc", &dump->diag_2fc, &dump->diag_2fc_len)) ||
+	    (rc = qc_read_dump_file(dfd, "ocf/cpc_name", &dump->cpc_name, NULL)) ||
+	    // more recent dumps include a copy of the respective parts of /sys/firmware
+	    (!dump->cpc_name &&
+	     (rc = qc_read_dump_file(dfd, "sys/firmware/ocf/cpc_name", &dump->cpc_name, NULL))) ||
+	    (rc = qc_read_dump_file(dfd, "sys/firmware/ipl/has_secure", &dump->has_secure, NULL)) ||
+	    (rc = qc_read_dump_file(dfd, "sys/firmware/ipl/secure", &dump->secure, NULL)))
+		qc_debug(NULL, "Error: Failed to read dump: %s\n", strerror(-rc));
+
+out:
+	if (dfd >= 0)
+		close(dfd);
+	if (rc)
+		qc_free_dump(dump);
+	qc_debug(NULL, "Return rc=%d\n", rc);
+	qc_debug_indent_dec();
+
+	return rc;
+}
+
+__attribute__ ((visibility ("default"))) void qc_free_dump(struct qc_dump *dump) {
+	if (!dump)
+		return;
+	free((char *)dump->sysinfo);
+	free((char *)dump->sthyi);
+	free((char *)dump->diag_204);
+	free((char *)dump->diag_2fc);
+	free((char *)dump->cpc_name);
+	free((char *)dump->has_secure);
+	free((char *)dump->secure);
+	memset(dump, 0, sizeof(*dump));
+}
+
+int qc_refresh_hdl(struct qc_handle *hdl, int flags, int *changed, struct qc_handle **prev) {
+	struct qc_handle *saved = NULL;
+	int i, attached, rc = 0;
+
+	if (changed)
+		*changed = 0;
+	if (prev)
+		*prev = NULL;
+	if (hdl->frozen) {
+		qc_debug(hdl, "Error: Data from a snapshot cannot be refreshed\n");
+		rc = -EPERM;
+		goto out;
+	}
+	// keep the current layers to determine changes, and in case we fail
+	if (qc_hdl_save(hdl, &saved)) {
+		rc = -1;
+		goto out;
+	}
+	for (i = 0; i <= hdl->retries; ++i) {
+		if (i > 0)
+			qc_retry_wait(hdl, i, flags);
+		// fall back to gathering data if published data is not usable (anymore)
+		attached = hdl->shm && !qc_shm_attach(&hdl, hdl->shm);
+		if (attached)
+			rc = 0;
+		else
+			_qc_open(hdl, &rc, &flags);
+		if (rc > 0)
+			continue;
+		if (rc < 0 || ((rc = qc_consistency_check(hdl, &flags)) <= 0))
+			break;
+		// published data won't change on retry
+		if (attached)
+			break;
+	}
+	if (rc) {
+		if (rc > 0)
+			qc_debug(hdl, "Error: Unable to retrieve consistent data, giving up\n");
+		qc_debug(hdl, "Restore previous data\n");
+		qc_hdl_restore(hdl, saved);
+		goto out;
+	}
+	i = qc_hdl_flag_changes(hdl, saved);
+	qc_debug(hdl, "%d attribute(s) changed\n", i);
+	if (changed)
+		*changed = i;
+	if (prev)
+		*prev = saved;
+	else
+		qc_hdl_release(hdl, saved);
+	// a missing sample is no reason to fail
+	if (hdl->history)
+		qc_history_add(hdl);
+
+out:
+	return rc;
+}
+
+__attribute__ ((visibility ("default"))) int qc_refresh(void *cfg, int flags, int *changed) {
+	struct qc_handle *hdl;
+	int rc;
+
+	if (changed)
+		*changed = 0;
+	if ((hdl = qc_hdl_verify(cfg, "qc_refresh")) == NULL)
+		return -EFAULT;
+	qc_debug(hdl, "qc_refresh(flags=0x%x)\n", flags);
+	qc_debug_indent_inc();
+	if (flags & ~QC_REFRESH_ALL)
+		rc = -EINVAL;
+	else
+		rc = qc_refresh_hdl(hdl, flags, changed, NULL);
+	qc_debug(hdl, "Return rc=%d\n", rc);
+	qc_debug_indent_dec();
+	qc_hdl_put(cfg);
+
+	return rc;
+}
+
+__attribute__ ((visibility ("default"))) void *qc_watch_start(int interval, int flags, const enum qc_attr_id *ids,
+								int num_ids, qc_watch_cb cb, void *data, int *rc) {
+	struct qc_watch *watch = NULL;
+	struct qc_handle *hdl;
+	void *token;
+
+	*rc = 0;
+	if (interval <= 0 || !flags || (flags & ~QC_REFRESH_ALL) || !cb || (ids && num_ids <= 0)) {
+		*rc = -EINVAL;
+		return NULL;
+	}
+	// the watcher's handle is never passed to the caller, but registered nonetheless for use in 'cb'
+	token = qc_open(rc);
+	if (!token)
+		return NULL;
+	hdl = qc_hdl_verify(token, "qc_watch_start");
+	qc_debug(hdl, "qc_watch_start(interval=%d, flags=0x%x, num_ids=%d)\n", interval, flags, ids ? num_ids : 0);
+	qc_debug_indent_inc();
+	*rc = qc_watch_create(&watch, hdl, token, interval, flags, ids, num_ids, cb, data);
+	qc_debug(hdl, "Return rc=%d\n", *rc);
+	qc_debug_indent_dec();
+	qc_hdl_put(token);
+	if (*rc)
+		qc_close(token);
+
+	return watch;
+}
+
+__attribute__ ((visibility ("default"))) int qc_watch_stop(void *watcher) {
+	void *token;
+
+	if (!watcher || (token = qc_watch_destroy(watcher)) == NULL)
+		return -EINVAL;
+	qc_close(token);
+
+	return 0;
+}
+
+__attribute__ ((visibility ("default"))) void qc_close(void *cfg) {
+	struct qc_handle *hdl;
+
+	if ((hdl = qc_hdl_verify(cfg, "qc_close")) == NULL)
 		return;
 	qc_debug(hdl, "qc_close()\n");
 	qc_debug_indent_inc();
+	if (qc_hdl_unregister(cfg))
+		_qc_close(hdl);
+	qc_debug_indent_dec();
+}
 
-	qc_debug_deinit(hdl);
-	qc_hdl_reinit(hdl);
-	free(hdl);
+__attribute__ ((visibility ("default"))) int qc_publish(void *cfg, const char *path, int validity) {
+	struct qc_handle *hdl;
+	int rc;
+
+	if ((hdl = qc_hdl_verify(cfg, "qc_publish")) == NULL)
+		return -EFAULT;
+	qc_debug(hdl, "qc_publish()\n");
+	qc_debug_indent_inc();
+	if (!path)
+		rc = -EINVAL;
+	else
+		rc = qc_shm_publish(hdl, path, validity);
+	qc_debug(hdl, "Return rc=%d\n", rc);
+	qc_debug_indent_dec();
+	qc_hdl_put(cfg);
+
+	return rc;
+}
+
+__attribute__ ((visibility ("default"))) int qc_save_snapshot(void *cfg, char *buf, size_t size, size_t *len) {
+	struct qc_handle *hdl;
+	int rc;
 
+	if ((hdl = qc_hdl_verify(cfg, "qc_save_snapshot")) == NULL)
+		return -EFAULT;
+	qc_debug(hdl, "qc_save_snapshot(size=%zd)\n", size);
+	qc_debug_indent_inc();
+	if (!len || (!buf && size))
+		rc = -EINVAL;
+	else
+		rc = qc_hdl_serialize(hdl, buf, size, len);
+	qc_debug(hdl, "Return rc=%d\n", rc);
 	qc_debug_indent_dec();
+	qc_hdl_put(cfg);
+
+	return rc;
 }
 
 __attribute__ ((visibility ("default"))) int qc_get_num_layers(void *cfg, int *rc) {
-	struct qc_handle *hdl = cfg;
+	struct qc_handle *hdl;
+	int num;
 
-	if (qc_hdl_verify(hdl, "qc_get_num_layers")) {
+	if ((hdl = qc_hdl_verify(cfg, "qc_get_num_layers")) == NULL) {
 		*rc = -EFAULT;
 		return *rc;
 	}
 	qc_debug(hdl, "qc_get_num_layers()\n");
 	qc_debug_indent_inc();
-	while (hdl->next)
-		hdl = hdl->next;
-	qc_debug(hdl, "Return %d layers\n", hdl->layer_no + 1);
+	num = hdl->num_layers;
+	qc_debug(hdl, "Return %d layers\n", num);
 	*rc = 0;
 	qc_debug_indent_dec();
+	qc_hdl_put(cfg);
 
-	return hdl->layer_no + 1;
+	return num;
 }
 
-static struct qc_handle *qc_get_layer_handle(void *config, int layer) {
-	struct qc_handle *hdl = config;
+static struct qc_handle *qc_get_layer_handle(struct qc_handle *root, int layer) {
+	if (layer < 0 || layer >= root->num_layers)
+		return NULL;
 
-	do {
-		if (hdl->layer_no == layer)
-			return hdl;
-		hdl = hdl->next;
-	} while (hdl);
-
-	return NULL;
+	return root->layers[layer];
 }
 
 static int qc_is_attr_id_valid(enum qc_attr_id id) {
-	return id <= qc_secure;
+	return id <= qc_ziip_effective_capacity_layer;
 }
 
 __attribute__ ((visibility ("default"))) int qc_get_attribute_string(void *cfg, enum qc_attr_id id, int layer, const char **value) {
-	struct qc_handle *hdl;
+	struct qc_handle *root, *hdl;
 	int rc;
 
 	*value = NULL;
-	if (qc_hdl_verify(cfg, "qc_get_attribute_string"))
+	if ((root = qc_hdl_verify(cfg, "qc_get_attribute_string")) == NULL)
 		return -4;
-	hdl = qc_get_layer_handle(cfg, layer);
-	qc_debug(cfg, "qc_get_attribute_string(attr=%d, layer=%d)\n", id, layer);
+	hdl = qc_get_layer_handle(root, layer);
+	qc_debug(root, "qc_get_attribute_string(attr=%d, layer=%d)\n", id, layer);
 	qc_debug_indent_inc();
 	if (!hdl) {
 		rc = -1;
@@ -969,33 +1899,35 @@ __attribute__ ((visibility ("default"))) int qc_get_attribute_string(void *cfg,
 		goto out;
 	}
 	if ((*value = qc_get_attr_value_string(hdl, id))) {
-		qc_debug(cfg, "Attr '%s' from '%c' res=%s\n", qc_attr_id_to_char(cfg, id), qc_get_attr_value_src_string(hdl, id), *value);
+		qc_debug(root, "Attr '%s' from '%c' res=%s\n", qc_attr_id_to_char(root, id), qc_get_attr_value_src_string(hdl, id), *value);
 		rc = 1;
 		goto out;
 	}
 	if (qc_is_attr_set_string(hdl, id) <= 0) {
-		qc_debug(cfg, "Attr '%s' not defined\n", qc_attr_id_to_char(cfg, id));
+		qc_debug(root, "Attr '%s' not defined\n", qc_attr_id_to_char(root, id));
 		rc = 0;
 		goto out;
 	}
 	rc = -3;
 
 out:
-	qc_debug(cfg, "Return value='%s', rc=%d\n", *value, rc);
+	qc_debug(root, "Return value='%s', rc=%d\n", *value, rc);
 	qc_debug_indent_dec();
+	qc_hdl_put(cfg);
+
 	return rc;
 }
 
 __attribute__ ((visibility ("default"))) int qc_get_attribute_int(void *cfg, enum qc_attr_id id, int layer, int *value) {
-	struct qc_handle *hdl;
+	struct qc_handle *root, *hdl;
 	void *ptr = NULL;
 	int rc;
 
 	*value = -EINVAL;
-	if (qc_hdl_verify(cfg, "qc_get_attribute_int"))
+	if ((root = qc_hdl_verify(cfg, "qc_get_attribute_int")) == NULL)
 		return -4;
-	hdl = qc_get_layer_handle(cfg, layer);
-	qc_debug(cfg, "qc_get_attribute_int(attr=%d, layer=%d)\n", id, layer);
+	hdl = qc_get_layer_handle(root, layer);
+	qc_debug(root, "qc_get_attribute_int(attr=%d, layer=%d)\n", id, layer);
 	qc_debug_indent_inc();
 	if (!hdl) {
 		rc = -1;
@@ -1006,13 +1938,13 @@ __attribute__ ((visibility ("default"))) int qc_get_attribute_int(void *cfg, enu
 		goto out;
 	}
 	if ((ptr = qc_get_attr_value_int(hdl, id))) {
-		qc_debug(cfg, "Attr '%s' from '%c' res=%d\n", qc_attr_id_to_char(cfg, id), qc_get_attr_value_src_int(hdl, id), *(int *)ptr);
+		qc_debug(root, "Attr '%s' from '%c' res=%d\n", qc_attr_id_to_char(root, id), qc_get_attr_value_src_int(hdl, id), *(int *)ptr);
 		rc = 1;
 		goto out;
 	}
 	// Attribute value not set - let's figure out why
 	if (qc_is_attr_set_int(hdl, id) <= 0) {
-		qc_debug(cfg, "Attr '%s' not defined\n", qc_attr_id_to_char(cfg, id));
+		qc_debug(root, "Attr '%s' not defined\n", qc_attr_id_to_char(root, id));
 		rc = 0;
 		goto out;
 	}
@@ -1021,23 +1953,24 @@ __attribute__ ((visibility ("default"))) int qc_get_attribute_int(void *cfg, enu
 out:
 	if (ptr)
 		*value = *(int *)ptr;
-	qc_debug(cfg, "Return value=%d, rc=%d\n", *value, rc);
+	qc_debug(root, "Return value=%d, rc=%d\n", *value, rc);
 	qc_debug_indent_dec();
+	qc_hdl_put(cfg);
 
 	return rc;
 }
 
 
 __attribute__ ((visibility ("default"))) int qc_get_attribute_float(void *cfg, enum qc_attr_id id, int layer, float *value) {
-	struct qc_handle *hdl;
+	struct qc_handle *root, *hdl;
 	void *ptr = NULL;
 	int rc;
 
 	*value = -EINVAL;
-	if (qc_hdl_verify(cfg, "qc_get_attribute_float"))
+	if ((root = qc_hdl_verify(cfg, "qc_get_attribute_float")) == NULL)
 		return -4;
-	hdl = qc_get_layer_handle(cfg, layer);
-	qc_debug(cfg, "qc_get_attribute_float(attr=%d, layer=%d)\n", id, layer);
+	hdl = qc_get_layer_handle(root, layer);
+	qc_debug(root, "qc_get_attribute_float(attr=%d, layer=%d)\n", id, layer);
 	qc_debug_indent_inc();
 	if (!hdl) {
 		rc = -1;
@@ -1048,13 +1981,13 @@ __attribute__ ((visibility ("default"))) int qc_get_attribute_float(void *cfg, e
 		goto out;
 	}
 	if ((ptr = qc_get_attr_value_float(hdl, id))) {
-		qc_debug(cfg, "Attr '%s' from '%c' res=%f\n", qc_attr_id_to_char(cfg, id), qc_get_attr_value_src_float(hdl, id), *(float *)ptr);
+		qc_debug(root, "Attr '%s' from '%c' res=%f\n", qc_attr_id_to_char(root, id), qc_get_attr_value_src_float(hdl, id), *(float *)ptr);
 		rc = 1;
 		goto out;
 	}
 	// Attribute value not set - let's figure out why
 	if (qc_is_attr_set_float(hdl, id) <= 0) {
-		qc_debug(cfg, "Attr '%s' not defined\n", qc_attr_id_to_char(cfg, id));
+		qc_debug(root, "Attr '%s' not defined\n", qc_attr_id_to_char(root, id));
 		rc = 0;
 		goto out;
 	}
@@ -1063,38 +1996,300 @@ __attribute__ ((visibility ("default"))) int qc_get_attribute_float(void *cfg, e
 out:
 	if (ptr)
 		*value = *(float *)ptr;
-	qc_debug(cfg, "Return value=%f, rc=%d\n", *value, rc);
+	qc_debug(root, "Return value=%f, rc=%d\n", *value, rc);
+	qc_debug_indent_dec();
+	qc_hdl_put(cfg);
+
+	return rc;
+}
+
+// Retrieve a single attribute for qc_get_attributes(), matching the qc_get_attribute_*() functions
+static int qc_get_attr_req(struct qc_handle *hdl, struct qc_attr_req *req) {
+	void *ptr;
+	int set;
+
+	switch (req->type) {
+	case QC_ATTR_TYPE_INT:
+		req->value.i = -EINVAL;
+		break;
+	case QC_ATTR_TYPE_FLOAT:
+		req->value.f = -EINVAL;
+		break;
+	case QC_ATTR_TYPE_STRING:
+		req->value.s = NULL;
+		break;
+	default:
+		return -2;
+	}
+	if (!hdl)
+		return -1;
+	if (!qc_is_attr_id_valid(req->id))
+		return -2;
+	switch (req->type) {
+	case QC_ATTR_TYPE_INT:
+		if ((ptr = qc_get_attr_value_int(hdl, req->id))) {
+			req->value.i = *(int *)ptr;
+			return 1;
+		}
+		set = qc_is_attr_set_int(hdl, req->id);
+		break;
+	case QC_ATTR_TYPE_FLOAT:
+		if ((ptr = qc_get_attr_value_float(hdl, req->id))) {
+			req->value.f = *(float *)ptr;
+			return 1;
+		}
+		set = qc_is_attr_set_float(hdl, req->id);
+		break;
+	default:
+		if ((req->value.s = qc_get_attr_value_string(hdl, req->id)))
+			return 1;
+		set = qc_is_attr_set_string(hdl, req->id);
+		break;
+	}
+
+	return set <= 0 ? 0 : -3;
+}
+
+__attribute__ ((visibility ("default"))) int qc_get_attributes(void *cfg, struct qc_attr_req *reqs, int num) {
+	struct qc_handle *root;
+	int i, rc = 0;
+
+	if ((root = qc_hdl_verify(cfg, "qc_get_attributes")) == NULL)
+		return -4;
+	qc_debug(root, "qc_get_attributes(num=%d)\n", num);
+	qc_debug_indent_inc();
+	if (!reqs && num > 0) {
+		rc = -EINVAL;
+		goto out;
+	}
+	for (i = 0; i < num; i++)
+		reqs[i].rc = qc_get_attr_req(qc_get_layer_handle(root, reqs[i].layer), &reqs[i]);
+
+out:
+	qc_debug(root, "Return rc=%d\n", rc);
+	qc_debug_indent_dec();
+	qc_hdl_put(cfg);
+
+	return rc;
+}
+
+__attribute__ ((visibility ("default"))) int qc_get_attribute_changed(void *cfg, enum qc_attr_id id, int layer) {
+	struct qc_handle *root, *hdl;
+	int rc;
+
+	if ((root = qc_hdl_verify(cfg, "qc_get_attribute_changed")) == NULL)
+		return -4;
+	hdl = qc_get_layer_handle(root, layer);
+	qc_debug(root, "qc_get_attribute_changed(attr=%d, layer=%d)\n", id, layer);
+	qc_debug_indent_inc();
+	if (!hdl) {
+		rc = -1;
+		goto out;
+	}
+	if (!qc_is_attr_id_valid(id)) {
+		rc = -2;
+		goto out;
+	}
+	if ((rc = qc_is_attr_changed(hdl, id)) < 0)
+		rc = -3;
+
+out:
+	qc_debug(root, "Return rc=%d\n", rc);
 	qc_debug_indent_dec();
+	qc_hdl_put(cfg);
 
 	return rc;
 }
 
-static void qc_start_object(int *jindent, int layer) {
-	printf("%*s\"Layer %d\": {\n", *jindent, "", layer);
+static void qc_start_object(struct qc_json_out *out, int *jindent, int layer) {
+	if (out->flags & QC_JSON_COMPACT)
+		qc_json_printf(out, "\"Layer %d\":{", layer);
+	else
+		qc_json_printf(out, "%*s\"Layer %d\": {\n", *jindent, "", layer);
 	*jindent += 2;
 }
-static void qc_end_object(int *jindent, int final) {
+static void qc_end_object(struct qc_json_out *out, int *jindent, int final) {
 	*jindent -= 2;
-	printf("%*s}%s\n", *jindent, "", (final ? "" : ","));
+	if (out->flags & QC_JSON_COMPACT)
+		qc_json_printf(out, "}%s", (final ? "" : ","));
+	else
+		qc_json_printf(out, "%*s}%s\n", *jindent, "", (final ? "" : ","));
 }
 
-__attribute__ ((visibility ("default"))) void qc_export_json(void *cfg) {
-	struct qc_handle *hdl = (struct qc_handle *)cfg;
+static int _qc_export_json(struct qc_handle *root, struct qc_json_out *out) {
 	int jindent = 0;	// indent for json output
+	struct qc_handle *hdl;
 	int i;
 
-	if (!hdl)
-		return;
-
-	printf("{\n");
+	qc_debug(root, "Export JSON (flags=0x%x)\n", out->flags);
+	qc_debug_indent_inc();
+	qc_json_printf(out, (out->flags & QC_JSON_COMPACT) ? "{" : "{\n");
 	jindent += 2;
-	for (hdl = hdl->root, i = 0; hdl != NULL; hdl = hdl->next, i++) {
-		qc_start_object(&jindent, i);
-		qc_print_attrs_json(hdl, jindent);
-		qc_end_object(&jindent, hdl->next == NULL);
+	for (hdl = root, i = 0; hdl != NULL; hdl = hdl->next, i++) {
+		qc_start_object(out, &jindent, i);
+		qc_print_attrs_json(out, hdl, jindent);
+		qc_end_object(out, &jindent, hdl->next == NULL);
 	}
+	qc_json_printf(out, (out->flags & QC_JSON_COMPACT) ? "}" : "}\n");
+	qc_json_flush(out);
+	qc_debug(root, "Return rc=%d\n", out->err);
+	qc_debug_indent_dec();
 
-	printf("}\n");
+	return out->err;
+}
+
+__attribute__ ((visibility ("default"))) void qc_export_json(void *cfg) {
+	struct qc_json_out out = { .fp = stdout, .fd = -1 };
+	struct qc_handle *hdl;
+
+	if ((hdl = qc_hdl_verify(cfg, "qc_export_json")) == NULL)
+		return;
+	_qc_export_json(hdl, &out);
+	qc_hdl_put(cfg);
 
 	return;
 }
+
+__attribute__ ((visibility ("default"))) int qc_export_json_file(void *cfg, FILE *fp, int flags) {
+	struct qc_json_out out = { .flags = flags, .fp = fp, .fd = -1 };
+	struct qc_handle *hdl;
+	int rc;
+
+	if ((hdl = qc_hdl_verify(cfg, "qc_export_json_file")) == NULL)
+		return -EFAULT;
+	if (!fp || (flags & ~QC_JSON_ALL))
+		rc = -EINVAL;
+	else
+		rc = _qc_export_json(hdl, &out);
+	qc_hdl_put(cfg);
+
+	return rc;
+}
+
+__attribute__ ((visibility ("default"))) int qc_export_json_fd(void *cfg, int fd, int flags) {
+	struct qc_json_out out = { .flags = flags, .fd = fd };
+	struct qc_handle *hdl;
+	char buf[4096];
+	int rc;
+
+	if ((hdl = qc_hdl_verify(cfg, "qc_export_json_fd")) == NULL)
+		return -EFAULT;
+	if (fd < 0 || (flags & ~QC_JSON_ALL)) {
+		rc = -EINVAL;
+	} else {
+		out.buf = buf;
+		out.size = sizeof(buf);
+		rc = _qc_export_json(hdl, &out);
+	}
+	qc_hdl_put(cfg);
+
+	return rc;
+}
+
+__attribute__ ((visibility ("default"))) int qc_export_json_buf(void *cfg, char *buf, size_t size, size_t *len, int flags) {
+	struct qc_json_out out = { .flags = flags, .fd = -1, .buf = buf, .size = size };
+	struct qc_handle *hdl;
+	int rc;
+
+	if ((hdl = qc_hdl_verify(cfg, "qc_export_json_buf")) == NULL)
+		return -EFAULT;
+	if ((!buf && size) || (flags & ~QC_JSON_ALL))
+		rc = -EINVAL;
+	else if ((rc = _qc_export_json(hdl, &out)) == 0) {
+		if (len)
+			*len = out.len;
+		rc = out.len < size ? 0 : 1;
+	}
+	qc_hdl_put(cfg);
+
+	return rc;
+}
+
+__attribute__ ((visibility ("default"))) int qc_get_stats(void *cfg, struct qc_stats *stats) {
+	unsigned long long *src, *tgt;
+	struct qc_handle *hdl = NULL;
+	size_t i;
+
+	if (cfg && (hdl = qc_hdl_verify(cfg, "qc_get_stats")) == NULL)
+		return -EFAULT;
+	if (stats) {
+		// counters are updated concurrently, so read each atomically
+		src = (unsigned long long *)(hdl ? &hdl->stats : &qc_stats);
+		tgt = (unsigned long long *)stats;
+		for (i = 0; i < sizeof(struct qc_stats) / sizeof(unsigned long long); i++)
+			tgt[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+	}
+	if (hdl)
+		qc_hdl_put(cfg);
+
+	return stats ? 0 : -EINVAL;
+}
+
+__attribute__ ((visibility ("default"))) int qc_history_enable(void *cfg, const enum qc_attr_id *ids, int num_ids,
+								int size) {
+	struct qc_handle *hdl;
+	int i, rc = 0;
+
+	if ((hdl = qc_hdl_verify(cfg, "qc_history_enable")) == NULL)
+		return -EFAULT;
+	qc_debug(hdl, "qc_history_enable(num_ids=%d, size=%d)\n", ids ? num_ids : 0, size);
+	qc_debug_indent_inc();
+	if (size < 0 || size > QC_HISTORY_MAX_SIZE || (ids && (num_ids <= 0 || num_ids > QC_NUM_ATTR_IDS))) {
+		rc = -EINVAL;
+		goto out;
+	}
+	for (i = 0; ids && i < num_ids; i++) {
+		if ((unsigned int)ids[i] >= QC_NUM_ATTR_IDS) {
+			rc = -EINVAL;
+			goto out;
+		}
+	}
+	if (size)
+		rc = qc_history_create(hdl, ids, num_ids, size);
+	else
+		qc_history_free(hdl);
+
+out:
+	qc_debug(hdl, "Return rc=%d\n", rc);
+	qc_debug_indent_dec();
+	qc_hdl_put(cfg);
+
+	return rc;
+}
+
+__attribute__ ((visibility ("default"))) int qc_history_get(void *cfg, enum qc_attr_id id, int layer,
+							     struct qc_history_sample *samples, int num) {
+	struct qc_handle *hdl;
+	int rc;
+
+	if ((hdl = qc_hdl_verify(cfg, "qc_history_get")) == NULL)
+		return -EFAULT;
+	if (!samples || num < 0 || layer < 0)
+		rc = -EINVAL;
+	else if (!hdl->history)
+		rc = -ENODATA;
+	else
+		rc = qc_history_read(hdl, id, layer, samples, num);
+	qc_hdl_put(cfg);
+
+	return rc;
+}
+
+__attribute__ ((visibility ("default"))) int qc_history_summary(void *cfg, enum qc_attr_id id, int layer,
+								 unsigned long long window,
+								 struct qc_history_summary *summary) {
+	struct qc_handle *hdl;
+	int rc = 0;
+
+	if ((hdl = qc_hdl_verify(cfg, "qc_history_summary")) == NULL)
+		return -EFAULT;
+	if (!summary || layer < 0)
+		rc = -EINVAL;
+	else if (!hdl->history)
+		rc = -ENODATA;
+	else
+		qc_history_summarize(hdl, id, layer, window, summary);
+	qc_hdl_put(cfg);
+
+	return rc;
+}
@@ -7,10 +7,13 @@
 
 #define QC_VERSION	"2.5.1"
 
+#include <stdio.h>
+
 
 /* Build Customization */
 //#define CONFIG_DUMP_READING		// Allow to read in dumps
 //#define CONFIG_V1_COMPATIBILITY	// Support functionality deprecated in v1.x
+//#define CONFIG_NO_DEBUG		// Compile out all log messages
 
 /** \enum qc_attr_id
  * Defines the attributes retrievable by the API. Attributes can
@@ -54,6 +57,20 @@
  * In layers reporting cores, use attributes #qc_num_cp_threads, #qc_num_ifl_threads and
  * #qc_num_ziip_threads to derive the number of CPUs.
  *
+ * ### Effective Capacity ###
+ * The attributes #qc_cp_effective_capacity, #qc_ifl_effective_capacity and
+ * #qc_ziip_effective_capacity are computed from all layers, and denote an upper
+ * bound of the capacity that is available to the topmost layer for the respective
+ * CPU type. Each layer on the way from the topmost layer down to the CEC can limit
+ * the capacity through the number of CPUs or cores of the respective type, as well as
+ * through any absolute cappings, weight-based cappings and capped capacities.
+ * Where a layer dispatches a CPU type on another type (see e.g.
+ * #qc_cp_dispatch_type), the limits of the latter type apply in the layers below.
+ * The value is a scaled value where 0x10000 equals to one core, and the number of the
+ * layer imposing the tightest limit is reported in #qc_cp_effective_capacity_layer,
+ * #qc_ifl_effective_capacity_layer and #qc_ziip_effective_capacity_layer respectively.
+ * Note that actual capacity might be lower due to contention with other consumers.
+ *
  * ### Notes ###
  * - zIIPs are not included in CPU and core total counts.
  * - Special care needs to be taken with respect to [5] when processing #qc_num_core_total,
@@ -167,6 +184,12 @@
  * #qc_ifl_weight_capping              | int  |<CODE>&nbsp;&nbsp;V</CODE>| Reported in unit of cores<br><b>Note</b>: \b [4]
  * #qc_ziip_absolute_capping           | int  |<CODE>&nbsp;&nbsp;V</CODE>| Reported in unit of cores
  * #qc_ziip_weight_capping             | int  |<CODE>&nbsp;&nbsp;V</CODE>| Reported in unit of cores<br><b>Note</b>: \b [4]
+ * #qc_cp_effective_capacity           | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_cp_effective_capacity_layer     | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ifl_effective_capacity          | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ifl_effective_capacity_layer    | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ziip_effective_capacity         | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ziip_effective_capacity_layer   | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
  *
  *
  * Attributes for z/VM hypervisors     | Type | Src | Comment
@@ -196,6 +219,12 @@
  * #qc_num_cp_threads                  | int  |<CODE>&nbsp;&nbsp;V</CODE>| Number of threads/CPUs per CP core in use
  * #qc_num_ifl_threads                 | int  |<CODE>&nbsp;&nbsp;V</CODE>| Number of threads/CPUs per IFL core in use
  * #qc_num_ziip_threads                | int  |<CODE>&nbsp;&nbsp;V</CODE>| Number of threads/CPUs per zIIP core in use
+ * #qc_cp_effective_capacity           | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_cp_effective_capacity_layer     | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ifl_effective_capacity          | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ifl_effective_capacity_layer    | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ziip_effective_capacity         | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ziip_effective_capacity_layer   | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
  *
  *
  * Attributes for z/VM resource pools  | Type | Src | Comment
@@ -253,6 +282,12 @@
  * #qc_ziip_dispatch_limithard         | int  |<CODE>&nbsp;&nbsp;V</CODE>| \n
  * #qc_ziip_dispatch_type              | int  |<CODE>&nbsp;&nbsp;V</CODE>| Only set in presence of zIIPs
  * #qc_ziip_capped_capacity            | int  |<CODE>&nbsp;&nbsp;V</CODE>| Reported in unit of cores unless run as a guest of another hypervisor other than LPAR
+ * #qc_cp_effective_capacity           | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_cp_effective_capacity_layer     | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ifl_effective_capacity          | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ifl_effective_capacity_layer    | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ziip_effective_capacity         | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ziip_effective_capacity_layer   | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
  *
  *
  * Attributes for z/OS hypervisors     | Type | Src | Comment
@@ -323,6 +358,12 @@
  * #qc_ziip_dispatch_limithard         | int  |<CODE>&nbsp;&nbsp;V</CODE>| \n
  * #qc_ziip_dispatch_type              | int  |<CODE>&nbsp;&nbsp;V</CODE>| Only set in presence of zIIPs<br><b>NOTE: I guess it would be cleaner if we would switch to IFL attributes instead of zIIPs, since that is (to my understanding), what Linux will see - and use THIS attribute to indicate that the IFLs are dispatched to zIIPs...?</b>
  * #qc_ziip_capped_capacity            | int  |<CODE>&nbsp;&nbsp;V</CODE>| Reported in unit of cores unless run as a guest of another hypervisor other than LPAR
+ * #qc_cp_effective_capacity           | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_cp_effective_capacity_layer     | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ifl_effective_capacity          | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ifl_effective_capacity_layer    | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ziip_effective_capacity         | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ziip_effective_capacity_layer   | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
  *
  *
  * Attributes for KVM hypervisors      | Type | Src | Comment
@@ -342,6 +383,12 @@
  * #qc_num_ifl_total                   | int  |<CODE>SHV</CODE>| Sum of #qc_num_ifl_dedicated and #qc_num_ifl_shared<br>Reported in unit of cores unless run as a guest of another hypervisor other than LPAR
  * #qc_num_ifl_dedicated               | int  |<CODE>ShV</CODE>| Reported in unit of cores unless run as a guest of another hypervisor other than LPAR
  * #qc_num_ifl_shared                  | int  |<CODE>ShV</CODE>| Reported in unit of cores unless run as a guest of another hypervisor other than LPAR
+ * #qc_cp_effective_capacity           | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_cp_effective_capacity_layer     | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ifl_effective_capacity          | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ifl_effective_capacity_layer    | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ziip_effective_capacity         | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ziip_effective_capacity_layer   | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
  *
  *
  * Attributes for KVM guests           | Type | Src | Comment
@@ -365,6 +412,12 @@
  * #qc_num_ifl_dedicated               | int  |<CODE>S&nbsp;&nbsp;</CODE>| Reported in unit of CPUs
  * #qc_num_ifl_shared                  | int  |<CODE>S&nbsp;&nbsp;</CODE>| Reported in unit of CPUs
  * #qc_ifl_dispatch_type               | int  |<CODE>SHV</CODE>| \n
+ * #qc_cp_effective_capacity           | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_cp_effective_capacity_layer     | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ifl_effective_capacity          | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ifl_effective_capacity_layer    | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ziip_effective_capacity         | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
+ * #qc_ziip_effective_capacity_layer   | int  |     | Computed for the topmost layer only, see <i>Effective Capacity</i>
  *
  * \b [1] Available starting with RHEL7.2 and SLES12SP1<br>
  * \b [2] <I>z/Architecture Principles of Operation</I>, SA22-7832<br>
@@ -440,6 +493,21 @@ enum qc_model_families {
 	QC_TYPE_FAMILY_LINUXONE = 1,
 };
 
+/** \enum qc_refresh_flags
+ * Data sources to refresh in qc_refresh(). Can be combined. */
+enum qc_refresh_flags {
+	/** Data from \c /proc/sysinfo */
+	QC_REFRESH_SYSINFO = 0x01,
+	/** Data from hypfs (\c diag_204 and \c diag_2fc) */
+	QC_REFRESH_HYPFS = 0x02,
+	/** Data from the \c STHYI instruction */
+	QC_REFRESH_STHYI = 0x04,
+	/** Data from sysfs */
+	QC_REFRESH_SYSFS = 0x08,
+	/** All data sources */
+	QC_REFRESH_ALL = 0x0f,
+};
+
 /** \enum qc_attr_id */
 enum qc_attr_id {
 	/** The adjustment factor indicates the maximum percentage of the machine (in parts of 1000) that could be
@@ -517,6 +585,21 @@ enum qc_attr_id {
 	qc_ziip_limithard_cap = 71,
 	/** zIIP weight-based capping value -- scaled value where 0x10000 equals to one core, or 0 if no capping set */
 	qc_ziip_weight_capping = 72,
+	/** Maximum CP capacity that the topmost layer can use, considering the number of CPUs as well as all
+	    cappings in all layers -- scaled value where 0x10000 equals to one core.
+	    Note: This attribute is only ever available for the topmost layer. */
+	qc_cp_effective_capacity = 79,
+	/** Layer imposing the limit in #qc_cp_effective_capacity.
+	    Note: This attribute is only ever available for the topmost layer. */
+	qc_cp_effective_capacity_layer = 80,
+	/** Maximum IFL capacity that the topmost layer can use, see #qc_cp_effective_capacity */
+	qc_ifl_effective_capacity = 81,
+	/** Layer imposing the limit in #qc_ifl_effective_capacity */
+	qc_ifl_effective_capacity_layer = 82,
+	/** Maximum zIIP capacity that the topmost layer can use, see #qc_cp_effective_capacity */
+	qc_ziip_effective_capacity = 83,
+	/** Layer imposing the limit in #qc_ziip_effective_capacity */
+	qc_ziip_effective_capacity_layer = 84,
 	/** Layer category, see layer tables above for details */
 	qc_layer_category = 24,
 	/** Numeric representation  of layer category, see enum #qc_layer_categories */
@@ -623,6 +706,72 @@ enum qc_attr_id {
 	qc_lic_identifier = 64,
 };
 
+/** \enum qc_attr_type
+ * Types of attributes as retrieved by qc_get_attributes(). */
+enum qc_attr_type {
+	/** Integer, see qc_get_attribute_int() */
+	QC_ATTR_TYPE_INT = 0,
+	/** Floating point, see qc_get_attribute_float() */
+	QC_ATTR_TYPE_FLOAT = 1,
+	/** String, see qc_get_attribute_string() */
+	QC_ATTR_TYPE_STRING = 2,
+};
+
+/** Value of an attribute, interpreted according to its \ref qc_attr_type */
+union qc_attr_value {
+	int		 i;
+	float		 f;
+	const char	*s;
+};
+
+/** Request to retrieve a single attribute in qc_get_attributes() */
+struct qc_attr_req {
+	/** Attribute to retrieve */
+	enum qc_attr_id		 id;
+	/** Layer to retrieve the attribute from */
+	int			 layer;
+	/** Type of the attribute */
+	enum qc_attr_type	 type;
+	/** Set to the return code of the respective qc_get_attribute_*() function */
+	int			 rc;
+	/** Set to the value of the attribute, as returned by the respective
+	    qc_get_attribute_*() function */
+	union qc_attr_value	 value;
+};
+
+/** Change of a single attribute as reported to a \ref qc_watch_cb */
+struct qc_attr_change {
+	/** Layer of the attribute */
+	int			 layer;
+	/** Attribute that changed */
+	enum qc_attr_id		 id;
+	/** Type of the attribute */
+	enum qc_attr_type	 type;
+	/** 1 if the attribute was set before the change, 0 otherwise */
+	int			 old_set;
+	/** 1 if the attribute is set after the change, 0 otherwise */
+	int			 new_set;
+	/** Value before the change, valid if \p old_set is 1 */
+	union qc_attr_value	 old_value;
+	/** Value after the change, valid if \p new_set is 1 */
+	union qc_attr_value	 new_value;
+};
+
+/**
+ * Callback invoked by a watcher started via qc_watch_start() whenever
+ * attributes changed. Runs on the watcher's thread.
+ *
+ * @param hdl Handle of the configuration after the change. Can be used to
+ *            query further attributes, but must not be closed or refreshed.
+ *            Since the watcher refreshes it concurrently, it must not be used
+ *            outside of the callback, in particular not from other threads.
+ * @param changes Array of changed attributes. Strings are valid for the
+ *                duration of the callback only.
+ * @param num Number of elements in \p changes.
+ * @param data Pointer as passed to qc_watch_start().
+ */
+typedef void (*qc_watch_cb)(void *hdl, const struct qc_attr_change *changes, int num, void *data);
+
 
 /**
  * Attaches to system information sources and prepares the extraction of
@@ -637,6 +786,9 @@ enum qc_attr_id {
  * after a configuration has been opened, closing the configuration and
  * re-opening it ensures capacity information is used from the migrated-to
  * system.<BR>
+ * Multiple threads can open, use and close configurations concurrently. A
+ * configuration must not be used by other threads while it is refreshed or
+ * closed.<BR>
  * Use the following environment variables to operate built-in service facilities:
  * - \c QC_DEBUG: Set to an integer value
  *   - >0 to enable logging to a file \c /tmp/qclib-XXXXXX or as specified by
@@ -648,6 +800,11 @@ enum qc_attr_id {
  *   <=0 on the next qc_open() call.<BR>
  * - \c QC_DEBUG_FILE: Stem to use for log files and dump directories (see \c
  *   QC_DEBUG). Defaults to \c /tmp/qclib-XXXXXX.
+ * - \c QC_DEBUG_RING: Set to a value >0 to keep log messages in an in-memory
+ *   ring buffer of that many messages instead of writing them to the log file
+ *   right away. The ring buffer is written to the log file in qc_close(), and
+ *   older messages are lost if it overflows. Reduces the overhead of logging
+ *   to a minimum.
  * - \c QC_AUTODUMP: Set to a value >0 to trigger a dump to a directory named
  *   \c /tmp/qclib-XXXXXX.dump-XXX if an error is encountered within qc_open().<br>
  *   <b>Note</b>: This will also create an empty log file for technical reasons,
@@ -655,8 +812,19 @@ enum qc_attr_id {
  * - \c QC_USE_DUMP: To run with a previously generated dump instead of live data,
      point this environment variable to a directory containing the dump data.
      Requires compilation with \c CONFIG_DUMP_READING set.
- * - \c QC_CHECK_CONSISTENCY: Check data for consistency. Recommended for debugging
- *   scenarios only.
+ * - \c QC_CHECK_CONSISTENCY: Check data for consistency. If inconsistent, data is
+ *   retrieved again from the data sources involved, see \c QC_RETRIES.
+ * - \c QC_RETRIES: Maximum number of times to retrieve data again from the data
+ *   sources involved if data is inconsistent, e.g. due to CPU hotplug. Defaults
+ *   to 2, maximum is 10. Data attached via \c QC_USE_SHM is not retried.
+ * - \c QC_RETRY_DELAY: Time in milliseconds to wait before the first retry,
+ *   doubled for each further retry up to a maximum of 1 second. Defaults to 0.
+ * - \c QC_PARALLEL_OPEN: Set to a value >0 to retrieve data from the data sources
+ *   concurrently, which reduces the latency of qc_open() and qc_refresh().
+ * - \c QC_USE_SHM: Point to a file that data is published to by another
+ *   process, e.g. by the \c qcd daemon, to use that data instead of retrieving
+ *   it from the data sources, see qc_publish(). Falls back to retrieving data
+ *   from the data sources if the file does not contain valid, current data.
  *
  * @see qc_close()
  *
@@ -671,11 +839,104 @@ enum qc_attr_id {
  */
 void *qc_open(int *rc);
 
+/**
+ * Opens a configuration handle with data from a snapshot previously created by
+ * qc_save_snapshot(), possibly on a different system. The data is used as is,
+ * without accessing any data sources, and cannot be refreshed.
+ * Snapshots can only be opened by qclib versions using the same set of
+ * attributes.
+ *
+ * @see qc_close()
+ *
+ * @param buf Snapshot to use.
+ * @param len Length of \p buf.
+ * @param rc Return parameter indicating the return code. Set to 0 on success,
+ *           and <0 in case of an error, e.g. if \p buf is not a valid snapshot.
+ * @return Returns a configuration handle which is valid for reading out
+ *         capacity data until the configuration is closed. Returns NULL in
+ *         case of an error.
+ */
+void *qc_open_from_snapshot(const char *buf, size_t len, int *rc);
+
+/** In-memory copy of the raw data of the data sources, as used by
+    qc_open_from_dump(). Set members to NULL for data that is not available. */
+struct qc_dump {
+	/** Content of \c /proc/sysinfo */
+	const char	*sysinfo;
+	/** Length of \c sysinfo */
+	size_t		 sysinfo_len;
+	/** Response buffer of the STHYI instruction */
+	const char	*sthyi;
+	/** Length of \c sthyi */
+	size_t		 sthyi_len;
+	/** Content of \c s390_hypfs/diag_204 in debugfs, used in LPARs */
+	const char	*diag_204;
+	/** Length of \c diag_204 */
+	size_t		 diag_204_len;
+	/** Content of \c s390_hypfs/diag_2fc in debugfs, used in z/VM guests.
+	    Takes precedence over \c diag_204 */
+	const char	*diag_2fc;
+	/** Length of \c diag_2fc */
+	size_t		 diag_2fc_len;
+	/** Content of \c /sys/firmware/ocf/cpc_name, null-terminated */
+	const char	*cpc_name;
+	/** Content of \c /sys/firmware/ipl/has_secure, null-terminated */
+	const char	*has_secure;
+	/** Content of \c /sys/firmware/ipl/secure, null-terminated */
+	const char	*secure;
+};
+
+/**
+ * Opens a configuration handle with data from the raw data of the data sources
+ * in \p dump instead of the actual data sources, without any file system
+ * access. This allows to process dumps of different systems. Unlike \c
+ * QC_USE_DUMP (see qc_open()), this does not rely on any process-wide state
+ * and can be used in multiple threads at the same time.
+ * The handle cannot be refreshed, and \p dump is not referenced anymore once
+ * this function returns.
+ * Requires compilation with \c CONFIG_DUMP_READING set.
+ *
+ * @see qc_close()
+ *
+ * @param dump Data to use.
+ * @param rc Return parameter indicating the return code. Set to
+ * - 0 on success,
+ * - <0 in case of an error, and
+ * - >0 if the data is inconsistent.
+ * @return Returns a configuration handle which is valid for reading out
+ *         capacity data until the configuration is closed. Returns NULL in
+ *         case of an error.
+ */
+void *qc_open_from_dump(const struct qc_dump *dump, int *rc);
+
+/**
+ * Reads the raw data of the data sources from a dump directory as created with
+ * \c QC_AUTODUMP or \c QC_DEBUG=2 (see qc_open()) into \p dump, for use with
+ * qc_open_from_dump(). Data missing in the dump is left at NULL.
+ * Release the data with qc_free_dump() when done.
+ *
+ * @param path Path of the dump directory.
+ * @param dump Return parameter for the data.
+ * @return 0 on success, and <0 in case of an error, e.g. \c -ENODATA if the
+ *         dump is incomplete.
+ */
+int qc_read_dump(const char *path, struct qc_dump *dump);
+
+/**
+ * Releases the data read by qc_read_dump().
+ *
+ * @param dump Data to release.
+ */
+void qc_free_dump(struct qc_dump *dump);
+
 /**
  * Closes the configuration handle and releases all memory allocated when the
  * configuration was opened. The configuration handle is invalid after
  * calling this function, as are any returned pointers of previous capacity
  * function calls.
+ * Calls on the handle that are in progress in other threads are completed
+ * before the handle is released, and closing a handle multiple times is
+ * harmless.
  *
  * If logging or autodumping was enabled on qc_open(), environment variables
  * \c QC_DEBUG and \c QC_AUTODUMP need to be set to integers <=0 on the final
@@ -686,6 +947,74 @@ void *qc_open(int *rc);
  */
 void qc_close(void *hdl);
 
+/**
+ * Publishes the data of an open configuration handle to file \p path, which
+ * is typically located in \c /dev/shm, for use by other processes that have
+ * environment variable \c QC_USE_SHM set, see qc_open().
+ * Readers copy the data without locking and retry in case of a concurrent
+ * update, so calling this function repeatedly to publish refreshed data never
+ * blocks on readers.
+ * The file is created if it does not exist. Symlinks are not followed, and
+ * existing files must be owned by the caller's effective user and must not be
+ * writable by others. Likewise, readers only accept files owned by root or
+ * their own effective user that are not writable by others.
+ *
+ * @param hdl Handle of the configuration to publish.
+ * @param path File to publish the data to.
+ * @param validity Number of seconds after which readers consider the data
+ *        stale and retrieve data from the data sources instead. Specify 0 for
+ *        no limit.
+ * @return 0 on success, <0 in case of an error.
+ */
+int qc_publish(void *hdl, const char *path, int validity);
+
+/**
+ * Writes a snapshot of the data of an open configuration handle to \p buf in
+ * a compact binary format, for use with qc_open_from_snapshot(). Pass \p size
+ * 0 to determine the required size.
+ *
+ * @param hdl Handle of the configuration to use.
+ * @param buf Buffer to write to.
+ * @param size Size of \p buf.
+ * @param len Return parameter set to the length of the snapshot.
+ * @return
+ * - 0  success
+ * - 1  \p buf is too small, nothing was written
+ * - <0 an error occurred
+ */
+int qc_save_snapshot(void *hdl, char *buf, size_t size, size_t *len);
+
+/**
+ * Updates the data of an open configuration handle. Data sources as specified
+ * by \p flags are read anew, while previously retrieved data is reused for all
+ * others. The handle as well as any memory allocated for the layers remain in
+ * place.
+ * Note that the layers may change, e.g. after a live guest migration, which
+ * is why the number of layers should be queried again using
+ * qc_get_num_layers() afterwards.
+ * Any returned pointers of previous capacity function calls are invalid after
+ * calling this function.
+ * Handles that use published data (see \c QC_USE_SHM in qc_open()) retrieve
+ * the currently published data instead, with \p flags only taking effect when
+ * falling back to the data sources.
+ * Handles opened with qc_open_from_snapshot() or qc_open_from_dump() cannot be
+ * refreshed.
+ *
+ * @see qc_get_attribute_changed()
+ *
+ * @param hdl Handle of the configuration to refresh.
+ * @param flags Data sources to refresh, see enum #qc_refresh_flags.
+ * @param changed Return parameter returning the number of attributes that
+ *        changed. Can be NULL.
+ * @return
+ * - 0 on success,
+ * - <0 in case of an error, and
+ * - >0 if the configuration could not be read completely at the moment,
+ *   but a retry later on could provide the missing data.
+ * The handle retains its previous data in case of a non-zero return code.
+ */
+int qc_refresh(void *hdl, int flags, int *changed);
+
 /**
  * Get the number of layers.
  *
@@ -767,10 +1096,278 @@ int qc_get_attribute_int(void *hdl, enum qc_attr_id id, int layer, int *value);
  */
 int qc_get_attribute_float(void *hdl, enum qc_attr_id id, int layer, float *value);
 
+/**
+ * Retrieves multiple attributes at once, as specified by the \c id, \c layer
+ * and \c type fields in \p reqs. Fields \c rc and \c value of each request
+ * are set exactly as by the qc_get_attribute_*() function for the respective
+ * type. Retrieving many attributes this way is considerably faster than
+ * individual calls.
+ *
+ * @see qc_get_attribute_int()
+ * @see qc_get_attribute_float()
+ * @see qc_get_attribute_string()
+ *
+ * @param hdl Handle of the configuration to use.
+ * @param reqs Array of attributes to retrieve.
+ * @param num Number of elements in \p reqs.
+ * @return 0 on success, <0 if the handle or \p reqs is invalid.
+ */
+int qc_get_attributes(void *hdl, struct qc_attr_req *reqs, int num);
+
+/**
+ * Indicates whether the attribute designated by \p id changed in the last call
+ * to qc_refresh(). Attributes of a layer that was not present before, or of a
+ * different type, are considered as changed if set.
+ *
+ * @see qc_refresh()
+ *
+ * @param hdl Handle of the configuration to use.
+ * @param id Attribute to check.
+ * @param layer Specifies the layer, e.g.
+ * - 0: CEC layer information,
+ * - 1: LPAR layer information, etc.
+ * @return
+ * - >0  attribute changed
+ * -  0  attribute did not change, or qc_refresh() was not called yet
+ * - <0  an error occurred, e.g. the attribute does not exist in the layer
+ */
+int qc_get_attribute_changed(void *hdl, enum qc_attr_id id, int layer);
+
+/**
+ * Starts a watcher that refreshes the data on a background thread every
+ * \p interval milliseconds, and invokes \p cb with all attributes that changed
+ * since the previous refresh. The watcher uses a handle of its own, which
+ * is retained across refreshes.
+ * Failed refreshes are skipped, retrying in the next interval.
+ *
+ * @see qc_watch_stop()
+ * @see qc_refresh()
+ *
+ * @param interval Interval between refreshes in milliseconds, must be >0.
+ * @param flags Data sources to refresh, see enum #qc_refresh_flags.
+ * @param ids Attributes to report changes for, or NULL for all attributes.
+ * @param num_ids Number of elements in \p ids.
+ * @param cb Function to invoke with the changed attributes.
+ * @param data Pointer to pass to \p cb.
+ * @param rc Return code: 0 on success, <0 on error, >0 if no consistent data
+ *           could be retrieved initially.
+ * @return Watcher to pass to qc_watch_stop(), or NULL in case of errors.
+ */
+void *qc_watch_start(int interval, int flags, const enum qc_attr_id *ids, int num_ids, qc_watch_cb cb, void *data, int *rc);
+
+/**
+ * Stops a watcher started by qc_watch_start(), waiting for a running callback
+ * to finish, and releases all of its resources.
+ * Must not be called from within the watcher's callback.
+ *
+ * @param watcher Watcher as returned by qc_watch_start().
+ * @return 0 on success, <0 if \p watcher is invalid or was stopped already.
+ */
+int qc_watch_stop(void *watcher);
+
+/** \enum qc_json_flags
+ * Flags to control the format of qc_export_json_*(). */
+enum qc_json_flags {
+	/** Omit all whitespace */
+	QC_JSON_COMPACT = 0x01,
+	/** Print numeric attributes as JSON numbers instead of strings */
+	QC_JSON_TYPED = 0x02,
+	/** Omit attributes that are not set instead of printing \c null */
+	QC_JSON_SKIP_NULL = 0x04,
+	/** All of the above */
+	QC_JSON_ALL = 0x07,
+};
+
 /**
  * Prints the internal data in JSON format to stdout.
  * @param hdl Handle of the configuration to use.
  */
 void qc_export_json(void *hdl);
 
+/**
+ * Writes the internal data in JSON format to stream \p fp.
+ *
+ * @param hdl Handle of the configuration to use.
+ * @param fp Stream to write to.
+ * @param flags Combination of \c enum \c qc_json_flags, or 0 to use the same
+ *              format as qc_export_json().
+ * @return 0 on success, <0 on error.
+ */
+int qc_export_json_file(void *hdl, FILE *fp, int flags);
+
+/**
+ * Writes the internal data in JSON format to file descriptor \p fd.
+ *
+ * @param hdl Handle of the configuration to use.
+ * @param fd File descriptor to write to.
+ * @param flags Combination of \c enum \c qc_json_flags, or 0 to use the same
+ *              format as qc_export_json().
+ * @return 0 on success, <0 on error.
+ */
+int qc_export_json_fd(void *hdl, int fd, int flags);
+
+/**
+ * Writes the internal data in JSON format to buffer \p buf, terminated by a
+ * null character. Pass \p size 0 to determine the required size.
+ *
+ * @param hdl Handle of the configuration to use.
+ * @param buf Buffer to write to.
+ * @param size Size of \p buf.
+ * @param len Set to the length of the data, excluding the terminating null
+ *            character, if not NULL. Exceeds \p size - 1 if \p buf is too
+ *            small.
+ * @param flags Combination of \c enum \c qc_json_flags, or 0 to use the same
+ *              format as qc_export_json().
+ * @return
+ * - 0  success
+ * - 1  \p buf is too small, and holds the truncated data
+ * - <0 an error occurred
+ */
+int qc_export_json_buf(void *hdl, char *buf, size_t size, size_t *len, int flags);
+
+/** \enum qc_stats_phase
+ * Phases of gathering data, as accounted for in \c struct \c qc_stats. */
+enum qc_stats_phase {
+	/** Reading data from /proc/sysinfo */
+	QC_STATS_OPEN_SYSINFO = 0,
+	/** Reading data from hypfs */
+	QC_STATS_OPEN_HYPFS = 1,
+	/** Executing the STHYI instruction */
+	QC_STATS_OPEN_STHYI = 2,
+	/** Reading data from sysfs */
+	QC_STATS_OPEN_SYSFS = 3,
+	/** Processing data from /proc/sysinfo */
+	QC_STATS_PROCESS_SYSINFO = 4,
+	/** Processing data from hypfs */
+	QC_STATS_PROCESS_HYPFS = 5,
+	/** Processing data from STHYI */
+	QC_STATS_PROCESS_STHYI = 6,
+	/** Processing data from sysfs */
+	QC_STATS_PROCESS_SYSFS = 7,
+	/** Post-processing of the combined data */
+	QC_STATS_POSTPROCESSING = 8,
+	/** Consistency checks, see \c QC_CHECK_CONSISTENCY in qc_open() */
+	QC_STATS_CONSISTENCY_CHECK = 9,
+	/** Waiting before retries, see \c QC_RETRY_DELAY in qc_open() */
+	QC_STATS_RETRY_WAIT = 10,
+	/** Number of phases */
+	QC_STATS_NUM_PHASES = 11,
+};
+
+/** Statistics about gathering data, as retrieved by qc_get_stats() */
+struct qc_stats {
+	/** Number of times data was gathered from the data sources, including retries */
+	unsigned long long	num_gathers;
+	/** Number of retries due to inconsistent data, see \c QC_RETRIES in qc_open() */
+	unsigned long long	num_retries;
+	/** Number of times data sources had to re-read data, e.g. because it
+	    exceeded the buffer size, or changed while being read */
+	unsigned long long	num_read_retries;
+	/** Number of buffers allocated by the data sources to read data into */
+	unsigned long long	num_buf_allocs;
+	/** Number of bytes read by the data sources */
+	unsigned long long	bytes_read;
+	/** Total time spent gathering data in nanoseconds, including retries */
+	unsigned long long	time_total;
+	/** Time spent in each phase in nanoseconds, see \c enum \c qc_stats_phase.
+	    Data sources might be opened in parallel, see \c QC_PARALLEL_OPEN in
+	    qc_open(), in which case the sum can exceed \c time_total. */
+	unsigned long long	time[QC_STATS_NUM_PHASES];
+};
+
+/**
+ * Retrieves statistics about gathering data, e.g. to detect systems where
+ * this takes unusually long. Values are cumulative, and monotonic clocks are
+ * used for all times.
+ *
+ * @param hdl Handle of the configuration to retrieve the statistics of,
+ *            accumulated in qc_open() and all subsequent calls to qc_refresh().
+ *            Pass NULL to retrieve the statistics of all handles of the process.
+ * @param stats Return parameter for the statistics.
+ * @return 0 on success, <0 on error.
+ */
+int qc_get_stats(void *hdl, struct qc_stats *stats);
+
+/** Single sample of an attribute, as retrieved by qc_history_get() */
+struct qc_history_sample {
+	/** Time of the sample in milliseconds since the epoch */
+	unsigned long long	time;
+	/** 1 if the attribute was set at the time, 0 otherwise */
+	int			set;
+	/** Value of the attribute, valid if \p set is 1 */
+	double			value;
+};
+
+/** Summary of the samples of an attribute, as retrieved by qc_history_summary() */
+struct qc_history_summary {
+	/** Number of samples in the window where the attribute was set. All
+	    other fields are valid only if >0. */
+	int			num;
+	/** Minimum value */
+	double			min;
+	/** Maximum value */
+	double			max;
+	/** Average value */
+	double			avg;
+	/** Time of the oldest sample in milliseconds since the epoch */
+	unsigned long long	first;
+	/** Time of the most recent sample in milliseconds since the epoch */
+	unsigned long long	last;
+};
+
+/**
+ * Enables recording a history of samples of numeric attributes of all layers
+ * in the handle. The current data is recorded as the first sample, and
+ * each successful call to qc_refresh() records another one. Once \p size
+ * samples are recorded, each new sample replaces the oldest one.
+ * Calling this function again discards the previous history.
+ *
+ * @see qc_history_get()
+ * @see qc_history_summary()
+ *
+ * @param hdl Handle of the configuration to use.
+ * @param ids Attributes to record, or NULL to record a default set of
+ *            attributes: Capped capacities, weights, and the number of
+ *            configured and standby CPUs. String attributes are never set.
+ * @param num_ids Number of elements in \p ids, at most the number of
+ *                attributes in enum #qc_attr_id.
+ * @param size Maximum number of samples to retain, up to 65536, or 0 to
+ *             disable the history.
+ * @return 0 on success, <0 on error.
+ */
+int qc_history_enable(void *hdl, const enum qc_attr_id *ids, int num_ids, int size);
+
+/**
+ * Retrieves the most recent samples of an attribute from the history enabled
+ * by qc_history_enable(), starting with the most recent one.
+ *
+ * @param hdl Handle of the configuration to use.
+ * @param id Attribute to retrieve.
+ * @param layer Specifies the layer, e.g.
+ * - 0: CEC layer information,
+ * - 1: LPAR layer information, etc.
+ * @param samples Array to return the samples in.
+ * @param num Number of elements in \p samples.
+ * @return Number of samples returned on success, <0 on error, e.g. if the
+ *         history is not enabled.
+ */
+int qc_history_get(void *hdl, enum qc_attr_id id, int layer, struct qc_history_sample *samples, int num);
+
+/**
+ * Summarizes the samples of an attribute in the history enabled by
+ * qc_history_enable() within a window of time.
+ *
+ * @param hdl Handle of the configuration to use.
+ * @param id Attribute to summarize.
+ * @param layer Specifies the layer, e.g.
+ * - 0: CEC layer information,
+ * - 1: LPAR layer information, etc.
+ * @param window Consider samples of the last \p window milliseconds only, or
+ *               all samples if 0.
+ * @param summary Return parameter for the summary.
+ * @return 0 on success, <0 on error, e.g. if the history is not enabled.
+ */
+int qc_history_summary(void *hdl, enum qc_attr_id id, int layer, unsigned long long window,
+		       struct qc_history_summary *summary);
+
 #endif
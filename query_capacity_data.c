@@ -1,5 +1,9 @@
 /* Copyright IBM Corp. 2013, 2020 */
 
+#include <byteswap.h>
+#include <math.h>
+#include <stdarg.h>
+
 #include "query_capacity_data.h"
 
 
@@ -148,6 +152,12 @@ struct qc_lpar {
 	int cp_weight_capping;
 	int ifl_weight_capping;
 	int ziip_weight_capping;
+	int cp_effective_capacity;
+	int cp_effective_capacity_layer;
+	int ifl_effective_capacity;
+	int ifl_effective_capacity_layer;
+	int ziip_effective_capacity;
+	int ziip_effective_capacity_layer;
 };
 
 struct qc_zvm_pool {
@@ -193,6 +203,12 @@ struct qc_zvm_hypervisor {
 	int num_cp_threads;
 	int num_ifl_threads;
 	int num_ziip_threads;
+	int cp_effective_capacity;
+	int cp_effective_capacity_layer;
+	int ifl_effective_capacity;
+	int ifl_effective_capacity_layer;
+	int ziip_effective_capacity;
+	int ziip_effective_capacity_layer;
 };
 
 struct qc_zvm_guest {
@@ -231,6 +247,12 @@ struct qc_zvm_guest {
 	int ziip_dispatch_limithard;
 	int ziip_dispatch_type;
 	int ziip_capped_capacity;
+	int cp_effective_capacity;
+	int cp_effective_capacity_layer;
+	int ifl_effective_capacity;
+	int ifl_effective_capacity_layer;
+	int ziip_effective_capacity;
+	int ziip_effective_capacity_layer;
 };
 
 struct qc_zos_hypervisor {
@@ -298,6 +320,12 @@ struct qc_zos_zcx_server {
 	int ziip_dispatch_limithard;
 	int ziip_dispatch_type;
 	int ziip_capped_capacity;
+	int cp_effective_capacity;
+	int cp_effective_capacity_layer;
+	int ifl_effective_capacity;
+	int ifl_effective_capacity_layer;
+	int ziip_effective_capacity;
+	int ziip_effective_capacity_layer;
 };
 
 struct qc_kvm_hypervisor {
@@ -316,6 +344,12 @@ struct qc_kvm_hypervisor {
 	int num_ifl_total;
 	int num_ifl_dedicated;
 	int num_ifl_shared;
+	int cp_effective_capacity;
+	int cp_effective_capacity_layer;
+	int ifl_effective_capacity;
+	int ifl_effective_capacity_layer;
+	int ziip_effective_capacity;
+	int ziip_effective_capacity_layer;
 };
 
 struct qc_kvm_guest {
@@ -338,6 +372,12 @@ struct qc_kvm_guest {
 	int num_ifl_dedicated;
 	int num_ifl_shared;
 	int ifl_dispatch_type;
+	int cp_effective_capacity;
+	int cp_effective_capacity_layer;
+	int ifl_effective_capacity;
+	int ifl_effective_capacity_layer;
+	int ziip_effective_capacity;
+	int ziip_effective_capacity_layer;
 };
 
 enum qc_data_type {
@@ -442,6 +482,12 @@ static struct qc_attr lpar_attrs[] = {
 	{qc_cp_weight_capping, integer, offsetof(struct qc_lpar, cp_weight_capping)},
 	{qc_ifl_weight_capping, integer, offsetof(struct qc_lpar, ifl_weight_capping)},
 	{qc_ziip_weight_capping, integer, offsetof(struct qc_lpar, ziip_weight_capping)},
+	{qc_cp_effective_capacity, integer, offsetof(struct qc_lpar, cp_effective_capacity)},
+	{qc_cp_effective_capacity_layer, integer, offsetof(struct qc_lpar, cp_effective_capacity_layer)},
+	{qc_ifl_effective_capacity, integer, offsetof(struct qc_lpar, ifl_effective_capacity)},
+	{qc_ifl_effective_capacity_layer, integer, offsetof(struct qc_lpar, ifl_effective_capacity_layer)},
+	{qc_ziip_effective_capacity, integer, offsetof(struct qc_lpar, ziip_effective_capacity)},
+	{qc_ziip_effective_capacity_layer, integer, offsetof(struct qc_lpar, ziip_effective_capacity_layer)},
 	{-1, string, -1}
 };
 
@@ -471,6 +517,12 @@ static struct qc_attr zvm_hv_attrs[] = {
 	{qc_num_cp_threads, integer, offsetof(struct qc_zvm_hypervisor, num_cp_threads)},
 	{qc_num_ifl_threads, integer, offsetof(struct qc_zvm_hypervisor, num_ifl_threads)},
 	{qc_num_ziip_threads, integer, offsetof(struct qc_zvm_hypervisor, num_ziip_threads)},
+	{qc_cp_effective_capacity, integer, offsetof(struct qc_zvm_hypervisor, cp_effective_capacity)},
+	{qc_cp_effective_capacity_layer, integer, offsetof(struct qc_zvm_hypervisor, cp_effective_capacity_layer)},
+	{qc_ifl_effective_capacity, integer, offsetof(struct qc_zvm_hypervisor, ifl_effective_capacity)},
+	{qc_ifl_effective_capacity_layer, integer, offsetof(struct qc_zvm_hypervisor, ifl_effective_capacity_layer)},
+	{qc_ziip_effective_capacity, integer, offsetof(struct qc_zvm_hypervisor, ziip_effective_capacity)},
+	{qc_ziip_effective_capacity_layer, integer, offsetof(struct qc_zvm_hypervisor, ziip_effective_capacity_layer)},
 	{-1, string, -1}
 };
 
@@ -528,6 +580,12 @@ static struct qc_attr kvm_hv_attrs[] = {
 	{qc_num_ifl_total, integer, offsetof(struct qc_kvm_hypervisor, num_ifl_total)},
 	{qc_num_ifl_dedicated, integer, offsetof(struct qc_kvm_hypervisor, num_ifl_dedicated)},
 	{qc_num_ifl_shared, integer, offsetof(struct qc_kvm_hypervisor, num_ifl_shared)},
+	{qc_cp_effective_capacity, integer, offsetof(struct qc_kvm_hypervisor, cp_effective_capacity)},
+	{qc_cp_effective_capacity_layer, integer, offsetof(struct qc_kvm_hypervisor, cp_effective_capacity_layer)},
+	{qc_ifl_effective_capacity, integer, offsetof(struct qc_kvm_hypervisor, ifl_effective_capacity)},
+	{qc_ifl_effective_capacity_layer, integer, offsetof(struct qc_kvm_hypervisor, ifl_effective_capacity_layer)},
+	{qc_ziip_effective_capacity, integer, offsetof(struct qc_kvm_hypervisor, ziip_effective_capacity)},
+	{qc_ziip_effective_capacity_layer, integer, offsetof(struct qc_kvm_hypervisor, ziip_effective_capacity_layer)},
 	{-1, string, -1}
 };
 
@@ -585,6 +643,12 @@ static struct qc_attr zvm_guest_attrs[] = {
 	{qc_cp_dispatch_type, integer, offsetof(struct qc_zvm_guest, cp_dispatch_type)},
 	{qc_ifl_dispatch_type, integer, offsetof(struct qc_zvm_guest, ifl_dispatch_type)},
 	{qc_ziip_dispatch_type, integer, offsetof(struct qc_zvm_guest, ziip_dispatch_type)},
+	{qc_cp_effective_capacity, integer, offsetof(struct qc_zvm_guest, cp_effective_capacity)},
+	{qc_cp_effective_capacity_layer, integer, offsetof(struct qc_zvm_guest, cp_effective_capacity_layer)},
+	{qc_ifl_effective_capacity, integer, offsetof(struct qc_zvm_guest, ifl_effective_capacity)},
+	{qc_ifl_effective_capacity_layer, integer, offsetof(struct qc_zvm_guest, ifl_effective_capacity_layer)},
+	{qc_ziip_effective_capacity, integer, offsetof(struct qc_zvm_guest, ziip_effective_capacity)},
+	{qc_ziip_effective_capacity_layer, integer, offsetof(struct qc_zvm_guest, ziip_effective_capacity_layer)},
 	{-1, string, -1}
 };
 
@@ -617,6 +681,12 @@ static struct qc_attr zos_zcx_server_attrs[] = {
 	{qc_ziip_capped_capacity, integer, offsetof(struct qc_zos_zcx_server, ziip_capped_capacity)},
 	{qc_cp_dispatch_type, integer, offsetof(struct qc_zos_zcx_server, cp_dispatch_type)},
 	{qc_ziip_dispatch_type, integer, offsetof(struct qc_zos_zcx_server, ziip_dispatch_type)},
+	{qc_cp_effective_capacity, integer, offsetof(struct qc_zos_zcx_server, cp_effective_capacity)},
+	{qc_cp_effective_capacity_layer, integer, offsetof(struct qc_zos_zcx_server, cp_effective_capacity_layer)},
+	{qc_ifl_effective_capacity, integer, offsetof(struct qc_zos_zcx_server, ifl_effective_capacity)},
+	{qc_ifl_effective_capacity_layer, integer, offsetof(struct qc_zos_zcx_server, ifl_effective_capacity_layer)},
+	{qc_ziip_effective_capacity, integer, offsetof(struct qc_zos_zcx_server, ziip_effective_capacity)},
+	{qc_ziip_effective_capacity_layer, integer, offsetof(struct qc_zos_zcx_server, ziip_effective_capacity_layer)},
 	{-1, string, -1}
 };
 
@@ -640,9 +710,109 @@ static struct qc_attr kvm_guest_attrs[] = {
 	{qc_num_ifl_dedicated, integer, offsetof(struct qc_kvm_guest, num_ifl_dedicated)},
 	{qc_num_ifl_shared, integer, offsetof(struct qc_kvm_guest, num_ifl_shared)},
 	{qc_ifl_dispatch_type, integer, offsetof(struct qc_kvm_guest, ifl_dispatch_type)},
+	{qc_cp_effective_capacity, integer, offsetof(struct qc_kvm_guest, cp_effective_capacity)},
+	{qc_cp_effective_capacity_layer, integer, offsetof(struct qc_kvm_guest, cp_effective_capacity_layer)},
+	{qc_ifl_effective_capacity, integer, offsetof(struct qc_kvm_guest, ifl_effective_capacity)},
+	{qc_ifl_effective_capacity_layer, integer, offsetof(struct qc_kvm_guest, ifl_effective_capacity_layer)},
+	{qc_ziip_effective_capacity, integer, offsetof(struct qc_kvm_guest, ziip_effective_capacity)},
+	{qc_ziip_effective_capacity_layer, integer, offsetof(struct qc_kvm_guest, ziip_effective_capacity_layer)},
 	{-1, string, -1}
 };
 
+/*
+ * Maps attribute ids to the index of the respective entry in the *_attrs
+ * tables above (or -1 if not present), so lookups don't need to walk the
+ * tables. Populated once when the library is loaded.
+ */
+static short cec_idx[QC_NUM_ATTR_IDS];
+static short lpar_group_idx[QC_NUM_ATTR_IDS];
+static short lpar_idx[QC_NUM_ATTR_IDS];
+static short zvm_hv_idx[QC_NUM_ATTR_IDS];
+static short zos_hv_idx[QC_NUM_ATTR_IDS];
+static short zos_tenant_resgroup_idx[QC_NUM_ATTR_IDS];
+static short kvm_hv_idx[QC_NUM_ATTR_IDS];
+static short zvm_pool_idx[QC_NUM_ATTR_IDS];
+static short zvm_guest_idx[QC_NUM_ATTR_IDS];
+static short zos_zcx_server_idx[QC_NUM_ATTR_IDS];
+static short kvm_guest_idx[QC_NUM_ATTR_IDS];
+
+static struct qc_attr_tbl {
+	struct qc_attr	*attrs;
+	short		*idx;
+} qc_attr_tbls[] = {
+	{cec_attrs, cec_idx},
+	{lpar_group_attrs, lpar_group_idx},
+	{lpar_attrs, lpar_idx},
+	{zvm_hv_attrs, zvm_hv_idx},
+	{zos_hv_attrs, zos_hv_idx},
+	{zos_tenant_resgroup_attrs, zos_tenant_resgroup_idx},
+	{kvm_hv_attrs, kvm_hv_idx},
+	{zvm_pool_attrs, zvm_pool_idx},
+	{zvm_guest_attrs, zvm_guest_idx},
+	{zos_zcx_server_attrs, zos_zcx_server_idx},
+	{kvm_guest_attrs, kvm_guest_idx},
+	{NULL, NULL}
+};
+
+// Fingerprint of the attribute tables, identifying compatible serialized data
+static __u64 qc_attr_layout;
+
+// FNV-1a over the bytes of 'val', independent of byte order
+static __u64 qc_hash_int(__u64 hash, int val) {
+	unsigned int i;
+
+	for (i = 0; i < sizeof(val); i++)
+		hash = (hash ^ (((unsigned int)val >> (8 * i)) & 0xff)) * 0x100000001b3ULL;
+
+	return hash;
+}
+
+static void __attribute__((constructor)) qc_attr_idx_init(void) {
+	struct qc_attr_tbl *tbl;
+	struct qc_attr *attr;
+	int i;
+
+	qc_attr_layout = 0xcbf29ce484222325ULL;
+	for (tbl = qc_attr_tbls; tbl->attrs; tbl++) {
+		for (i = 0; i < QC_NUM_ATTR_IDS; i++)
+			tbl->idx[i] = -1;
+		for (i = 0; tbl->attrs[i].offset >= 0; i++)
+			tbl->idx[tbl->attrs[i].id] = i;
+		for (attr = tbl->attrs; ; attr++) {
+			qc_attr_layout = qc_hash_int(qc_attr_layout, attr->id);
+			qc_attr_layout = qc_hash_int(qc_attr_layout, attr->type);
+			qc_attr_layout = qc_hash_int(qc_attr_layout, attr->offset);
+			if (attr->offset < 0)
+				break;
+			if (attr->type == string)
+				qc_attr_layout = qc_hash_int(qc_attr_layout, qc_get_str_attr_len(attr->id));
+		}
+	}
+}
+
+static short *qc_get_attr_idx_tbl(struct qc_attr *attrs) {
+	struct qc_attr_tbl *tbl;
+
+	for (tbl = qc_attr_tbls; tbl->attrs; tbl++)
+		if (tbl->attrs == attrs)
+			return tbl->idx;
+
+	return NULL;
+}
+
+// Returns index of attribute 'id' in attr_list of 'hdl', or -1 if not present
+static int qc_get_attr_idx(struct qc_handle *hdl, enum qc_attr_id id, enum qc_data_type type) {
+	int idx;
+
+	if ((unsigned int)id >= QC_NUM_ATTR_IDS)
+		return -1;
+	idx = hdl->attr_idx[id];
+	if (idx < 0 || hdl->attr_list[idx].type != type)
+		return -1;
+
+	return idx;
+}
+
 
 const char *qc_attr_id_to_char(struct qc_handle *hdl, enum qc_attr_id id) {
 	switch (id) {
@@ -725,6 +895,12 @@ const char *qc_attr_id_to_char(struct qc_handle *hdl, enum qc_attr_id id) {
 	case qc_num_ziip_shared: return "num_ziip_shared";
 	case qc_num_ziip_total: return "num_ziip_total";
 	case qc_num_ziip_threads: return "num_ziip_threads";
+	case qc_cp_effective_capacity: return "cp_effective_capacity";
+	case qc_cp_effective_capacity_layer: return "cp_effective_capacity_layer";
+	case qc_ifl_effective_capacity: return "ifl_effective_capacity";
+	case qc_ifl_effective_capacity_layer: return "ifl_effective_capacity_layer";
+	case qc_ziip_effective_capacity: return "ziip_effective_capacity";
+	case qc_ziip_effective_capacity_layer: return "ziip_effective_capacity_layer";
 	default: break;
 	}
 	qc_debug(hdl, "Error: Cannot convert unknown attribute '%d' to char*\n", id);
@@ -742,13 +918,134 @@ struct qc_handle *qc_hdl_get_lpar(struct qc_handle *hdl) {
 	return hdl;
 }
 
+/*
+ * All memory for the handles of a configuration is carved from an arena of
+ * chunks, so that opening a configuration typically requires a single malloc,
+ * and closing it frees everything at once. The root handle is located at the
+ * start of the first chunk. Since individual handles cannot be freed, layers
+ * that are removed are put in the pool of the root handle for reuse.
+ */
+#define QC_ARENA_CHUNK_SIZE	8192
+#define QC_ARENA_ALIGN(x)	(((x) + 15) & ~(size_t)15)
+
+struct qc_arena {
+	struct qc_arena	*next;
+	size_t		 size;	// usable bytes in 'data'
+	size_t		 used;
+	char		 data[] __attribute__((aligned(16)));
+};
+
+static struct qc_arena *qc_arena_new(size_t size) {
+	struct qc_arena *arena;
+
+	if (size < QC_ARENA_CHUNK_SIZE - sizeof(struct qc_arena))
+		size = QC_ARENA_CHUNK_SIZE - sizeof(struct qc_arena);
+	arena = malloc(sizeof(struct qc_arena) + size);
+	if (!arena)
+		return NULL;
+	arena->next = NULL;
+	arena->size = size;
+	arena->used = 0;
+
+	return arena;
+}
+
+static void *qc_arena_alloc(struct qc_handle *root, size_t size) {
+	struct qc_arena *arena = root->arena;
+	void *ptr;
+
+	size = QC_ARENA_ALIGN(size);
+	if (arena->size - arena->used < size) {
+		arena = qc_arena_new(size);
+		if (!arena)
+			return NULL;
+		arena->next = root->arena;
+		root->arena = arena;
+	}
+	ptr = arena->data + arena->used;
+	arena->used += size;
+	memset(ptr, 0, size);
+
+	return ptr;
+}
+
+// Returns a new root handle, located at the start of a new arena
+static struct qc_handle *qc_arena_new_root(void) {
+	struct qc_arena *arena;
+	struct qc_handle *root;
+
+	arena = qc_arena_new(0);
+	if (!arena)
+		return NULL;
+	root = (struct qc_handle *)arena->data;
+	arena->used = QC_ARENA_ALIGN(sizeof(struct qc_handle));
+	memset(root, 0, sizeof(struct qc_handle));
+	root->root = root;
+	root->arena = arena;
+
+	return root;
+}
+
+void qc_hdl_free(struct qc_handle *root) {
+	struct qc_arena *arena, *next;
+
+	free(root->layers);
+	// the chunk holding the root handle comes last
+	for (arena = root->arena; arena != NULL; arena = next) {
+		next = arena->next;
+		free(arena);
+	}
+}
+
+int qc_hdl_index_layers(struct qc_handle *root) {
+	struct qc_handle *hdl, **layers;
+	int num = 0;
+
+	for (hdl = root; hdl != NULL; hdl = hdl->next)
+		num++;
+	// never shrink, so restoring previous layers cannot fail
+	if (num > root->max_layers) {
+		layers = realloc(root->layers, num * sizeof(struct qc_handle *));
+		if (!layers) {
+			qc_debug(root, "Error: Failed to allocate layer index\n");
+			root->num_layers = 0;
+			return -1;
+		}
+		root->layers = layers;
+		root->max_layers = num;
+	}
+	for (hdl = root, num = 0; hdl != NULL; hdl = hdl->next)
+		root->layers[num++] = hdl;
+	root->num_layers = num;
+
+	return 0;
+}
+
 // 'hdl' is for error reporting, as 'tgthdl' might not be part of the pointer lists yet
+// Returns a handle for attribute table 'attrs' from the pool of 'root', or NULL if none available
+static struct qc_handle *qc_hdl_reuse(struct qc_handle *root, struct qc_attr *attrs) {
+	struct qc_handle *ptr, *prev = NULL;
+
+	for (ptr = root->pool; ptr != NULL; prev = ptr, ptr = ptr->next) {
+		if (ptr->attr_list == attrs) {
+			if (prev)
+				prev->next = ptr->next;
+			else
+				root->pool = ptr->next;
+			return ptr;
+		}
+	}
+
+	return NULL;
+}
+
 int qc_hdl_new(struct qc_handle *hdl, struct qc_handle **tgthdl, int layer_no,
 		  int layer_type_num) {
 	int num_attrs, layer_category_num;
 	char *layer_type, *layer_category;
 	struct qc_attr *attrs;
 	size_t layer_sz;
+	char *buf;
 
 	switch (layer_type_num) {
 	case QC_LAYER_TYPE_CEC:
@@ -841,40 +1138,47 @@ int qc_hdl_new(struct qc_handle *hdl, struct qc_handle **tgthdl, int layer_no,
 	for (num_attrs = 0; attrs[num_attrs].offset >= 0; ++num_attrs);
 	num_attrs++;
 
-	if (hdl || *tgthdl == NULL) {
-		// Possibly reuse existing handle when alloc'ing the cec layer.
-		// Otherwise we'd change the handle which serves as an identified in
-		// our log output, which could be confusing.
-		*tgthdl = malloc(sizeof(struct qc_handle));
+	// Possibly reuse existing handle when alloc'ing the cec layer.
+	// Otherwise we'd change the handle which serves as an identified in
+	// our log output, which could be confusing.
+	// For all other layers, reuse a handle of the same type released earlier
+	// on, if available.
+	if (hdl)
+		*tgthdl = qc_hdl_reuse(hdl->root, attrs);
+	if (*tgthdl == NULL) {
+		if (hdl)
+			*tgthdl = qc_arena_alloc(hdl->root, sizeof(struct qc_handle));
+		else
+			*tgthdl = qc_arena_new_root();
 		if (!*tgthdl) {
 			qc_debug(hdl, "Error: Failed to allocate handle\n");
 			return -2;
 		}
 	}
-	memset(*tgthdl, 0, sizeof(struct qc_handle));
 	(*tgthdl)->layer_no = layer_no;
 	(*tgthdl)->attr_list = attrs;
+	(*tgthdl)->attr_idx = qc_get_attr_idx_tbl(attrs);
+	(*tgthdl)->layer_sz = layer_sz;
+	(*tgthdl)->num_attrs = num_attrs;
+	(*tgthdl)->next = NULL;
 	if (hdl)
 		(*tgthdl)->root = hdl->root;
-	else
-		(*tgthdl)->root = *tgthdl;
-	(*tgthdl)->layer = malloc(layer_sz);
 	if (!(*tgthdl)->layer) {
-		qc_debug(hdl, "Error: Failed to allocate layer\n");
-		free(*tgthdl);
-		*tgthdl = NULL;
-		return -3;
+		// a single allocation holds the layer and all arrays; ints go first for alignment
+		buf = qc_arena_alloc((*tgthdl)->root, layer_sz + 2 * num_attrs * sizeof(int) + num_attrs);
+		if (!buf) {
+			qc_debug(hdl, "Error: Failed to allocate layer\n");
+			return -3;
+		}
+		(*tgthdl)->layer = buf;
+		(*tgthdl)->attr_present = (int *)(buf + layer_sz);
+		(*tgthdl)->attr_changed = (*tgthdl)->attr_present + num_attrs;
+		(*tgthdl)->src = (char *)((*tgthdl)->attr_changed + num_attrs);
 	}
 	memset((*tgthdl)->layer, 0, layer_sz);
-	(*tgthdl)->attr_present = calloc(num_attrs, sizeof(int));
-	(*tgthdl)->src = calloc(num_attrs, sizeof(int));
-	if (!(*tgthdl)->attr_present || !(*tgthdl)->src) {
-		qc_debug(hdl, "Error: Failed to allocate attr_present array\n");
-		free((*tgthdl)->layer);
-		free(*tgthdl);
-		*tgthdl = NULL;
-		return -4;
-	}
+	memset((*tgthdl)->attr_present, 0, num_attrs * sizeof(int));
+	memset((*tgthdl)->src, 0, num_attrs);
+	memset((*tgthdl)->attr_changed, 0, num_attrs * sizeof(int));
 	if (qc_set_attr_int(*tgthdl, qc_layer_type_num, layer_type_num, ATTR_SRC_UNDEF) ||
 	    qc_set_attr_int(*tgthdl, qc_layer_category_num, layer_category_num, ATTR_SRC_UNDEF) ||
 	    qc_set_attr_string(*tgthdl, qc_layer_type, layer_type, ATTR_SRC_UNDEF) ||
@@ -901,30 +1205,418 @@ int qc_hdl_insert(struct qc_handle *hdl, struct qc_handle **inserted_hdl, int ty
 }
 
 void qc_hdl_prune(struct qc_handle *hdl) {
-        struct qc_handle *ptr = hdl, *skip = NULL;
-
-        // Pruning at the root needs special handling as does intermediate pruning
-        if (hdl == qc_hdl_get_root(hdl))
-                skip = hdl;
-        else {
-                hdl = qc_hdl_get_prev(hdl);
-                hdl->next = NULL;
-        }
-
-        while (ptr) {
-		free(ptr->layer);
-		free(ptr->attr_present);
-		free(ptr->src);
-		hdl = ptr->next;
-		if (ptr == skip) {
-			memset(ptr, 0, sizeof(struct qc_handle));
-			ptr->root = ptr;
-		} else
-			free(ptr);
-		ptr = hdl;
+	struct qc_handle *prev = qc_hdl_get_prev(hdl);
+
+	if (!prev)
+		return;
+	prev->next = NULL;
+	qc_hdl_release(hdl->root, hdl);
+}
+
+void qc_hdl_release(struct qc_handle *root, struct qc_handle *hdl) {
+	struct qc_handle *next;
+
+	for (; hdl != NULL; hdl = next) {
+		next = hdl->next;
+		hdl->next = root->pool;
+		root->pool = hdl;
+	}
+}
+
+// Swaps the layer data of handles 'a' and 'b'
+static void qc_hdl_swap(struct qc_handle *a, struct qc_handle *b) {
+	struct qc_handle tmp = *a;
+
+	a->layer = b->layer;
+	a->attr_present = b->attr_present;
+	a->src = b->src;
+	a->attr_changed = b->attr_changed;
+	b->layer = tmp.layer;
+	b->attr_present = tmp.attr_present;
+	b->src = tmp.src;
+	b->attr_changed = tmp.attr_changed;
+}
+
+int qc_hdl_save(struct qc_handle *hdl, struct qc_handle **saved) {
+	if (qc_hdl_new(hdl, saved, 0, QC_LAYER_TYPE_CEC))
+		return -1;
+	qc_hdl_swap(hdl, *saved);
+	(*saved)->next = hdl->next;
+	hdl->next = NULL;
+
+	return 0;
+}
+
+void qc_hdl_restore(struct qc_handle *hdl, struct qc_handle *saved) {
+	qc_hdl_release(hdl, hdl->next);
+	qc_hdl_swap(hdl, saved);
+	hdl->next = saved->next;
+	saved->next = NULL;
+	qc_hdl_release(hdl, saved);
+	qc_hdl_index_layers(hdl);	// cannot fail, as the index held these layers before
+}
+
+// Returns whether attribute at index 'idx' differs between layers 'a' and 'b' of the same type
+static int qc_attr_differs(struct qc_handle *a, struct qc_handle *b, int idx) {
+	struct qc_attr *attr = &a->attr_list[idx];
+	char *val_a = (char *)a->layer + attr->offset, *val_b = (char *)b->layer + attr->offset;
+
+	if (a->attr_present[idx] != b->attr_present[idx])
+		return 1;
+	if (!a->attr_present[idx])
+		return 0;
+	switch (attr->type) {
+	case integer:
+		return *(int *)val_a != *(int *)val_b;
+	case floatingpoint:
+		return *(float *)val_a != *(float *)val_b;
+	case string:
+		return strcmp(val_a, val_b) != 0;
+	}
+
+	return 0;
+}
+
+int qc_hdl_flag_changes(struct qc_handle *hdl, struct qc_handle *saved) {
+	int idx, changed = 0;
+
+	for (; hdl != NULL; hdl = hdl->next) {
+		for (idx = 0; hdl->attr_list[idx].offset >= 0; ++idx) {
+			// layers of different type at the same position count as changed entirely
+			if (saved && saved->attr_list == hdl->attr_list)
+				hdl->attr_changed[idx] = qc_attr_differs(hdl, saved, idx);
+			else
+				hdl->attr_changed[idx] = hdl->attr_present[idx];
+			if (hdl->attr_changed[idx])
+				changed++;
+		}
+		if (saved)
+			saved = saved->next;
+	}
+	// account for layers that disappeared
+	for (; saved != NULL; saved = saved->next)
+		for (idx = 0; saved->attr_list[idx].offset >= 0; ++idx)
+			changed += saved->attr_present[idx];
+
+	return changed;
+}
+
+// Returns whether changes of attribute 'id' are to be reported, see qc_hdl_get_changes()
+static int qc_change_wanted(enum qc_attr_id id, const enum qc_attr_id *ids, int num_ids) {
+	int i;
+
+	if (!ids)
+		return 1;
+	for (i = 0; i < num_ids; ++i)
+		if (ids[i] == id)
+			return 1;
+
+	return 0;
+}
+
+static void qc_change_set_value(struct qc_handle *hdl, int idx, union qc_attr_value *value) {
+	struct qc_attr *attr = &hdl->attr_list[idx];
+	char *val = (char *)hdl->layer + attr->offset;
+
+	switch (attr->type) {
+	case integer:
+		value->i = *(int *)val;
+		break;
+	case floatingpoint:
+		value->f = *(float *)val;
+		break;
+	case string:
+		value->s = val;
+		break;
+	}
+}
+
+// Appends a change for attribute at index 'idx' of layer 'new' (or 'old' if 'new' is NULL)
+static int qc_change_add(struct qc_handle *new, struct qc_handle *old, int idx, struct qc_attr_change **changes,
+			 int *num, int *max) {
+	struct qc_handle *hdl = new ? new : old;
+	struct qc_attr *attr = &hdl->attr_list[idx];
+	struct qc_attr_change *chg;
+	int old_idx;
+
+	if (*num == *max) {
+		*max = *max ? 2 * *max : 16;
+		if ((chg = realloc(*changes, *max * sizeof(struct qc_attr_change))) == NULL) {
+			qc_debug(hdl, "Error: Failed to allocate changes\n");
+			return -1;
+		}
+		*changes = chg;
+	}
+	chg = &(*changes)[(*num)++];
+	memset(chg, 0, sizeof(*chg));
+	chg->layer = hdl->layer_no;
+	chg->id = attr->id;
+	switch (attr->type) {
+	case integer:
+		chg->type = QC_ATTR_TYPE_INT;
+		break;
+	case floatingpoint:
+		chg->type = QC_ATTR_TYPE_FLOAT;
+		break;
+	case string:
+		chg->type = QC_ATTR_TYPE_STRING;
+		break;
+	}
+	if (new && new->attr_present[idx]) {
+		chg->new_set = 1;
+		qc_change_set_value(new, idx, &chg->new_value);
+	}
+	if (old && (old_idx = qc_get_attr_idx(old, attr->id, attr->type)) >= 0 && old->attr_present[old_idx]) {
+		chg->old_set = 1;
+		qc_change_set_value(old, old_idx, &chg->old_value);
+	}
+
+	return 0;
+}
+
+int qc_hdl_get_changes(struct qc_handle *hdl, struct qc_handle *saved, const enum qc_attr_id *ids, int num_ids,
+		       struct qc_attr_change **changes, int *num) {
+	int idx, max = 0;
+
+	*changes = NULL;
+	*num = 0;
+	for (; hdl != NULL; hdl = hdl->next) {
+		for (idx = 0; hdl->attr_list[idx].offset >= 0; ++idx) {
+			if (hdl->attr_changed[idx] && qc_change_wanted(hdl->attr_list[idx].id, ids, num_ids) &&
+			    qc_change_add(hdl, saved, idx, changes, num, &max))
+				goto err;
+		}
+		// attributes of a previous layer of different type that are gone now
+		if (saved && saved->attr_list != hdl->attr_list) {
+			for (idx = 0; saved->attr_list[idx].offset >= 0; ++idx) {
+				if (saved->attr_present[idx] &&
+				    qc_get_attr_idx(hdl, saved->attr_list[idx].id, saved->attr_list[idx].type) < 0 &&
+				    qc_change_wanted(saved->attr_list[idx].id, ids, num_ids) &&
+				    qc_change_add(NULL, saved, idx, changes, num, &max))
+					goto err;
+			}
+		}
+		if (saved)
+			saved = saved->next;
+	}
+	// account for layers that disappeared
+	for (; saved != NULL; saved = saved->next) {
+		for (idx = 0; saved->attr_list[idx].offset >= 0; ++idx) {
+			if (saved->attr_present[idx] && qc_change_wanted(saved->attr_list[idx].id, ids, num_ids) &&
+			    qc_change_add(NULL, saved, idx, changes, num, &max))
+				goto err;
+		}
+	}
+
+	return 0;
+
+err:
+	free(*changes);
+	*changes = NULL;
+	*num = 0;
+
+	return -1;
+}
+
+/*
+ * Serialized layers as created by qc_hdl_serialize(): A header, followed by
+ * one entry per layer, consisting of the layer data as well as its
+ * attr_present and src arrays.
+ * Since the layer data is copied as is, serialized data is only valid for
+ * the same attribute tables and byte order, which is what 'layout' verifies.
+ */
+#define QC_SNAP_VERSION		1
+#define QC_SNAP_ALIGN(x)	(((x) + 7) & ~(size_t)7)
+
+struct qc_snap_hdr {
+	__u32	version;	// see QC_SNAP_VERSION
+	__u32	num_layers;
+	__u64	layout;		// see qc_attr_layout
+	__u64	len;		// total length, including this header
+};
+
+struct qc_snap_layer {
+	__u32	layer_type_num;
+	__u32	layer_sz;
+	__u32	num_attrs;
+	__u32	len;		// total length of this entry, including padding
+};
+
+static size_t qc_snap_layer_len(struct qc_handle *hdl) {
+	return QC_SNAP_ALIGN(sizeof(struct qc_snap_layer) + hdl->layer_sz +
+			     hdl->num_attrs * (sizeof(int) + sizeof(char)));
+}
+
+int qc_hdl_serialize(struct qc_handle *hdl, char *buf, size_t size, size_t *len) {
+	struct qc_snap_layer *lyr;
+	struct qc_snap_hdr *shdr;
+	struct qc_handle *ptr;
+	int num = 0;
+	char *p;
+
+	*len = sizeof(struct qc_snap_hdr);
+	for (ptr = hdl; ptr != NULL; ptr = ptr->next, num++)
+		*len += qc_snap_layer_len(ptr);
+	if (*len > size)
+		return 1;
+
+	memset(buf, 0, *len);
+	shdr = (struct qc_snap_hdr *)buf;
+	shdr->version = QC_SNAP_VERSION;
+	shdr->num_layers = num;
+	shdr->layout = qc_attr_layout;
+	shdr->len = *len;
+	p = buf + sizeof(struct qc_snap_hdr);
+	for (ptr = hdl; ptr != NULL; ptr = ptr->next) {
+		lyr = (struct qc_snap_layer *)p;
+		lyr->layer_type_num = *(int *)ptr->layer;
+		lyr->layer_sz = ptr->layer_sz;
+		lyr->num_attrs = ptr->num_attrs;
+		lyr->len = qc_snap_layer_len(ptr);
+		p += sizeof(struct qc_snap_layer);
+		memcpy(p, ptr->layer, ptr->layer_sz);
+		p += ptr->layer_sz;
+		memcpy(p, ptr->attr_present, ptr->num_attrs * sizeof(int));
+		p += ptr->num_attrs * sizeof(int);
+		memcpy(p, ptr->src, ptr->num_attrs);
+		p = (char *)lyr + lyr->len;
+	}
+
+	return 0;
+}
+
+// Convert snapshot fields from a system with a different byte order if 'swap' is set
+static __u32 qc_snap_u32(int swap, __u32 val) {
+	return swap ? bswap_32(val) : val;
+}
+
+static __u64 qc_snap_u64(int swap, __u64 val) {
+	return swap ? bswap_64(val) : val;
+}
+
+// Convert all numeric attributes and the presence indicators of 'hdl' to our byte order
+static void qc_snap_swap_layer(struct qc_handle *hdl) {
+	struct qc_attr *attr;
+	__u32 *val;
+	int i;
+
+	for (attr = hdl->attr_list; attr->offset >= 0; attr++) {
+		if (attr->type == string)
+			continue;
+		val = (__u32 *)((char *)hdl->layer + attr->offset);
+		*val = bswap_32(*val);
+	}
+	for (i = 0; i < hdl->num_attrs; i++)
+		hdl->attr_present[i] = bswap_32(hdl->attr_present[i]);
+}
+
+// Make sure all string attributes of 'hdl' are terminated within their buffers
+static void qc_snap_terminate_strings(struct qc_handle *hdl) {
+	struct qc_attr *attr;
+
+	for (attr = hdl->attr_list; attr->offset >= 0; attr++) {
+		if (attr->type == string)
+			((char *)hdl->layer + attr->offset)[qc_get_str_attr_len(attr->id) - 1] = '\0';
+	}
+}
+
+int qc_hdl_deserialize(struct qc_handle **hdl, const char *buf, size_t len) {
+	struct qc_handle *ptr = NULL, *prev = NULL;
+	struct qc_snap_layer lyr;
+	struct qc_snap_hdr shdr;
+	int swap = 0, rc = 0;
+	unsigned int i;
+	const char *p;
+	size_t off;
+
+	// data might originate from a different system, so we don't rely on alignment or byte order
+	if (len >= sizeof(struct qc_snap_hdr)) {
+		memcpy(&shdr, buf, sizeof(struct qc_snap_hdr));
+		swap = shdr.version == bswap_32(QC_SNAP_VERSION);
+		shdr.num_layers = qc_snap_u32(swap, shdr.num_layers);
+		shdr.layout = qc_snap_u64(swap, shdr.layout);
+		shdr.len = qc_snap_u64(swap, shdr.len);
+	}
+	if (len < sizeof(struct qc_snap_hdr) || qc_snap_u32(swap, shdr.version) != QC_SNAP_VERSION ||
+	    shdr.layout != qc_attr_layout) {
+		qc_debug(*hdl, "Error: Serialized data has unsupported format\n");
+		return -1;
+	}
+	if (shdr.len > len || shdr.num_layers == 0) {
+		qc_debug(*hdl, "Error: Serialized data is truncated\n");
+		return -2;
+	}
+	if (swap)
+		qc_debug(*hdl, "Serialized data has different byte order, converting\n");
+	if (*hdl) {
+		// release present layers for reuse
+		qc_hdl_release(*hdl, (*hdl)->next);
+		(*hdl)->next = NULL;
+	}
+	for (i = 0, off = sizeof(struct qc_snap_hdr); i < shdr.num_layers; i++, off += lyr.len) {
+		if (off + sizeof(struct qc_snap_layer) > shdr.len) {
+			qc_debug(*hdl, "Error: Serialized data of layer %d is corrupt\n", i);
+			rc = -3;
+			goto out;
+		}
+		memcpy(&lyr, buf + off, sizeof(struct qc_snap_layer));
+		lyr.layer_type_num = qc_snap_u32(swap, lyr.layer_type_num);
+		lyr.layer_sz = qc_snap_u32(swap, lyr.layer_sz);
+		lyr.num_attrs = qc_snap_u32(swap, lyr.num_attrs);
+		lyr.len = qc_snap_u32(swap, lyr.len);
+		if (lyr.len > shdr.len - off || lyr.len < sizeof(struct qc_snap_layer) ||
+		    (i == 0 && lyr.layer_type_num != QC_LAYER_TYPE_CEC)) {
+			qc_debug(*hdl, "Error: Serialized data of layer %d is corrupt\n", i);
+			rc = -3;
+			goto out;
+		}
+		if (i == 0) {
+			if (qc_hdl_new(NULL, hdl, 0, QC_LAYER_TYPE_CEC)) {
+				rc = -4;
+				goto out;
+			}
+			ptr = *hdl;
+		} else {
+			if (qc_hdl_new(*hdl, &ptr, i, lyr.layer_type_num)) {
+				rc = -4;
+				goto out;
+			}
+			prev->next = ptr;
+		}
+		prev = ptr;
+		if (lyr.layer_sz != ptr->layer_sz || lyr.num_attrs != (unsigned int)ptr->num_attrs ||
+		    lyr.len < sizeof(struct qc_snap_layer) + ptr->layer_sz + ptr->num_attrs * (sizeof(int) + sizeof(char))) {
+			qc_debug(*hdl, "Error: Serialized data of layer %d does not match\n", i);
+			rc = -5;
+			goto out;
+		}
+		p = buf + off + sizeof(struct qc_snap_layer);
+		memcpy(ptr->layer, p, ptr->layer_sz);
+		p += ptr->layer_sz;
+		memcpy(ptr->attr_present, p, ptr->num_attrs * sizeof(int));
+		p += ptr->num_attrs * sizeof(int);
+		memcpy(ptr->src, p, ptr->num_attrs);
+		if (swap)
+			qc_snap_swap_layer(ptr);
+		// the layer data must describe the layer type we allocated
+		if ((unsigned int)*(int *)ptr->layer != lyr.layer_type_num) {
+			qc_debug(*hdl, "Error: Serialized data of layer %d has inconsistent type\n", i);
+			rc = -5;
+			goto out;
+		}
+		qc_snap_terminate_strings(ptr);
+	}
+	if (qc_hdl_index_layers(*hdl))
+		rc = -4;
+out:
+	if (rc && *hdl) {
+		// don't leave a partial chain behind
+		qc_hdl_release(*hdl, (*hdl)->next);
+		(*hdl)->next = NULL;
+		qc_hdl_index_layers(*hdl);
 	}
 
-	return;
+	return rc;
 }
 
 int qc_hdl_get_layer_no(struct qc_handle *hdl) {
@@ -978,20 +1670,17 @@ static enum qc_attr_id preserve_v1_attr_compatibility(struct qc_handle *hdl, enu
 
 // Indicates the attribute as 'set', returning a ptr to its content
 static char *qc_set_attr(struct qc_handle *hdl, enum qc_attr_id id, enum qc_data_type type, char src, int *prev_set) {
-	struct qc_attr *attr_list = hdl->attr_list;
-	int count;
-
-	for (count = 0; attr_list[count].offset >= 0; ++count) {
-		if (attr_list[count].id == id && attr_list[count].type == type) {
-			*prev_set = hdl->attr_present[count];
-			hdl->attr_present[count] = 1;
-			hdl->src[count] = src;
-			return (char *)hdl->layer + attr_list[count].offset;
-		}
+	int idx;
+
+	if ((idx = qc_get_attr_idx(hdl, id, type)) < 0) {
+		qc_debug(hdl, "Error: Failed to set attr=%s (not found)\n", qc_attr_id_to_char(hdl, id));
+		return NULL;
 	}
-	qc_debug(hdl, "Error: Failed to set attr=%s (not found)\n", qc_attr_id_to_char(hdl, id));
+	*prev_set = hdl->attr_present[idx];
+	hdl->attr_present[idx] = 1;
+	hdl->src[idx] = src;
 
-	return NULL;
+	return (char *)hdl->layer + hdl->attr_list[idx].offset;
 }
 
 // Sets attribute 'id' in layer as pointed to by 'hdl'
@@ -1070,21 +1759,19 @@ int qc_set_attr_string(struct qc_handle *hdl, enum qc_attr_id id, const char *st
 // Note: Copy content to temporary buffer for conversion first, as we do not want to modify the source data.
 int qc_set_attr_ebcdic_string(struct qc_handle *hdl, enum qc_attr_id id, unsigned char *str,
 			      unsigned int str_len, char src) {
-	char *buf;
+	char buf[STR_BUF_SIZE];
 	int rc;
 
-	buf = malloc(str_len + 1);
-	if (!buf) {
-		qc_debug(hdl, "Error: Memory allocation error\n");
+	if (str_len >= sizeof(buf)) {
+		qc_debug(hdl, "Error: EBCDIC string of length %u exceeds buffer\n", str_len);
 		return -1;
 	}
-	memset(buf, '\0', str_len + 1);
 	memcpy(buf, str, str_len);
+	buf[str_len] = '\0';
 	if ((rc = qc_ebcdic_to_ascii(hdl, buf, str_len)) == 0) {
-		if (strlen(buf) && qc_set_attr_string(hdl, id, (char *)buf, src))
+		if (strlen(buf) && qc_set_attr_string(hdl, id, buf, src))
 			rc = -2;
 	}
-	free(buf);
 
 	return rc;
 }
@@ -1096,16 +1783,20 @@ int qc_is_nonempty_ebcdic(__u64 *str) {
 
 // Returns whether attribute 'id' in layer as pointed to by 'hdl' is set/defined
 static int qc_is_attr_set(struct qc_handle *hdl, enum qc_attr_id id, enum qc_data_type type) {
-	struct qc_attr *attr_list = hdl->attr_list;
-	int count = 0;
+	int idx;
 
-	while (attr_list[count].offset >= 0) {
-		if (attr_list[count].id == id && attr_list[count].type == type)
-			return hdl->attr_present[count];
-		count++;
-	}
+	if ((idx = qc_get_attr_idx(hdl, id, type)) < 0)
+		return 0;
 
-	return 0;
+	return hdl->attr_present[idx];
+}
+
+// Returns whether attribute 'id' changed in the last qc_refresh(), or <0 if not present in layer 'hdl'
+int qc_is_attr_changed(struct qc_handle *hdl, enum qc_attr_id id) {
+	if ((unsigned int)id >= QC_NUM_ATTR_IDS || hdl->attr_idx[id] < 0)
+		return -1;
+
+	return hdl->attr_changed[hdl->attr_idx[id]];
 }
 
 int qc_is_attr_set_int(struct qc_handle *hdl, enum qc_attr_id id) {
@@ -1124,6 +1815,10 @@ struct qc_handle *qc_hdl_get_root(struct qc_handle *hdl) {
 	return hdl ? hdl->root : NULL;
 }
 
+const struct qc_dump *qc_hdl_get_dump(struct qc_handle *hdl) {
+	return hdl ? hdl->root->dump : NULL;
+}
+
 struct qc_handle *qc_hdl_get_top(struct qc_handle *hdl) {
 	for (; hdl->next != NULL; hdl = hdl->next);
 
@@ -1141,17 +1836,6 @@ struct qc_handle *qc_hdl_get_prev(struct qc_handle *hdl) {
 	return NULL;
 }
 
-static int qc_get_attr_idx(struct qc_handle *hdl, enum qc_attr_id id, enum qc_data_type type) {
-	struct qc_attr *attr_list = hdl->attr_list;
-	int idx;
-
-	for (idx = 0; attr_list[idx].offset >= 0; ++idx)
-		if (attr_list[idx].id == id && attr_list[idx].type == type)
-			return idx;
-
-	return -1;
-}
-
 /// Retrieve value of attribute 'id' of layer pointed at by 'hdl'
 static void *qc_get_attr_value(struct qc_handle *hdl, enum qc_attr_id id, enum qc_data_type type) {
 	struct qc_attr *attr_list = hdl->attr_list;
@@ -1202,26 +1886,112 @@ char qc_get_attr_value_src_string(struct qc_handle *hdl, enum qc_attr_id id) {
 	return qc_get_attr_value_src(hdl, id, string);
 }
 
-void qc_print_attrs_json(struct qc_handle *hdl, int indent) {
-        struct qc_attr *attr;
-        void *val;
-
-        for (attr = hdl->attr_list; attr->offset >= 0; attr++) {
-                if ((val = qc_get_attr_value(hdl, attr->id, attr->type)) == NULL)
-                        printf("%*s\"%s\": null", indent, "", qc_attr_id_to_char(hdl, attr->id));
-                else {
-                        switch (attr->type) {
-                        case integer:
-                                printf("%*s\"%s\": \"%d\"", indent, "", qc_attr_id_to_char(hdl, attr->id), *(int*)val);
-                                break;
-                        case floatingpoint:
-                                printf("%*s\"%s\": \"%f\"", indent, "", qc_attr_id_to_char(hdl, attr->id), *(float*)val);
-                                break;
-                        case string:
-                                printf("%*s\"%s\": \"%s\"", indent, "", qc_attr_id_to_char(hdl, attr->id), (char*)val);
-                                break;
-                        }
-                }
-                printf("%s\n", (attr + 1)->offset >= 0 ? "," : "");
-        }
+int qc_json_flush(struct qc_json_out *out) {
+	size_t off = 0;
+	ssize_t lrc;
+
+	if (out->fd < 0 || out->err)
+		return out->err;
+	while (off < out->len) {
+		lrc = write(out->fd, out->buf + off, out->len - off);
+		if (lrc < 0) {
+			if (errno == EINTR)
+				continue;
+			out->err = -EIO;
+			return out->err;
+		}
+		off += lrc;
+	}
+	out->len = 0;
+
+	return 0;
+}
+
+void qc_json_printf(struct qc_json_out *out, const char *fmt, ...) {
+	size_t avail;
+	va_list ap;
+	int n;
+
+	if (out->err)
+		return;
+	va_start(ap, fmt);
+	if (out->fp) {
+		if (vfprintf(out->fp, fmt, ap) < 0)
+			out->err = -EIO;
+		va_end(ap);
+		return;
+	}
+	avail = out->len < out->size ? out->size - out->len : 0;
+	n = vsnprintf(avail ? out->buf + out->len : NULL, avail, fmt, ap);
+	va_end(ap);
+	if (n < 0) {
+		out->err = -EINVAL;
+		return;
+	}
+	if (out->fd >= 0 && (size_t)n >= avail) {
+		// staging buffer is full: write out and format again
+		if (qc_json_flush(out))
+			return;
+		if ((size_t)n >= out->size) {
+			out->err = -EOVERFLOW;
+			return;
+		}
+		va_start(ap, fmt);
+		vsnprintf(out->buf, out->size, fmt, ap);
+		va_end(ap);
+	}
+	out->len += n;
+}
+
+// Print 'str' as a JSON string, escaping characters as required
+static void qc_print_str_json(struct qc_json_out *out, const char *str) {
+	size_t n;
+
+	qc_json_printf(out, "\"");
+	while (*str) {
+		for (n = 0; str[n] && str[n] != '"' && str[n] != '\\' && (unsigned char)str[n] >= 0x20; n++);
+		if (n)
+			qc_json_printf(out, "%.*s", (int)n, str);
+		str += n;
+		if (*str)
+			qc_json_printf(out, "\\u%04x", (unsigned char)*str++);
+	}
+	qc_json_printf(out, "\"");
+}
+
+void qc_print_attrs_json(struct qc_json_out *out, struct qc_handle *hdl, int indent) {
+	int compact = out->flags & QC_JSON_COMPACT, typed = out->flags & QC_JSON_TYPED;
+	const char *sep = "";
+	struct qc_attr *attr;
+	void *val;
+
+	if (compact)
+		indent = 0;
+	for (attr = hdl->attr_list; attr->offset >= 0; attr++) {
+		if ((val = qc_get_attr_value(hdl, attr->id, attr->type)) == NULL && (out->flags & QC_JSON_SKIP_NULL))
+			continue;
+		qc_json_printf(out, "%s%*s\"%s\":%s", sep, indent, "", qc_attr_id_to_char(hdl, attr->id), compact ? "" : " ");
+		sep = compact ? "," : ",\n";
+		if (val == NULL) {
+			qc_json_printf(out, "null");
+			continue;
+		}
+		switch (attr->type) {
+		case integer:
+			qc_json_printf(out, typed ? "%d" : "\"%d\"", *(int*)val);
+			break;
+		case floatingpoint:
+			// JSON has no representation for inf and nan
+			if (typed && !isfinite(*(float*)val))
+				qc_json_printf(out, "null");
+			else
+				qc_json_printf(out, typed ? "%f" : "\"%f\"", *(float*)val);
+			break;
+		case string:
+			qc_print_str_json(out, (char*)val);
+			break;
+		}
+	}
+	if (*sep && !compact)
+		qc_json_printf(out, "\n");
 }
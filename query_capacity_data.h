@@ -15,6 +15,7 @@ int qc_set_attr_ebcdic_string(struct qc_handle *hdl, enum qc_attr_id id, unsigne
 int qc_is_attr_set_int(struct qc_handle *hdl, enum qc_attr_id id);
 int qc_is_attr_set_float(struct qc_handle *hdl, enum qc_attr_id id);
 int qc_is_attr_set_string(struct qc_handle *hdl, enum qc_attr_id id);
+int qc_is_attr_changed(struct qc_handle *hdl, enum qc_attr_id id);
 
 const char *qc_attr_id_to_char(struct qc_handle *hdl, enum qc_attr_id id);
 
@@ -27,6 +28,20 @@ char qc_get_attr_value_src_int(struct qc_handle *hdl, enum qc_attr_id id);
 char qc_get_attr_value_src_float(struct qc_handle *hdl, enum qc_attr_id id);
 char qc_get_attr_value_src_string(struct qc_handle *hdl, enum qc_attr_id id);
 
+// Destination of output in JSON format
+struct qc_json_out {
+	int	 flags;	// see enum qc_json_flags
+	FILE	*fp;	// stream to write to, if set
+	int	 fd;	// file descriptor to write to via staging buffer 'buf', if >=0
+	char	*buf;	// buffer to write to
+	size_t	 size;	// size of 'buf'
+	size_t	 len;	// length of output in 'buf' - might exceed 'size' if 'buf' is too small
+	int	 err;	// first error encountered, if any
+};
+
+void qc_json_printf(struct qc_json_out *out, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+// write out staged data, returns 0 on success
+int qc_json_flush(struct qc_json_out *out);
 // print all attributes in the list in json format
-void qc_print_attrs_json(struct qc_handle *hdl, int indent);
+void qc_print_attrs_json(struct qc_json_out *out, struct qc_handle *hdl, int indent);
 #endif
@@ -0,0 +1,224 @@
+/* Copyright IBM Corp. 2020 */
+
+#include <math.h>
+#include <stdint.h>
+
+#include "query_capacity_int.h"
+#include "query_capacity_data.h"
+
+
+/*
+ * Samples are kept in a struct-of-arrays layout: All samples of an attribute
+ * in a layer form a ring of 'size' values, so scanning a window touches
+ * contiguous memory only. The rings of all layers share the same head and
+ * timestamps, as each sample covers all layers. Unset values are NAN.
+ * Windows are determined using monotonic timestamps, so changes to the system
+ * time do not affect which samples are summarized.
+ */
+struct qc_history {
+	int		     size;		// number of samples per ring
+	int		     num;		// number of samples recorded, up to 'size'
+	int		     head;		// index of the next sample to record
+	int		     num_ids;
+	enum qc_attr_id	    *ids;		// attributes to record
+	unsigned long long  *times;		// time of each sample in milliseconds since the epoch
+	unsigned long long  *mono;		// time of each sample in milliseconds of CLOCK_MONOTONIC
+	int		     num_layers;	// number of entries in 'values'
+	double		   **values;		// per layer, 'num_ids' rings of 'size' values each
+};
+
+// Attributes recorded unless specified otherwise
+static const enum qc_attr_id qc_history_default_ids[] = {
+	qc_cp_absolute_capping, qc_cp_capped_capacity, qc_cp_weight_capping,
+	qc_ifl_absolute_capping, qc_ifl_capped_capacity, qc_ifl_weight_capping,
+	qc_ziip_absolute_capping, qc_ziip_capped_capacity, qc_ziip_weight_capping,
+	qc_num_cpu_configured, qc_num_cpu_standby,
+};
+
+static unsigned long long qc_history_now(clockid_t clk) {
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+// Returns the rings of layer 'layer_no', allocating them for all layers up to 'layer_no' as needed
+static double *qc_history_get_layer(struct qc_handle *hdl, int layer_no) {
+	struct qc_history *hist = hdl->history;
+	double **values;
+	size_t i, n;
+
+	if (layer_no < hist->num_layers)
+		return hist->values[layer_no];
+	values = realloc(hist->values, (layer_no + 1) * sizeof(double *));
+	if (!values) {
+		qc_debug(hdl, "Error: Failed to allocate history layers\n");
+		return NULL;
+	}
+	hist->values = values;
+	n = (size_t)hist->num_ids * hist->size;
+	if (n > SIZE_MAX / sizeof(double)) {
+		qc_debug(hdl, "Error: History too large\n");
+		return NULL;
+	}
+	for (; hist->num_layers <= layer_no; hist->num_layers++) {
+		values[hist->num_layers] = malloc(n * sizeof(double));
+		if (!values[hist->num_layers]) {
+			qc_debug(hdl, "Error: Failed to allocate history of layer %d\n", hist->num_layers);
+			return NULL;
+		}
+		// the layer did not exist in earlier samples
+		for (i = 0; i < n; i++)
+			values[hist->num_layers][i] = NAN;
+	}
+
+	return values[layer_no];
+}
+
+int qc_history_add(struct qc_handle *hdl) {
+	struct qc_history *hist = hdl->history;
+	struct qc_handle *layer;
+	double *values;
+	float *fval;
+	int i, l, *ival;
+
+	for (l = 0; l < hdl->num_layers; l++) {
+		if ((values = qc_history_get_layer(hdl, l)) == NULL)
+			return -1;
+		layer = hdl->layers[l];
+		for (i = 0; i < hist->num_ids; i++) {
+			if ((ival = qc_get_attr_value_int(layer, hist->ids[i])) != NULL)
+				values[i * hist->size + hist->head] = *ival;
+			else if ((fval = qc_get_attr_value_float(layer, hist->ids[i])) != NULL)
+				values[i * hist->size + hist->head] = *fval;
+			else
+				values[i * hist->size + hist->head] = NAN;
+		}
+	}
+	// layers that are gone
+	for (; l < hist->num_layers; l++)
+		for (i = 0; i < hist->num_ids; i++)
+			hist->values[l][i * hist->size + hist->head] = NAN;
+	hist->times[hist->head] = qc_history_now(CLOCK_REALTIME);
+	hist->mono[hist->head] = qc_history_now(CLOCK_MONOTONIC);
+	hist->head = (hist->head + 1) % hist->size;
+	if (hist->num < hist->size)
+		hist->num++;
+
+	return 0;
+}
+
+void qc_history_free(struct qc_handle *hdl) {
+	struct qc_history *hist = hdl->history;
+	int i;
+
+	if (!hist)
+		return;
+	for (i = 0; i < hist->num_layers; i++)
+		free(hist->values[i]);
+	free(hist->values);
+	free(hist->times);
+	free(hist->mono);
+	free(hist->ids);
+	free(hist);
+	hdl->history = NULL;
+}
+
+int qc_history_create(struct qc_handle *hdl, const enum qc_attr_id *ids, int num_ids, int size) {
+	struct qc_history *hist;
+
+	qc_history_free(hdl);
+	if (!ids) {
+		ids = qc_history_default_ids;
+		num_ids = sizeof(qc_history_default_ids) / sizeof(qc_history_default_ids[0]);
+	}
+	hist = calloc(1, sizeof(struct qc_history));
+	if (!hist)
+		goto err;
+	hdl->history = hist;
+	hist->size = size;
+	hist->num_ids = num_ids;
+	hist->ids = malloc(num_ids * sizeof(enum qc_attr_id));
+	hist->times = malloc(size * sizeof(unsigned long long));
+	hist->mono = malloc(size * sizeof(unsigned long long));
+	if (!hist->ids || !hist->times || !hist->mono)
+		goto err;
+	memcpy(hist->ids, ids, num_ids * sizeof(enum qc_attr_id));
+	if (qc_history_add(hdl))
+		goto err;
+
+	return 0;
+
+err:
+	qc_debug(hdl, "Error: Failed to allocate history\n");
+	qc_history_free(hdl);
+
+	return -ENOMEM;
+}
+
+// Returns the ring of attribute 'id' in layer 'layer', or NULL if not recorded
+static double *qc_history_get_ring(struct qc_history *hist, enum qc_attr_id id, int layer) {
+	int i;
+
+	if (layer >= hist->num_layers)
+		return NULL;
+	for (i = 0; i < hist->num_ids; i++)
+		if (hist->ids[i] == id)
+			return hist->values[layer] + i * hist->size;
+
+	return NULL;
+}
+
+int qc_history_read(struct qc_handle *hdl, enum qc_attr_id id, int layer, struct qc_history_sample *samples,
+		    int num) {
+	struct qc_history *hist = hdl->history;
+	double *ring;
+	int i, idx;
+
+	ring = qc_history_get_ring(hist, id, layer);
+	if (num > hist->num)
+		num = hist->num;
+	// most recent first
+	for (i = 0, idx = hist->head; i < num; i++) {
+		idx = (idx + hist->size - 1) % hist->size;
+		samples[i].time = hist->times[idx];
+		samples[i].set = ring && !isnan(ring[idx]);
+		samples[i].value = samples[i].set ? ring[idx] : 0;
+	}
+
+	return num;
+}
+
+void qc_history_summarize(struct qc_handle *hdl, enum qc_attr_id id, int layer, unsigned long long window,
+			  struct qc_history_summary *summary) {
+	struct qc_history *hist = hdl->history;
+	unsigned long long now, start = 0;
+	double *ring, sum = 0;
+	int i, idx;
+
+	memset(summary, 0, sizeof(*summary));
+	if ((ring = qc_history_get_ring(hist, id, layer)) == NULL)
+		return;
+	now = qc_history_now(CLOCK_MONOTONIC);
+	if (window && window < now)
+		start = now - window;
+	for (i = 0, idx = hist->head; i < hist->num; i++) {
+		idx = (idx + hist->size - 1) % hist->size;
+		if (hist->mono[idx] < start)
+			break;
+		if (isnan(ring[idx]))
+			continue;
+		if (!summary->num || ring[idx] < summary->min)
+			summary->min = ring[idx];
+		if (!summary->num || ring[idx] > summary->max)
+			summary->max = ring[idx];
+		if (!summary->num)
+			summary->last = hist->times[idx];
+		summary->first = hist->times[idx];
+		sum += ring[idx];
+		summary->num++;
+	}
+	if (summary->num)
+		summary->avg = sum / summary->num;
+}
@@ -8,12 +8,15 @@
 #include <dirent.h>
 #include <mntent.h>
 #include <endian.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include "query_capacity_data.h"
 
 
 #define QC_HYPFS_LPAR		"/s390_hypfs/diag_204"
 #define QC_HYPFS_ZVM		"/s390_hypfs/diag_2fc"
+#define QC_MOUNTINFO		"/proc/self/mountinfo"
 #define QC_NAME_LEN		8
 #define QC_CPU_TYPE_CP		0
 #define QC_CPU_TYPE_IFL		3
@@ -405,6 +408,9 @@ static int qc_read_diag_file(struct qc_handle *hdl, const char *dbgfs, struct hy
 	qc_debug(hdl, "Read in file '%s'\n", fpath);
 	// file content needs to be read in one(!) go
 	for (i = 0; i < 10; ++i) {
+		// the first read only retrieves the header to determine the size
+		if (i > 1)
+			qc_stats_add(hdl, num_read_retries, 1);
 		fh = open(fpath, O_RDONLY);
 		if (fh == -1) {
 			qc_debug(hdl, "Error: Failed to open file '%s'\n", fpath);
@@ -416,6 +422,7 @@ static int qc_read_diag_file(struct qc_handle *hdl, const char *dbgfs, struct hy
 											buflen);
 			goto out_fail;
 		}
+		qc_stats_add(hdl, num_buf_allocs, 1);
 		lrc = read(fh, priv->data, buflen);
 		close(fh);
 		if (lrc == -1) {
@@ -423,6 +430,7 @@ static int qc_read_diag_file(struct qc_handle *hdl, const char *dbgfs, struct hy
 			close(fh);
 			goto out_fail;
 		}
+		qc_stats_add(hdl, bytes_read, lrc);
 		hdr = (struct dfs_diag_hdr*)priv->data;
 		if ((buflen = sizeof(struct dfs_diag_hdr) + htobe64(hdr->len)) == lrc) {
 			priv->len = lrc;
@@ -544,12 +552,146 @@ out:
 	return rc;
 }
 
+// Process-wide cache of mount points, invalidated by changes to the mount table
+static struct qc_mnt_cache {
+	const char	*fstype;
+	int		 valid;
+	char		*mp;		// NULL if not mounted
+} qc_mnt_cache[] = {
+	{"debugfs",	0, NULL},
+	{"s390_hypfs",	0, NULL},
+};
+
+static pthread_mutex_t qc_mnt_lock = PTHREAD_MUTEX_INITIALIZER;
+static int qc_mnt_fd = -1;	// to get notified about changes to the mount table
+static dev_t qc_mnt_dev;	// to recognize qc_mnt_fd, see qc_mnt_fd_valid()
+static ino_t qc_mnt_ino;
+static pid_t qc_mnt_pid;
+
+// The application might close qc_mnt_fd, and the number be reused for another file
+static int qc_mnt_fd_valid(void) {
+	struct stat sb;
+
+	return fstat(qc_mnt_fd, &sb) == 0 && sb.st_dev == qc_mnt_dev && sb.st_ino == qc_mnt_ino;
+}
+
+static void qc_mnt_cache_flush(void) {
+	unsigned int i;
+
+	for (i = 0; i < sizeof(qc_mnt_cache) / sizeof(qc_mnt_cache[0]); i++) {
+		free(qc_mnt_cache[i].mp);
+		qc_mnt_cache[i].mp = NULL;
+		qc_mnt_cache[i].valid = 0;
+	}
+}
+
+static struct qc_mnt_cache *qc_mnt_cache_get(const char *fstype) {
+	unsigned int i;
+
+	for (i = 0; i < sizeof(qc_mnt_cache) / sizeof(qc_mnt_cache[0]); i++) {
+		if (strcmp(qc_mnt_cache[i].fstype, fstype) == 0)
+			return &qc_mnt_cache[i];
+	}
+
+	return NULL;
+}
+
+/* Drops all cached mount points if the mount table changed since the last call.
+   Returns 1 if the cache can be used, 0 if changes cannot be detected.
+   Must be called with qc_mnt_lock held. */
+static int qc_mnt_cache_check(struct qc_handle *hdl) {
+	struct pollfd pfd;
+	struct stat sb;
+	int rc;
+
+	if (qc_mnt_fd >= 0 && !qc_mnt_fd_valid()) {
+		// not ours anymore, so leave it alone
+		qc_debug(hdl, "%s was closed behind our back, reopening\n", QC_MOUNTINFO);
+		qc_mnt_fd = -1;
+	}
+	if (qc_mnt_fd >= 0 && qc_mnt_pid != getpid()) {
+		// we were forked, and might be in a different mount namespace by now
+		close(qc_mnt_fd);
+		qc_mnt_fd = -1;
+	}
+	if (qc_mnt_fd < 0) {
+		qc_mnt_cache_flush();
+		// any changes after this point are reported by poll()
+		if ((qc_mnt_fd = open(QC_MOUNTINFO, O_RDONLY | O_CLOEXEC)) < 0) {
+			qc_debug(hdl, "Failed to open %s, not caching mount points: %s\n", QC_MOUNTINFO,
+				 strerror(errno));
+			return 0;
+		}
+		if (fstat(qc_mnt_fd, &sb)) {
+			qc_debug(hdl, "Failed to stat %s, not caching mount points: %s\n", QC_MOUNTINFO,
+				 strerror(errno));
+			close(qc_mnt_fd);
+			qc_mnt_fd = -1;
+			return 0;
+		}
+		qc_mnt_dev = sb.st_dev;
+		qc_mnt_ino = sb.st_ino;
+		qc_mnt_pid = getpid();
+		return 1;
+	}
+	pfd.fd = qc_mnt_fd;
+	pfd.events = POLLPRI;
+	pfd.revents = 0;
+	if ((rc = poll(&pfd, 1, 0)) < 0 || pfd.revents & POLLNVAL) {
+		qc_debug(hdl, "Failed to poll %s, not caching mount points\n", QC_MOUNTINFO);
+		if (!(pfd.revents & POLLNVAL))
+			close(qc_mnt_fd);
+		qc_mnt_fd = -1;
+		qc_mnt_cache_flush();
+		return 0;
+	}
+	if (pfd.revents & (POLLPRI | POLLERR)) {
+		qc_debug(hdl, "Mount table changed, dropping cached mount points\n");
+		qc_mnt_cache_flush();
+	}
+
+	return 1;
+}
+
 /* Retrieve mountpoint of fstype from /etc/mtab.
    Returns 0 on success with malloc'd mountpoint in 'mp', >0 if not found and
    <0 in case of an error. */
-static int qc_get_mountpoint(struct qc_handle *hdl, char *fstype, char **mp) {
+static int qc_scan_mountpoint(struct qc_handle *hdl, char *fstype, char **mp) {
 	struct mntent *mntbuf;
 	FILE *mounts;
+
+	*mp = NULL;
+	mounts = setmntent(_PATH_MOUNTED, "r");
+	if (!mounts) {
+		qc_debug(hdl, "Error: Failed to open %s\n", _PATH_MOUNTED);
+		return -1;
+	}
+	while ((mntbuf = getmntent(mounts)) != NULL) {
+		if (strcmp(mntbuf->mnt_type, fstype) == 0) {
+			*mp = strdup(mntbuf->mnt_dir);
+			if (!*mp) {
+				qc_debug(hdl, "Error: Failed to allocate buffer\n");
+				endmntent(mounts);
+				return -2;
+			}
+			break;
+		}
+	}
+	endmntent(mounts);
+	if (!*mp) {
+		qc_debug(hdl, "%s not mounted according to '%s'\n", fstype, _PATH_MOUNTED);
+		return 1;
+	}
+	qc_debug(hdl, "%s mounted at '%s'\n", fstype, *mp);
+
+	return 0;
+}
+
+/* Retrieve mountpoint of fstype, using the cache where possible.
+   Returns 0 on success with malloc'd mountpoint in 'mp', >0 if not found and
+   <0 in case of an error. */
+static int qc_get_mountpoint(struct qc_handle *hdl, char *fstype, char **mp) {
+	struct qc_mnt_cache *ent;
 	char *fname;
 	int rc;
 
@@ -577,35 +719,82 @@ static int qc_get_mountpoint(struct qc_handle *hdl, char *fstype, char **mp) {
 		return 0;
 	}
 	qc_debug(hdl, "Locate mount point of %s\n", fstype);
-	*mp = NULL;
-	mounts = setmntent(_PATH_MOUNTED, "r");
-	if (!mounts) {
-		qc_debug(hdl, "Error: Failed to open %s\n", _PATH_MOUNTED);
-		return -1;
+	pthread_mutex_lock(&qc_mnt_lock);
+	if (!qc_mnt_cache_check(hdl) || (ent = qc_mnt_cache_get(fstype)) == NULL) {
+		rc = qc_scan_mountpoint(hdl, fstype, mp);
+		goto out;
 	}
-	while ((mntbuf = getmntent(mounts)) != NULL) {
-		if (strcmp(mntbuf->mnt_type, fstype) == 0) {
-			*mp = strdup(mntbuf->mnt_dir);
-			if (!*mp) {
-				qc_debug(hdl, "Error: Failed to allocate buffer\n");
-				endmntent(mounts);
-				return -2;
-			}
-			break;
+	if (ent->valid) {
+		if (!ent->mp) {
+			qc_debug(hdl, "%s not mounted (cached)\n", fstype);
+			rc = 1;
+			goto out;
+		}
+		if ((*mp = strdup(ent->mp)) == NULL) {
+			qc_debug(hdl, "Error: Failed to allocate buffer\n");
+			rc = -2;
+			goto out;
 		}
+		qc_debug(hdl, "%s mounted at '%s' (cached)\n", fstype, *mp);
+		rc = 0;
+		goto out;
 	}
-	endmntent(mounts);
-	if (!*mp) {
-		qc_debug(hdl, "%s not mounted according to '%s'\n", fstype, _PATH_MOUNTED);
+	if ((rc = qc_scan_mountpoint(hdl, fstype, mp)) < 0)
+		goto out;
+	// failing to cache is not an error - we will just scan again next time
+	if (rc == 0 && (ent->mp = strdup(*mp)) == NULL)
+		goto out;
+	ent->valid = 1;
+
+out:
+	pthread_mutex_unlock(&qc_mnt_lock);
+
+	return rc;
+}
+
+// Copies the diag data from in-memory 'dump', if available
+static int qc_read_diag_mem(struct qc_handle *hdl, const struct qc_dump *dump, struct hypfs_priv *priv) {
+	struct dfs_diag_hdr hdr;
+	const char *data;
+	size_t len;
+
+	if (dump->diag_2fc) {
+		priv->diag = QC_HYPFS_ZVM;
+		data = dump->diag_2fc;
+		len = dump->diag_2fc_len;
+	} else if (dump->diag_204) {
+		priv->diag = QC_HYPFS_LPAR;
+		data = dump->diag_204;
+		len = dump->diag_204_len;
+	} else {
+		qc_debug(hdl, "No hypfs data available\n");
 		return 1;
 	}
-	qc_debug(hdl, "%s mounted at '%s'\n", fstype, *mp);
+	qc_debug(hdl, "Read %s from memory\n", priv->diag);
+	if (len < sizeof(struct dfs_diag_hdr)) {
+		qc_debug(hdl, "Error: Data too short\n");
+		return 1;
+	}
+	memcpy(&hdr, data, sizeof(struct dfs_diag_hdr));
+	if (sizeof(struct dfs_diag_hdr) + htobe64(hdr.len) != len) {
+		qc_debug(hdl, "Error: Data length does not match header\n");
+		return 1;
+	}
+	if ((priv->data = malloc(len)) == NULL) {
+		qc_debug(hdl, "Error: Failed to allocate '%zd' Bytes for diag data\n", len);
+		return -1;
+	}
+	memcpy(priv->data, data, len);
+	priv->len = len;
+	qc_stats_add(hdl, num_buf_allocs, 1);
+	qc_stats_add(hdl, bytes_read, len);
 
 	return 0;
 }
 
 static int qc_hypfs_open(struct qc_handle *hdl, char **buf) {
 	char *dbgfs = NULL, *fpath = NULL;
+	const struct qc_dump *dump;
 	struct hypfs_priv *priv;
 	int rc = 0;
 
@@ -619,6 +808,15 @@ static int qc_hypfs_open(struct qc_handle *hdl, char **buf) {
 	bzero(priv, sizeof(struct hypfs_priv));
 	*buf = (char *)priv;
 
+	if ((dump = qc_hdl_get_dump(hdl)) != NULL) {
+		if ((rc = qc_read_diag_mem(hdl, dump, priv)) != 0) {
+			rc = rc < 0 ? rc : 0;	// missing data is not a fatal error - we just skip this source
+			goto out;
+		}
+		priv->avail = strcmp(priv->diag, QC_HYPFS_ZVM) ? HYPFS_AVAIL_BIN_LPAR : HYPFS_AVAIL_BIN_ZVM;
+		goto out;
+	}
+
 	// check for binary hypfs interface
 	if ((rc = qc_get_mountpoint(hdl, "debugfs", &dbgfs)) < 0)
 		goto out;
@@ -709,5 +907,4 @@ struct qc_data_src hypfs = {qc_hypfs_open,
 			    qc_hypfs_process,
 			    qc_hypfs_dump,
 			    qc_hypfs_close,
-			    NULL,
 			    NULL};
@@ -9,7 +9,6 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
-#include <iconv.h>
 #include <inttypes.h>
 #include <linux/types.h>
 #include <unistd.h>
@@ -19,6 +18,9 @@
 
 /* Miscellaneous structures and constants */
 #define STR_BUF_SIZE		257
+#define QC_NUM_ATTR_IDS		(qc_ziip_effective_capacity_layer + 1)	// number of attribute ids, see enum qc_attr_id
+#define QC_NUM_SRCS		4		// number of data sources, see enum qc_refresh_flags
+#define QC_HISTORY_MAX_SIZE	65536		// maximum number of samples per attribute, see qc_history_enable()
 
 #define ATTR_SRC_SYSINFO	'S'
 #define ATTR_SRC_SYSFS		'F'
@@ -44,11 +46,30 @@ struct qc_handle {
 	void		 *layer;	// holds a copy of the respective *_values struct
 					// and is filled by looking up the offset via the respective *_attrs table
 	struct qc_attr	 *attr_list;
+	short		 *attr_idx;	// maps attribute ids to indices in attr_list
 	int 		  layer_no;
 	int 		 *attr_present;	// array indicating whether attributes are set
 	char		 *src;		// array indicating the source of the attribute's value, see ATTR_SRC_*
+	int		 *attr_changed;	// array indicating whether attributes changed in last qc_refresh()
+	size_t		  layer_sz;	// size of 'layer'
+	int		  num_attrs;	// number of entries in attr_present, src and attr_changed
 	struct qc_handle *next;
 	struct qc_handle *root;		// points to top handle
+	// Following fields are used in the root handle only
+	char		 *priv[QC_NUM_SRCS];	// data retrieved by the data sources
+	struct qc_handle *pool;		// released handles, retained for reuse by qc_refresh()
+	struct qc_arena	 *arena;	// memory holding all handles, see qc_hdl_new()
+	struct qc_handle **layers;	// all layers indexed by layer_no, see qc_hdl_index_layers()
+	int		  num_layers;	// number of entries in 'layers'
+	int		  max_layers;	// allocated entries in 'layers'
+	char		 *shm;		// file published data was retrieved from, see qc_shm_attach()
+	int		  frozen;	// data cannot be refreshed, see qc_open_from_snapshot()
+	const struct qc_dump *dump;	// in-memory data to use while opening, see qc_open_from_dump()
+	struct qc_stats	  stats;	// see qc_get_stats()
+	struct qc_history *history;	// see qc_history_enable()
+	int		  parallel_open;	// see QC_PARALLEL_OPEN in qc_open()
+	int		  retries;	// see QC_RETRIES in qc_open()
+	int		  retry_delay;	// in milliseconds, see QC_RETRY_DELAY in qc_open()
 };
 
 struct qc_data_src {
@@ -56,12 +77,37 @@ struct qc_data_src {
 	int  (*process)(struct qc_handle *, char *);
 	void (*dump)(struct qc_handle *, char *);
 	void (*close)(struct qc_handle *, char *);
-	int  (*lgm_check)(struct qc_handle *, const char *);
-	char *priv;
+	int  (*lgm_check)(struct qc_handle *, char *);
 };
 
 extern struct qc_data_src sysinfo, sysfs, hypfs, sthyi;
 
+/* Sharing of data between processes, see query_capacity_shm.c */
+int qc_shm_publish(struct qc_handle *hdl, const char *path, int validity);
+int qc_shm_attach(struct qc_handle **hdl, const char *path);
+
+/* Watching for changes, see query_capacity_watch.c */
+struct qc_watch;
+// Start a thread refreshing root handle 'hdl' (registered as 'token') every 'interval' milliseconds
+int qc_watch_create(struct qc_watch **watch, struct qc_handle *hdl, void *token, int interval, int flags,
+		    const enum qc_attr_id *ids, int num_ids, qc_watch_cb cb, void *data);
+// Stop the thread of 'watch' and free it, returning the token of its handle, or NULL if 'watch' is unknown
+void *qc_watch_destroy(struct qc_watch *watch);
+// Refresh data of root handle 'hdl', see qc_refresh(). Returns the previous layers in 'prev' if not NULL,
+// to be released via qc_hdl_release() by the caller
+int qc_refresh_hdl(struct qc_handle *hdl, int flags, int *changed, struct qc_handle **prev);
+
+/* Sample history, see query_capacity_history.c */
+// Discard the history of root handle 'hdl', and start a new one recording the current data
+int qc_history_create(struct qc_handle *hdl, const enum qc_attr_id *ids, int num_ids, int size);
+// Record the current data of root handle 'hdl' in its history
+int qc_history_add(struct qc_handle *hdl);
+void qc_history_free(struct qc_handle *hdl);
+int qc_history_read(struct qc_handle *hdl, enum qc_attr_id id, int layer, struct qc_history_sample *samples,
+		    int num);
+void qc_history_summarize(struct qc_handle *hdl, enum qc_attr_id id, int layer, unsigned long long window,
+			  struct qc_history_summary *summary);
+
 /* Utility functions */
 int qc_ebcdic_to_ascii(struct qc_handle *hdl, char *inbuf, size_t insz);
 int qc_is_nonempty_ebcdic(__u64 *str);
@@ -72,37 +118,80 @@ int qc_hdl_insert(struct qc_handle *hdl, struct qc_handle **inserted_hdl, int ty
 int qc_hdl_append(struct qc_handle *hdl, struct qc_handle **appended_hdl, int type);
 // Remove the layer pointed to by the handle and all layers on top
 void qc_hdl_prune(struct qc_handle *hdl);
+// Release the layers starting at 'hdl' into the pool of the root handle 'root' for later reuse
+void qc_hdl_release(struct qc_handle *root, struct qc_handle *hdl);
+// Free the root handle 'root' and all memory of its layers, including the pool
+void qc_hdl_free(struct qc_handle *root);
+// Update the array of layers in 'root' for direct access, to be called whenever the layers change
+int qc_hdl_index_layers(struct qc_handle *root);
+// Move content of root handle 'hdl' and all layers to a new chain 'saved', leaving 'hdl' without layers
+int qc_hdl_save(struct qc_handle *hdl, struct qc_handle **saved);
+// Restore content previously moved by qc_hdl_save(), releasing the current layers
+void qc_hdl_restore(struct qc_handle *hdl, struct qc_handle *saved);
+// Flag attributes of 'hdl' that differ from 'saved', returning the number of changed attributes
+int qc_hdl_flag_changes(struct qc_handle *hdl, struct qc_handle *saved);
+// Collect the attributes flagged by qc_hdl_flag_changes() into a newly allocated array 'changes',
+// restricted to the 'num_ids' attributes in 'ids' unless NULL. Old values point into 'saved'
+int qc_hdl_get_changes(struct qc_handle *hdl, struct qc_handle *saved, const enum qc_attr_id *ids, int num_ids,
+		       struct qc_attr_change **changes, int *num);
+// Serialize 'hdl' and all following layers into 'buf' of 'size' bytes. Returns 0 on success,
+// and >0 if 'buf' is too small. Either way, the required length is returned in 'len'
+int qc_hdl_serialize(struct qc_handle *hdl, char *buf, size_t size, size_t *len);
+// Create layers from data serialized by qc_hdl_serialize(), reusing root handle '*hdl' if set
+int qc_hdl_deserialize(struct qc_handle **hdl, const char *buf, size_t len);
 struct qc_handle *qc_hdl_get_cec(struct qc_handle *hdl);
 struct qc_handle *qc_hdl_get_lpar(struct qc_handle *hdl);
 struct qc_handle *qc_hdl_get_root(struct qc_handle *hdl);
+// Returns the in-memory data to use instead of the data sources, or NULL
+const struct qc_dump *qc_hdl_get_dump(struct qc_handle *hdl);
 struct qc_handle *qc_hdl_get_top(struct qc_handle *hdl);
 struct qc_handle *qc_hdl_get_prev(struct qc_handle *hdl);
 int qc_hdl_get_layer_no(struct qc_handle *hdl);
 
+/* Statistics, see qc_get_stats() */
+unsigned long long qc_stats_now(void);
+// Add 'val' to 'member' of the statistics of 'hdl' (if not NULL) as well as of the process
+#define qc_stats_add(hdl, member, val)	qc_stats_add_offset(hdl, offsetof(struct qc_stats, member), val)
+void qc_stats_add_offset(struct qc_handle *hdl, size_t offset, unsigned long long val);
+
 /* Debugging-related functions and variables */
 extern long  qc_dbg_level;
 extern FILE *qc_dbg_file;
 extern char *qc_dbg_dump_dir;
 extern char *qc_dbg_use_dump;
-extern int   qc_dbg_indent;
+extern __thread int qc_dbg_indent;
 extern int   qc_dbg_console;
 extern int   qc_consistency_check_requested;
-void qc_debug_indent_inc();
-void qc_debug_indent_dec();
 void qc_mark_dump_incomplete(struct qc_handle *hdl, char *missing_component);
 
+#ifdef CONFIG_NO_DEBUG
+// Arguments are still type-checked, but no code is generated
+#define qc_debug_indent_inc()	do { } while (0)
+#define qc_debug_indent_dec()	do { } while (0)
+#define qc_debug(hdl, arg, ...)	do { \
+	if (0) \
+		fprintf(stderr, "%p" arg, (void *)(hdl), ##__VA_ARGS__); \
+	} while (0);
+#else
+extern struct qc_dbg_rec *qc_dbg_ring;
+void qc_debug_indent_inc();
+void qc_debug_indent_dec();
+void qc_debug_ring_add(void *hdl, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
 
 #define qc_debug(hdl, arg, ...)	do { \
 	if (qc_dbg_level > 0) { \
 		if (qc_dbg_console) { \
 			fprintf(stderr, "%*s" arg, qc_dbg_indent, "", ##__VA_ARGS__); \
+		} else if (qc_dbg_ring) { \
+			qc_debug_ring_add(qc_hdl_get_root(hdl), "%*s" arg, qc_dbg_indent, "", ##__VA_ARGS__); \
 		} else { \
 			time_t t; \
-			struct tm *tm; \
+			struct tm tm; \
 			time(&t); \
-			tm = localtime(&t); \
+			localtime_r(&t, &tm); \
 			fprintf(qc_dbg_file, "%02d/%02d,%02d:%02d:%02d,%-10p: %*s" arg, \
-			tm->tm_mon + 1, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec, qc_hdl_get_root(hdl), qc_dbg_indent, "", ##__VA_ARGS__); \
+			tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, qc_hdl_get_root(hdl), qc_dbg_indent, "", ##__VA_ARGS__); \
 		} \
 	} }while(0);
 #endif
+#endif
@@ -0,0 +1,239 @@
+/* Copyright IBM Corp. 2020 */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "query_capacity_int.h"
+
+
+#define QC_SHM_MAGIC		"QCLIBSHM"
+#define QC_SHM_MIN_SIZE		65536	// initial file size, grown as needed
+#define QC_SHM_RETRIES		100	// attempts to read consistent data before giving up
+
+/*
+ * Layout of a file written by qc_shm_publish(). Updates are guarded by a
+ * seqlock: 'seq' is odd while an update is in progress, and readers retry
+ * until 'seq' is even and unchanged before and after copying the data.
+ * Hence readers never block the writer, nor each other.
+ */
+struct qc_shm_hdr {
+	char	magic[8];	// see QC_SHM_MAGIC
+	__u64	seq;
+	__u64	timestamp;	// time of last update, in seconds since the epoch
+	__u32	validity;	// seconds after 'timestamp' that the data remains valid, or 0
+	__u32	len;		// length of 'data'
+	char	data[];		// layers as serialized by qc_hdl_serialize()
+};
+
+/* Files usually reside in a world-writable directory like /dev/shm, hence we
+   only trust regular files owned by 'uid' or 'uid2' that nobody else can modify */
+static int qc_shm_is_trusted(struct qc_handle *hdl, const char *path, struct stat *sb, uid_t uid, uid_t uid2) {
+	if (!S_ISREG(sb->st_mode)) {
+		qc_debug(hdl, "Error: '%s' is not a regular file\n", path);
+		return 0;
+	}
+	if (sb->st_uid != uid && sb->st_uid != uid2) {
+		qc_debug(hdl, "Error: '%s' is owned by untrusted user %u\n", path, (unsigned int)sb->st_uid);
+		return 0;
+	}
+	if (sb->st_mode & (S_IWGRP | S_IWOTH)) {
+		qc_debug(hdl, "Error: '%s' is writable by others\n", path);
+		return 0;
+	}
+
+	return 1;
+}
+
+// Open the file at 'path' for publishing, creating it if necessary
+static int qc_shm_open_publish(struct qc_handle *hdl, const char *path, struct stat *sb) {
+	int fd;
+
+	// never follow symlinks, which others might have planted
+	fd = open(path, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+	if (fd >= 0) {
+		if (fstat(fd, sb)) {
+			close(fd);
+			return -1;
+		}
+		if (qc_shm_is_trusted(hdl, path, sb, geteuid(), geteuid()))
+			return fd;
+		close(fd);
+		// replace a stale file of ours, e.g. with wrong permissions
+		if (sb->st_uid != geteuid() || unlink(path)) {
+			qc_debug(hdl, "Error: Cannot replace '%s'\n", path);
+			return -1;
+		}
+		qc_debug(hdl, "Replace '%s'\n", path);
+	} else if (errno != ENOENT) {
+		qc_debug(hdl, "Error: Failed to open '%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		qc_debug(hdl, "Error: Failed to create '%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+	// umask might have been more permissive
+	if (fchmod(fd, 0644) || fstat(fd, sb)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int qc_shm_publish(struct qc_handle *hdl, const char *path, int validity) {
+	struct qc_shm_hdr *shm = MAP_FAILED;
+	size_t len, size = 0;
+	char *buf = NULL;
+	struct stat sb;
+	int fd, rc = 0;
+	__u64 seq;
+
+	qc_debug(hdl, "Publish data to '%s'\n", path);
+	qc_debug_indent_inc();
+	// serialize upfront to keep the time that readers have to wait short
+	qc_hdl_serialize(hdl, NULL, 0, &len);
+	buf = malloc(len);
+	if (!buf) {
+		qc_debug(hdl, "Error: Failed to allocate buffer\n");
+		rc = -1;
+		goto out;
+	}
+	if (qc_hdl_serialize(hdl, buf, len, &len)) {
+		rc = -2;
+		goto out;
+	}
+	if ((fd = qc_shm_open_publish(hdl, path, &sb)) < 0) {
+		rc = -3;
+		goto out;
+	}
+	// never shrink the file, as readers might have it mapped
+	size = sizeof(struct qc_shm_hdr) + len;
+	if (size < QC_SHM_MIN_SIZE)
+		size = QC_SHM_MIN_SIZE;
+	if ((size_t)sb.st_size > size)
+		size = sb.st_size;
+	else if (ftruncate(fd, size)) {
+		qc_debug(hdl, "Error: Failed to resize '%s': %s\n", path, strerror(errno));
+		close(fd);
+		rc = -4;
+		goto out;
+	}
+	shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		qc_debug(hdl, "Error: Failed to map '%s': %s\n", path, strerror(errno));
+		rc = -5;
+		goto out;
+	}
+
+	seq = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED) | 1;
+	__atomic_store_n(&shm->seq, seq, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(shm->magic, QC_SHM_MAGIC, sizeof(shm->magic));
+	shm->timestamp = time(NULL);
+	shm->validity = validity > 0 ? validity : 0;
+	shm->len = len;
+	memcpy(shm->data, buf, len);
+	__atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELEASE);
+	qc_debug(hdl, "Published %zd bytes, sequence number %llu\n", len, (unsigned long long)seq + 1);
+
+out:
+	if (shm != MAP_FAILED)
+		munmap(shm, size);
+	free(buf);
+	qc_debug(hdl, "Return rc=%d\n", rc);
+	qc_debug_indent_dec();
+
+	return rc;
+}
+
+int qc_shm_attach(struct qc_handle **hdl, const char *path) {
+	struct qc_shm_hdr *shm = MAP_FAILED, hdr;
+	size_t size = 0, max_len;
+	char *buf = NULL;
+	struct stat sb;
+	int fd, i, rc = 0;
+	__u64 seq;
+
+	qc_debug(*hdl, "Retrieve data published in '%s'\n", path);
+	qc_debug_indent_inc();
+	fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0) {
+		qc_debug(*hdl, "Failed to open '%s': %s\n", path, strerror(errno));
+		rc = -1;
+		goto out;
+	}
+	// only accept data published by root or ourselves
+	if (fstat(fd, &sb) || !qc_shm_is_trusted(*hdl, path, &sb, 0, geteuid())) {
+		close(fd);
+		rc = -7;
+		goto out;
+	}
+	if ((size_t)sb.st_size < sizeof(struct qc_shm_hdr)) {
+		qc_debug(*hdl, "Error: File '%s' is too small\n", path);
+		close(fd);
+		rc = -2;
+		goto out;
+	}
+	size = sb.st_size;
+	shm = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		qc_debug(*hdl, "Error: Failed to map '%s': %s\n", path, strerror(errno));
+		rc = -3;
+		goto out;
+	}
+	max_len = size - sizeof(struct qc_shm_hdr);
+	buf = malloc(max_len);
+	if (!buf) {
+		qc_debug(*hdl, "Error: Failed to allocate buffer\n");
+		rc = -4;
+		goto out;
+	}
+
+	for (i = 0; i < QC_SHM_RETRIES; i++) {
+		seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+		if (!(seq & 1)) {
+			memcpy(&hdr, shm, sizeof(struct qc_shm_hdr));
+			if (hdr.len <= max_len)
+				memcpy(buf, shm->data, hdr.len);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq)
+				break;
+		}
+		sched_yield();
+	}
+	if (i == QC_SHM_RETRIES) {
+		qc_debug(*hdl, "Error: Failed to read consistent data\n");
+		rc = 1;
+		goto out;
+	}
+	if (memcmp(hdr.magic, QC_SHM_MAGIC, sizeof(hdr.magic)) || hdr.len > max_len) {
+		qc_debug(*hdl, "Error: File '%s' does not contain valid data\n", path);
+		rc = -5;
+		goto out;
+	}
+	if (hdr.validity && (__u64)time(NULL) > hdr.timestamp + hdr.validity) {
+		qc_debug(*hdl, "Data is stale, published %llu seconds ago\n",
+			 (unsigned long long)(time(NULL) - hdr.timestamp));
+		rc = 2;
+		goto out;
+	}
+	if (qc_hdl_deserialize(hdl, buf, hdr.len))
+		rc = -6;
+
+out:
+	if (shm != MAP_FAILED)
+		munmap(shm, size);
+	free(buf);
+	qc_debug(*hdl, "Return rc=%d\n", rc);
+	qc_debug_indent_dec();
+
+	return rc;
+}
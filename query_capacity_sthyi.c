@@ -636,6 +636,7 @@ out:
 
 static int qc_sthyi_open(struct qc_handle *hdl, char **buf) {
 	struct sthyi_priv *priv = NULL;
+	const struct qc_dump *dump;
 	void *p = NULL;
 	int rc = 0;
 
@@ -656,8 +657,17 @@ static int qc_sthyi_open(struct qc_handle *hdl, char **buf) {
 	}
 	priv->data = (char *)p;
 	bzero(priv->data, STHYI_BUF_SIZE);
+	qc_stats_add(hdl, num_buf_allocs, 1);
 
-	if (qc_dbg_use_dump) {
+	if ((dump = qc_hdl_get_dump(hdl)) != NULL) {
+		if (!dump->sthyi) {
+			qc_debug(hdl, "No STHYI data available\n");
+			goto out;
+		}
+		memcpy(priv->data, dump->sthyi, dump->sthyi_len < STHYI_BUF_SIZE ? dump->sthyi_len : STHYI_BUF_SIZE);
+		qc_debug(hdl, "STHYI data read from memory\n");
+		priv->avail = STHYI_AVAILABLE;
+	} else if (qc_dbg_use_dump) {
 		if (qc_read_sthyi_dump(hdl, priv->data) != 0)
 			goto out;
 		priv->avail = STHYI_AVAILABLE;
@@ -677,6 +687,9 @@ static int qc_sthyi_open(struct qc_handle *hdl, char **buf) {
 			rc = qc_sthyi_lpar(hdl, priv);
 		}
 	}
+	// STHYI always fills the entire response buffer
+	if (priv->avail == STHYI_AVAILABLE)
+		qc_stats_add(hdl, bytes_read, STHYI_BUF_SIZE);
 
 out:
 	qc_debug_indent_dec();
@@ -695,5 +708,4 @@ struct qc_data_src sthyi = {qc_sthyi_open,
 			    qc_sthyi_process,
 			    qc_sthyi_dump,
 			    qc_sthyi_close,
-			    NULL,
 			    NULL};
@@ -191,6 +191,8 @@ static int qc_sysfs_get_file_content(struct qc_handle *hdl, char *file, char **c
 		*content = NULL;
 		return -2;
 	}
+	qc_stats_add(hdl, num_buf_allocs, 1);
+	qc_stats_add(hdl, bytes_read, rc);
 	rc = 0;
 	if (strcmp(*content, "\n") == 0 || **content == '\0') {
 		qc_debug(hdl, "'%s' contains no data, discarding\n", file);
@@ -203,12 +205,35 @@ static int qc_sysfs_get_file_content(struct qc_handle *hdl, char *file, char **c
 	return 0;
 }
 
-/** Handle numeric attributes */
-static int qc_sysfs_num_attr(struct qc_handle *hdl, char *file, int *attr) {
-	char *content = NULL;
-	int rc;
+/** Same as qc_sysfs_get_file_content(), but retrieves the data from in-memory 'mem' */
+static int qc_sysfs_get_mem_content(struct qc_handle *hdl, const char *name, const char *mem, char **content) {
+	size_t len;
 
-	rc = qc_sysfs_get_file_content(hdl, file, &content);
+	*content = NULL;
+	if (!mem) {
+		qc_debug(hdl, "'%s' not available\n", name);
+		return 1;
+	}
+	len = strcspn(mem, "\n");
+	if (len == 0) {
+		qc_debug(hdl, "'%s' contains no data, discarding\n", name);
+		return 2;
+	}
+	if (mem[len] == '\n')
+		len++;	// retain the newline, just like when reading the file
+	if ((*content = strndup(mem, len)) == NULL) {
+		qc_debug(hdl, "Error: Failed to allocate buffer for '%s'\n", name);
+		return -1;
+	}
+	qc_stats_add(hdl, num_buf_allocs, 1);
+	qc_stats_add(hdl, bytes_read, len);
+	qc_debug(hdl, "Read %s from memory\n", name);
+
+	return 0;
+}
+
+/** Convert numeric attributes from 'content' as retrieved with return code 'rc' */
+static int qc_sysfs_num_content(struct qc_handle *hdl, const char *file, int rc, char *content, int *attr) {
 	if (rc) {
 		*attr = -1;
 		if (rc > 0)
@@ -228,6 +253,26 @@ out:
 	return rc;
 }
 
+/** Handle numeric attributes */
+static int qc_sysfs_num_attr(struct qc_handle *hdl, char *file, int *attr) {
+	char *content = NULL;
+	int rc;
+
+	rc = qc_sysfs_get_file_content(hdl, file, &content);
+
+	return qc_sysfs_num_content(hdl, file, rc, content, attr);
+}
+
+/** Handle numeric attributes from in-memory 'mem' */
+static int qc_sysfs_num_mem(struct qc_handle *hdl, const char *name, const char *mem, int *attr) {
+	char *content = NULL;
+	int rc;
+
+	rc = qc_sysfs_get_mem_content(hdl, name, mem, &content);
+
+	return qc_sysfs_num_content(hdl, name, rc, content, attr);
+}
+
 static struct sysfs_priv *qc_sysfs_init_data(struct qc_handle *hdl, char **data) {
 	struct sysfs_priv *p;
 
@@ -245,6 +290,7 @@ static struct sysfs_priv *qc_sysfs_init_data(struct qc_handle *hdl, char **data)
 }
 
 static int qc_sysfs_open(struct qc_handle *hdl, char **data) {
+	const struct qc_dump *dump;
 	struct sysfs_priv *p;
 	char *path = NULL;
 	int rc = 0, lrc;
@@ -256,7 +302,15 @@ static int qc_sysfs_open(struct qc_handle *hdl, char **data) {
 		rc = -1;
 		goto out;
 	}
-	if (qc_dbg_use_dump) {
+	if ((dump = qc_hdl_get_dump(hdl)) != NULL) {
+		qc_debug(hdl, "Read sysfs from memory\n");
+		if (qc_sysfs_get_mem_content(hdl, "cpc_name", dump->cpc_name, &p->cpc_name) < 0 ||
+		    qc_sysfs_num_mem(hdl, "has_secure", dump->has_secure, &p->has_secure) ||
+		    qc_sysfs_num_mem(hdl, "secure", dump->secure, &p->secure))
+			rc = -1;
+		else
+			p->avail = SYSFS_AVAILABLE;
+	} else if (qc_dbg_use_dump) {
 		qc_debug(hdl, "Read sysfs from dump\n");
 		if (qc_sysfs_is_old_dump_format(hdl)) {
 			// Note: previously, we had a directory called 'ocf' where only one piece of data was
@@ -347,5 +401,4 @@ struct qc_data_src sysfs = {qc_sysfs_open,
 			    qc_sysfs_process,
 			    qc_sysfs_dump,
 			    qc_sysfs_close,
-			    NULL,
 			    NULL};
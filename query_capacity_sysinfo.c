@@ -10,11 +10,16 @@
 #include "query_capacity_data.h"
 
 
-static const char *qc_sysinfo_delim = "\n";
+struct sysinfo_priv {
+	char	*data;
+	ssize_t	 size;	// size of buffer 'data'
+	ssize_t	 len;	// length of content in 'data'
+	__u64	 hash;	// hash of content in 'data', used for the LGM check
+};
 
 
-static void qc_sysinfo_dump(struct qc_handle *hdl, char *sysinfo) {
-	char *path;
+static void qc_sysinfo_dump(struct qc_handle *hdl, char *priv) {
+	char *path, *sysinfo = priv ? ((struct sysinfo_priv *)priv)->data : NULL;
 	FILE *f;
 
 	qc_debug(hdl, "Dump sysinfo\n");
@@ -51,75 +56,159 @@ static void qc_sysinfo_dump(struct qc_handle *hdl, char *sysinfo) {
 	return;
 }
 
-static int qc_sysinfo_open(struct qc_handle *hdl, char **sysinfo) {
+// FNV-1a hash
+static __u64 qc_sysinfo_hash(const char *data, ssize_t len) {
+	__u64 hash = 0xcbf29ce484222325ULL;
+	ssize_t i;
+
+	for (i = 0; i < len; ++i) {
+		hash ^= (unsigned char)data[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+// Copies sysinfo from in-memory 'dump' into priv->data, reusing the buffer if large enough
+static int qc_sysinfo_read_mem(struct qc_handle *hdl, struct sysinfo_priv *priv, const struct qc_dump *dump) {
+	qc_debug(hdl, "Read sysinfo from memory\n");
+	if (!dump->sysinfo) {
+		qc_debug(hdl, "Error: No sysinfo data available\n");
+		free(priv->data);
+		priv->data = NULL;
+		return -3;
+	}
+	if (!priv->data || (size_t)priv->size <= dump->sysinfo_len) {
+		free(priv->data);
+		priv->size = dump->sysinfo_len + 1;
+		priv->data = malloc(priv->size);
+		if (!priv->data) {
+			qc_debug(hdl, "Error: Failed to alloc buffer for sysinfo data\n");
+			return -2;
+		}
+		qc_stats_add(hdl, num_buf_allocs, 1);
+	}
+	memcpy(priv->data, dump->sysinfo, dump->sysinfo_len);
+	qc_stats_add(hdl, bytes_read, dump->sysinfo_len);
+	priv->data[dump->sysinfo_len] = '\0';
+	priv->len = dump->sysinfo_len;
+	priv->hash = qc_sysinfo_hash(priv->data, priv->len);
+
+	return 0;
+}
+
+// Reads sysinfo into priv->data, reusing the buffer if already allocated
+static int qc_sysinfo_read(struct qc_handle *hdl, struct sysinfo_priv *priv) {
+	const struct qc_dump *dump;
 	char *fname = NULL;
-	ssize_t lrc = 1, sysinfo_sz;
-	int fd;
+	ssize_t lrc;
+	int fd, rc = 0;
 
-	qc_debug(hdl, "Retrieve sysinfo\n");
-	qc_debug_indent_inc();
-	*sysinfo = NULL;
+	if ((dump = qc_hdl_get_dump(hdl)) != NULL)
+		return qc_sysinfo_read_mem(hdl, priv, dump);
 	if (qc_dbg_use_dump) {
 		qc_debug(hdl, "Read sysinfo from dump\n");
 		if (asprintf(&fname, "%s/sysinfo", qc_dbg_use_dump) == -1) {
 			qc_debug(hdl, "Error: Mem alloc failed, cannot open dump\n");
-			goto out_early;
+			return -1;
 		}
 	} else
 		qc_debug(hdl, "Read sysinfo from /proc/sysinfo\n");
 
-	for (sysinfo_sz = 8192, lrc = sysinfo_sz; 2 * lrc >= sysinfo_sz; sysinfo_sz *= 2) {
+	if (!priv->data)
+		priv->size = 8192;
+	while (1) {
+		if (!priv->data) {
+			qc_debug(hdl, "Read sysinfo using buffer size %zu\n", priv->size);
+			priv->data = malloc(priv->size);
+			if (!priv->data) {
+				qc_debug(hdl, "Error: Failed to alloc buffer for sysinfo file\n");
+				rc = -2;
+				goto out;
+			}
+			qc_stats_add(hdl, num_buf_allocs, 1);
+		}
 		fd = open(fname ? fname : "/proc/sysinfo", O_RDONLY);
-		if (!fd) {
+		if (fd < 0) {
 			qc_debug(hdl, "Error: Failed to open file '%s': %s\n",
 				 fname ? fname : "/proc/sysinfo", strerror(errno));
+			rc = -3;
 			goto out;
 		}
-
-		free(*sysinfo);
-		qc_debug(hdl, "Read sysinfo using buffer size %zu\n", sysinfo_sz);
-		*sysinfo = malloc(sysinfo_sz);
-		if (!*sysinfo) {
-			qc_debug(hdl, "Error: Failed to alloc buffer for sysinfo file\n");
-			goto out;
-		}
-		lrc = read(fd, *sysinfo, sysinfo_sz);
+		lrc = read(fd, priv->data, priv->size);
+		close(fd);
 		if (lrc == -1) {
 			qc_debug(hdl, "Error: Failed to read %s file: %s\n",
 				 fname ? fname : "/proc/sysinfo", strerror(errno));
-			free(*sysinfo);
-			*sysinfo = NULL;
+			rc = -4;
 			goto out;
 		}
-		close(fd);
+		qc_stats_add(hdl, bytes_read, lrc);
+		if (lrc < priv->size)
+			break;
+		// buffer possibly too small, retry with a larger one
+		qc_stats_add(hdl, num_read_retries, 1);
+		free(priv->data);
+		priv->data = NULL;
+		priv->size *= 2;
 	}
-	(*sysinfo)[lrc] = '\0';
-	goto out_early;
+	priv->data[lrc] = '\0';
+	priv->len = lrc;
+	priv->hash = qc_sysinfo_hash(priv->data, lrc);
 
 out:
-	close(fd);
-
-out_early:
+	if (rc) {
+		free(priv->data);
+		priv->data = NULL;
+	}
 	free(fname);
-	qc_debug(hdl, "Done reading sysinfo, sysinfo=%p\n", *sysinfo);
+
+	return rc;
+}
+
+static int qc_sysinfo_open(struct qc_handle *hdl, char **buf) {
+	struct sysinfo_priv *priv;
+	int rc = 0;
+
+	qc_debug(hdl, "Retrieve sysinfo\n");
+	qc_debug_indent_inc();
+	*buf = NULL;
+	if ((priv = malloc(sizeof(struct sysinfo_priv))) == NULL) {
+		qc_debug(hdl, "Error: Failed to alloc sysinfo_priv\n");
+		rc = -1;
+		goto out;
+	}
+	memset(priv, 0, sizeof(struct sysinfo_priv));
+	*buf = (char *)priv;
+	rc = qc_sysinfo_read(hdl, priv);
+
+out:
+	qc_debug(hdl, "Done reading sysinfo, sysinfo=%p\n", priv ? priv->data : NULL);
 	qc_debug_indent_dec();
 
-	return *sysinfo == NULL;
+	return rc;
 }
 
-static int qc_sysinfo_lgm_check(struct qc_handle *hdl, const char *sysinfo) {
-	char *lsysinfo = NULL;
+static int qc_sysinfo_lgm_check(struct qc_handle *hdl, char *buf) {
+	struct sysinfo_priv *priv = (struct sysinfo_priv *)buf;
+	ssize_t len;
+	__u64 hash;
 	int rc = 0;
 
-	// Live Guest Migration check: If we were migrated, /proc/sysinfo will have changed
+	// Live Guest Migration check: If we were migrated, /proc/sysinfo will have changed.
+	// We only compare length and hash of the content, so the buffer can be reused. This
+	// is probabilistic: A change resulting in a hash collision goes unnoticed, which
+	// we accept given the 64 bit hash, and the same length being required as well.
 	qc_debug(hdl, "Run LGM check\n");
 	qc_debug_indent_inc();
-	if (qc_sysinfo_open(hdl, &lsysinfo)) {
+	len = priv->len;
+	hash = priv->hash;
+	if (qc_sysinfo_read(hdl, priv)) {
 		qc_debug(hdl, "Error: Failed to open /proc/sysinfo\n");
 		rc = -1;
 		goto out;
 	}
-	if (strcmp(lsysinfo, sysinfo)) {
+	if (priv->len != len || priv->hash != hash) {
 		qc_debug(hdl, "/proc/sysinfo content changed, LGM took place!\n");
 		rc = 1;
 		goto out;
@@ -129,54 +218,235 @@ static int qc_sysinfo_lgm_check(struct qc_handle *hdl, const char *sysinfo) {
 
 out:
 	qc_debug_indent_dec();
-	free(lsysinfo);
 
 	return rc;
 }
 
-static void qc_sysinfo_close(struct qc_handle *hdl, char *sysinfo) {
-	free(sysinfo);
+static void qc_sysinfo_close(struct qc_handle *hdl, char *priv) {
+	if (priv) {
+		free(((struct sysinfo_priv *)priv)->data);
+		free(priv);
+	}
 }
 
-/* Whenever we're using strtok_r() to parse sysinfo, we're messing up the string, since
-   strtok_r() will insert '\0's, so this function will create a fresh copy to work on. */
-static char *qc_copy_sysinfo(struct qc_handle *hdl, char *sysinfo) {
-	char *rc;
+/*
+ * /proc/sysinfo is parsed in a single pass in place: Each line is split at the
+ * colon, and the keyword is looked up in the table for the respective section.
+ */
+enum qc_sysinfo_fmt {
+	QC_SYSINFO_INT,		// integer value
+	QC_SYSINFO_THREADS,	// integer value, reported as number of threads - 1
+	QC_SYSINFO_FLOAT,	// floating point value
+	QC_SYSINFO_WORD,	// first word of the value, up to 'len' characters
+	QC_SYSINFO_LINE,	// remainder of the line, up to 'len' characters
+	QC_SYSINFO_MODEL,	// model capacity and model
+	QC_SYSINFO_PS_MTID	// limit to apply to the thread counts
+};
+
+struct qc_sysinfo_attr {
+	const char		*key;	// keyword preceding the colon
+	int			 key_len;
+	enum qc_attr_id		 id;
+	enum qc_sysinfo_fmt	 fmt;
+	int			 len;	// max length of string values
+};
+
+#define QC_SYSINFO_KEY(key)	key, sizeof(key) - 1
+
+static const struct qc_sysinfo_attr qc_sysinfo_cec_attrs[] = {
+	{QC_SYSINFO_KEY("Manufacturer"), qc_manufacturer, QC_SYSINFO_WORD, 16},
+	{QC_SYSINFO_KEY("Type"), qc_type, QC_SYSINFO_WORD, 4},
+	{QC_SYSINFO_KEY("LIC Identifier"), qc_lic_identifier, QC_SYSINFO_WORD, 16},
+	{QC_SYSINFO_KEY("Model"), qc_model_capacity, QC_SYSINFO_MODEL, 16},
+	{QC_SYSINFO_KEY("Sequence Code"), qc_sequence_code, QC_SYSINFO_WORD, 16},
+	{QC_SYSINFO_KEY("Plant"), qc_plant, QC_SYSINFO_WORD, 4},
+	{QC_SYSINFO_KEY("Capacity Adj. Ind."), qc_capacity_adjustment_indication, QC_SYSINFO_INT, 0},
+	{QC_SYSINFO_KEY("Capacity Ch. Reason"), qc_capacity_change_reason, QC_SYSINFO_INT, 0},
+	{QC_SYSINFO_KEY("CPUs Total"), qc_num_core_total, QC_SYSINFO_INT, 0},
+	{QC_SYSINFO_KEY("CPUs Configured"), qc_num_core_configured, QC_SYSINFO_INT, 0},
+	{QC_SYSINFO_KEY("CPUs Standby"), qc_num_core_standby, QC_SYSINFO_INT, 0},
+	{QC_SYSINFO_KEY("CPUs Reserved"), qc_num_core_reserved, QC_SYSINFO_INT, 0},
+	{QC_SYSINFO_KEY("CPUs G-MTID"), qc_num_cp_threads, QC_SYSINFO_THREADS, 0},
+	{QC_SYSINFO_KEY("CPUs S-MTID"), qc_num_ifl_threads, QC_SYSINFO_THREADS, 0},
+	{QC_SYSINFO_KEY("Capability"), qc_capability, QC_SYSINFO_FLOAT, 0},
+	{QC_SYSINFO_KEY("Secondary Capability"), qc_secondary_capability, QC_SYSINFO_FLOAT, 0},
+	{NULL, 0, 0, 0, 0}
+};
+
+static const struct qc_sysinfo_attr qc_sysinfo_lpar_attrs[] = {
+	{QC_SYSINFO_KEY("LPAR Number"), qc_partition_number, QC_SYSINFO_INT, 0},
+	{QC_SYSINFO_KEY("LPAR Characteristics"), qc_partition_char, QC_SYSINFO_LINE, 25},
+	{QC_SYSINFO_KEY("LPAR Name"), qc_layer_name, QC_SYSINFO_WORD, 8},
+	{QC_SYSINFO_KEY("LPAR Adjustment"), qc_adjustment, QC_SYSINFO_INT, 0},
+	{QC_SYSINFO_KEY("LPAR CPUs Total"), qc_num_core_total, QC_SYSINFO_INT, 0},
+	{QC_SYSINFO_KEY("LPAR CPUs Configured"), qc_num_core_configured, QC_SYSINFO_INT, 0},
+	{QC_SYSINFO_KEY("LPAR CPUs Standby"), qc_num_core_standby, QC_SYSINFO_INT, 0},
+	{QC_SYSINFO_KEY("LPAR CPUs Reserved"), qc_num_core_reserved, QC_SYSINFO_INT, 0},
+	{QC_SYSINFO_KEY("LPAR CPUs Dedicated"), qc_num_core_dedicated, QC_SYSINFO_INT, 0},
+	{QC_SYSINFO_KEY("LPAR CPUs Shared"), qc_num_core_shared, QC_SYSINFO_INT, 0},
+	{QC_SYSINFO_KEY("LPAR CPUs G-MTID"), qc_num_cp_threads, QC_SYSINFO_THREADS, 0},
+	{QC_SYSINFO_KEY("LPAR CPUs S-MTID"), qc_num_ifl_threads, QC_SYSINFO_THREADS, 0},
+	{QC_SYSINFO_KEY("LPAR CPUs PS-MTID"), qc_num_cp_threads, QC_SYSINFO_PS_MTID, 0},
+	{QC_SYSINFO_KEY("LPAR Extended Name"), qc_layer_extended_name, QC_SYSINFO_LINE, 256},
+	{QC_SYSINFO_KEY("LPAR UUID"), qc_layer_uuid, QC_SYSINFO_WORD, 36},
+	{NULL, 0, 0, 0, 0}
+};
+
+// VM attributes, with the "VMxx " prefix stripped
+static const struct qc_sysinfo_attr qc_sysinfo_vm_host_attrs[] = {
+	{QC_SYSINFO_KEY("Adjustment"), qc_adjustment, QC_SYSINFO_INT, 0},
+	{NULL, 0, 0, 0, 0}
+};
+
+static const struct qc_sysinfo_attr qc_sysinfo_vm_guest_attrs[] = {
+	{QC_SYSINFO_KEY("CPUs Total"), qc_num_cpu_total, QC_SYSINFO_INT, 0},
+	{QC_SYSINFO_KEY("CPUs Configured"), qc_num_cpu_configured, QC_SYSINFO_INT, 0},
+	{QC_SYSINFO_KEY("CPUs Standby"), qc_num_cpu_standby, QC_SYSINFO_INT, 0},
+	{QC_SYSINFO_KEY("CPUs Reserved"), qc_num_cpu_reserved, QC_SYSINFO_INT, 0},
+	{NULL, 0, 0, 0, 0}
+};
+
+static const struct qc_sysinfo_attr qc_sysinfo_kvm_guest_attrs[] = {
+	{QC_SYSINFO_KEY("Extended Name"), qc_layer_extended_name, QC_SYSINFO_LINE, 256},
+	{QC_SYSINFO_KEY("UUID"), qc_layer_uuid, QC_SYSINFO_WORD, 36},
+	{NULL, 0, 0, 0, 0}
+};
+
+// Returns the next non-empty line following 'line', or NULL if there is none
+static const char *qc_sysinfo_next_line(const char *line) {
+	if ((line = strchr(line, '\n')) == NULL)
+		return NULL;
+	while (*line == '\n')
+		line++;
+
+	return *line ? line : NULL;
+}
 
-	if ((rc = strdup(sysinfo)) == NULL)
-		qc_debug(hdl, "Error: Failed to create copy of qc_sysconfig\n");
+static const char *qc_sysinfo_skip_blanks(const char *p, const char *eol) {
+	while (p < eol && (*p == ' ' || *p == '\t'))
+		p++;
 
-	return rc;
+	return p;
 }
 
-#define QC_SYSINFO_PARSE_LINE_STR_NOCONT(hdl, str, strlen, id) \
-	if (sscanf(*line, str, str_buf) > 0 && qc_set_attr_string(hdl, id, str_buf, ATTR_SRC_SYSINFO)) \
-		goto out_err;
-#define QC_SYSINFO_PARSE_LINE_STR(hdl, str, strlen, id) \
-	if (sscanf(*line, str, str_buf) > 0) { \
-		if (qc_set_attr_string(hdl, id, str_buf, ATTR_SRC_SYSINFO)) \
-			goto out_err; \
-		continue; \
-	}
-#define QC_SYSINFO_PARSE_LINE_INT_inc(hdl, str, id, inc) \
-	if (sscanf(*line, str, &int_buf) > 0) { \
-		if (qc_set_attr_int(hdl, id, int_buf + inc, ATTR_SRC_SYSINFO)) \
-			goto out_err; \
-		continue; \
+// Looks up the keyword of 'line' in 'attrs', pointing 'val' past the colon
+static const struct qc_sysinfo_attr *qc_sysinfo_lookup(const struct qc_sysinfo_attr *attrs,
+						       const char *line, const char *eol, const char **val) {
+	const char *colon;
+	int key_len;
+
+	if ((colon = memchr(line, ':', eol - line)) == NULL)
+		return NULL;
+	key_len = colon - line;
+	for (; attrs->key; attrs++) {
+		if (attrs->key_len == key_len && !memcmp(attrs->key, line, key_len)) {
+			*val = colon + 1;
+			return attrs;
+		}
 	}
-#define QC_SYSINFO_PARSE_LINE_INT(hdl, str, id) QC_SYSINFO_PARSE_LINE_INT_inc(hdl, str, id, 0)
-#define QC_SYSINFO_PARSE_LINE_FLOAT(hdl, str, id) \
-	if (sscanf(*line, str, &float_buf)) { \
-		if (qc_set_attr_float(hdl, id, float_buf, ATTR_SRC_SYSINFO)) \
-			goto out_err; \
-		continue; \
+
+	return NULL;
+}
+
+static int qc_sysinfo_get_int(const char *val, const char *eol, int *i) {
+	char *end;
+	long l;
+
+	val = qc_sysinfo_skip_blanks(val, eol);
+	if (val == eol)
+		return -1;
+	l = strtol(val, &end, 0);
+	if (end == val)
+		return -1;
+	*i = (int)l;
+
+	return 0;
+}
+
+static int qc_sysinfo_get_float(const char *val, const char *eol, float *f) {
+	char *end;
+
+	val = qc_sysinfo_skip_blanks(val, eol);
+	if (val == eol)
+		return -1;
+	*f = strtof(val, &end);
+
+	return end == val ? -1 : 0;
+}
+
+// Copies the first word of 'val' (up to 'len' characters) to 'buf', returns ptr past the word
+static const char *qc_sysinfo_get_word(const char *val, const char *eol, char *buf, int len) {
+	int i;
+
+	val = qc_sysinfo_skip_blanks(val, eol);
+	for (i = 0; val < eol && *val != ' ' && *val != '\t'; val++)
+		if (i < len)
+			buf[i++] = *val;
+	buf[i] = '\0';
+
+	return val;
+}
+
+// Copies the remainder of the line (up to 'len' characters) to 'buf'
+static void qc_sysinfo_get_line(const char *val, const char *eol, char *buf, int len) {
+	int i;
+
+	val = qc_sysinfo_skip_blanks(val, eol);
+	for (i = 0; val < eol && i < len; val++, i++)
+		buf[i] = *val;
+	buf[i] = '\0';
+}
+
+// Sets the attribute as described by 'attr' from value 'val'. Attributes without a value are skipped.
+static int qc_sysinfo_set_attr(struct qc_handle *hdl, const struct qc_sysinfo_attr *attr,
+			       const char *val, const char *eol) {
+	char str_buf[STR_BUF_SIZE];
+	float float_buf;
+	int int_buf;
+
+	switch (attr->fmt) {
+	case QC_SYSINFO_INT:
+	case QC_SYSINFO_THREADS:
+		if (qc_sysinfo_get_int(val, eol, &int_buf))
+			return 0;
+		if (attr->fmt == QC_SYSINFO_THREADS)
+			int_buf++;
+		return qc_set_attr_int(hdl, attr->id, int_buf, ATTR_SRC_SYSINFO);
+	case QC_SYSINFO_FLOAT:
+		if (qc_sysinfo_get_float(val, eol, &float_buf))
+			return 0;
+		return qc_set_attr_float(hdl, attr->id, float_buf, ATTR_SRC_SYSINFO);
+	case QC_SYSINFO_WORD:
+		qc_sysinfo_get_word(val, eol, str_buf, attr->len);
+		break;
+	case QC_SYSINFO_LINE:
+		qc_sysinfo_get_line(val, eol, str_buf, attr->len);
+		break;
+	case QC_SYSINFO_MODEL:
+		val = qc_sysinfo_get_word(val, eol, str_buf, attr->len);
+		if (*str_buf && qc_set_attr_string(hdl, qc_model_capacity, str_buf, ATTR_SRC_SYSINFO))
+			return -1;
+		qc_sysinfo_get_word(val, eol, str_buf, attr->len);
+		if (*str_buf && qc_set_attr_string(hdl, qc_model, str_buf, ATTR_SRC_SYSINFO))
+			return -1;
+		return 0;
+	default:
+		return 0;
 	}
-static int qc_fill_in_sysinfo_values_vm(struct qc_handle *hdl, char **sptr, char **line) {
+	if (*str_buf && qc_set_attr_string(hdl, attr->id, str_buf, ATTR_SRC_SYSINFO))
+		return -1;
+
+	return 0;
+}
+
+static int qc_fill_in_sysinfo_values_vm(struct qc_handle *hdl, const char **line) {
 	char str_buf[STR_BUF_SIZE], layer_name[STR_BUF_SIZE];
 	struct qc_handle *guesthdl = NULL, *hosthdl = NULL;
-	int i, j, rc = -1, int_buf, guesttype, hosttype;
+	const struct qc_sysinfo_attr *attr;
+	int i, j, rc = -1, guesttype, hosttype;
+	const char *eol, *val;
 	char vmxx[] = "VMxx ";
-	char c, *sysi = NULL;
+	char c;
 
 	qc_debug(hdl, "Retrieve /proc/sysinfo information for VM\n");
 	qc_debug_indent_inc();
@@ -184,30 +454,25 @@ static int qc_fill_in_sysinfo_values_vm(struct qc_handle *hdl, char **sptr, char
 		for (j = 2, c = '0' + i/10; j <= 3; ++j, c = '0' + i%10)
 			vmxx[j] = c;
 		// Parse file till we find control program ID and name (which precedes)
-		// Note: strtok_r will skip empty lines - hence we can't start out reading the next line
-		//       start of the loop, or we'd skip a line when looping in the big loop
 		layer_name[0] = '\0';
-		do {
+		str_buf[0] = '\0';
+		for (; *line; *line = qc_sysinfo_next_line(*line)) {
 			if (strncmp(*line, vmxx, 5) != 0)
 				continue;	// fast-forward till eof
-			*line += 5;
-			sysi = NULL;
-			// Note: %x[^\n] can create trailing blanks, but unavoidable, since some names *can* contain blanks
-			if (layer_name[0] == '\0' && (rc = sscanf(*line, "Name: %8[^\n]", layer_name))) {
-				if (rc < 0)
-					break;
-			}
-			if ((rc = sscanf(*line, "Control Program: %16[^\001]s", str_buf)) > 0)
+			eol = strchrnul(*line, '\n');
+			val = *line + 5;
+			// Note: Names can contain blanks, trailing blanks are removed when setting the attribute
+			if (layer_name[0] == '\0' && !strncmp(val, "Name:", 5))
+				qc_sysinfo_get_line(val + 5, eol, layer_name, 8);
+			if (!strncmp(val, "Control Program:", 16)) {
+				qc_sysinfo_get_line(val + 16, eol, str_buf, 16);
 				break;
-		} while (!rc && (*line = strtok_r(sysi, qc_sysinfo_delim, sptr)) != NULL);
+			}
+		}
 		if (!*line) {	// end of file reached, but no VM layers found
 			rc = 0;
 			goto out;
 		}
-		if (!rc) {
-			qc_debug(hdl, "Error: Failed to retrieve CP ID from /proc/sysinfo\n");
-			goto out;
-		}
 		rc = -2;
 		if (!strncmp(str_buf, "z/VM", strlen("z/VM"))) {
 			hosttype = QC_LAYER_TYPE_ZVM_HYPERVISOR;
@@ -241,23 +506,20 @@ static int qc_fill_in_sysinfo_values_vm(struct qc_handle *hdl, char **sptr, char
 		if (qc_set_attr_string(hosthdl, qc_control_program_id, str_buf, ATTR_SRC_SYSINFO) ||
 		    qc_set_attr_string(guesthdl, qc_layer_name, layer_name, ATTR_SRC_SYSINFO))
 			goto out_err;
-		for (sysi = NULL, *line = strtok_r(sysi, qc_sysinfo_delim, sptr); *line;
-		     *line = strtok_r(sysi, qc_sysinfo_delim, sptr)) {
+		for (*line = qc_sysinfo_next_line(*line); *line; *line = qc_sysinfo_next_line(*line)) {
 			if (strncmp(*line, vmxx, 4) != 0)
 				break;
-			*line += 5;
-			sysi = NULL;
-			QC_SYSINFO_PARSE_LINE_INT(hosthdl, "Adjustment: %i", qc_adjustment);
-			if (strncmp(*line, "CPUs ", 5) == 0) {
-				*line += 5;
-				QC_SYSINFO_PARSE_LINE_INT(guesthdl, "Total: %i", qc_num_cpu_total);
-				QC_SYSINFO_PARSE_LINE_INT(guesthdl, "Configured: %i", qc_num_cpu_configured);
-				QC_SYSINFO_PARSE_LINE_INT(guesthdl, "Standby: %i", qc_num_cpu_standby);
-				QC_SYSINFO_PARSE_LINE_INT(guesthdl, "Reserved: %i", qc_num_cpu_reserved);
-			}
-			if (guesttype == QC_LAYER_TYPE_KVM_GUEST) {
-				QC_SYSINFO_PARSE_LINE_STR(guesthdl, "Extended Name: %256[^\n]", 256, qc_layer_extended_name);
-				QC_SYSINFO_PARSE_LINE_STR(guesthdl, "UUID: %36s", 36, qc_layer_uuid);
+			eol = strchrnul(*line, '\n');
+			if (eol - *line < 5)
+				continue;	// too short to hold an attribute, e.g. "VM00\n"
+			if ((attr = qc_sysinfo_lookup(qc_sysinfo_vm_host_attrs, *line + 5, eol, &val)) != NULL) {
+				if (qc_sysinfo_set_attr(hosthdl, attr, val, eol))
+					goto out_err;
+			} else if ((attr = qc_sysinfo_lookup(qc_sysinfo_vm_guest_attrs, *line + 5, eol, &val)) != NULL ||
+				   (guesttype == QC_LAYER_TYPE_KVM_GUEST &&
+				    (attr = qc_sysinfo_lookup(qc_sysinfo_kvm_guest_attrs, *line + 5, eol, &val)) != NULL)) {
+				if (qc_sysinfo_set_attr(guesthdl, attr, val, eol))
+					goto out_err;
 			}
 		}
 	}
@@ -313,36 +575,24 @@ out:
 	return rc;
 }
 
-static int qc_fill_in_sysinfo_values_lpar(struct qc_handle *hdl, char **sptr, char **line) {
-	char *sysi = NULL, str_buf[STR_BUF_SIZE];	// large enough for all sscanf() calls by far
+static int qc_fill_in_sysinfo_values_lpar(struct qc_handle *hdl, const char **line) {
+	const struct qc_sysinfo_attr *attr;
 	int int_buf, rc = -1, ps_mtid = -1, *i;
+	const char *eol, *val;
 
 	qc_debug(hdl, "Retrieve /proc/sysinfo information for LPAR\n");
 	qc_debug_indent_inc();
-	for (; *line && strncmp(*line, "VM", 2); *line = strtok_r(sysi, qc_sysinfo_delim, sptr)) {
-		sysi = NULL;
-		if (strncmp(*line, "LPAR ", 5) != 0)
+	for (; *line && strncmp(*line, "VM", 2); *line = qc_sysinfo_next_line(*line)) {
+		eol = strchrnul(*line, '\n');
+		if ((attr = qc_sysinfo_lookup(qc_sysinfo_lpar_attrs, *line, eol, &val)) == NULL)
 			continue;
-		*line += 5;
-		QC_SYSINFO_PARSE_LINE_INT(hdl, "Number: %i", qc_partition_number);
-		QC_SYSINFO_PARSE_LINE_STR(hdl, "Characteristics: %25[^\n]s", 25, qc_partition_char);
-		QC_SYSINFO_PARSE_LINE_STR(hdl, "Name: %8s", 8, qc_layer_name);
-		QC_SYSINFO_PARSE_LINE_INT(hdl, "Adjustment: %i", qc_adjustment);
-		if (strncmp(*line, "CPUs ", 5) == 0) {
-			*line += 5;
-			QC_SYSINFO_PARSE_LINE_INT(hdl, "Total: %i", qc_num_core_total);
-			QC_SYSINFO_PARSE_LINE_INT(hdl, "Configured: %i", qc_num_core_configured);
-			QC_SYSINFO_PARSE_LINE_INT(hdl, "Standby: %i", qc_num_core_standby);
-			QC_SYSINFO_PARSE_LINE_INT(hdl, "Reserved: %i", qc_num_core_reserved);
-			QC_SYSINFO_PARSE_LINE_INT(hdl, "Dedicated: %i", qc_num_core_dedicated);
-			QC_SYSINFO_PARSE_LINE_INT(hdl, "Shared: %i", qc_num_core_shared);
-			QC_SYSINFO_PARSE_LINE_INT_inc(hdl, "G-MTID: %i", qc_num_cp_threads, 1);
-			QC_SYSINFO_PARSE_LINE_INT_inc(hdl, "S-MTID: %i", qc_num_ifl_threads, 1);
-			if (sscanf(*line, "PS-MTID: %i", &int_buf) > 0)
+		if (attr->fmt == QC_SYSINFO_PS_MTID) {
+			if (!qc_sysinfo_get_int(val, eol, &int_buf))
 				ps_mtid = int_buf + 1;
+			continue;
 		}
-		QC_SYSINFO_PARSE_LINE_STR(hdl, "Extended Name: %256[^\n]", 256, qc_layer_extended_name);
-		QC_SYSINFO_PARSE_LINE_STR(hdl, "UUID: %36s", 36, qc_layer_uuid);
+		if (qc_sysinfo_set_attr(hdl, attr, val, eol))
+			goto out_err;
 	}
 	rc = qc_derive_part_char_num(hdl);
 	// Apply threshold provided by ps_mtid if set
@@ -364,10 +614,10 @@ out:
 	return rc;
 }
 
-static int qc_fill_in_sysinfo_values_cec(struct qc_handle *hdl, char **sptr, char **line) {
-	char *sysi = NULL, str_buf[STR_BUF_SIZE];	// large enough for all sscanf() calls by far
-	int int_buf, rc = -1;
-	float float_buf;
+static int qc_fill_in_sysinfo_values_cec(struct qc_handle *hdl, const char **line) {
+	const struct qc_sysinfo_attr *attr;
+	const char *eol, *val;
+	int rc = -1;
 
 	qc_debug(hdl, "Retrieve /proc/sysinfo information for CEC\n");
 	qc_debug_indent_inc();
@@ -376,37 +626,12 @@ static int qc_fill_in_sysinfo_values_cec(struct qc_handle *hdl, char **sptr, cha
 	    qc_set_attr_string(hdl, qc_layer_type, "CEC", ATTR_SRC_SYSINFO) ||
 	    qc_set_attr_string(hdl, qc_layer_category, "HOST", ATTR_SRC_SYSINFO))
 		goto out;
-	for (; *line && strncmp(*line, "LPAR", 4); *line = strtok_r(sysi, qc_sysinfo_delim, sptr)) {
-		sysi = NULL;
-		if (strncmp(*line, "Adj", 3) == 0)
-			continue;	// Lots of "Adjustment" lines that we can skip
-		QC_SYSINFO_PARSE_LINE_STR(hdl, "Manufacturer: %16s", 16, qc_manufacturer);
-		QC_SYSINFO_PARSE_LINE_STR(hdl, "Type: %4s", 4, qc_type);
-		QC_SYSINFO_PARSE_LINE_STR(hdl, "LIC Identifier: %16s", 16, qc_lic_identifier);
-		if (strncmp(*line, "Model: ", 7) == 0) {
-			*line += 7;
-			QC_SYSINFO_PARSE_LINE_STR_NOCONT(hdl, "%16s", 16, qc_model_capacity);
-			QC_SYSINFO_PARSE_LINE_STR_NOCONT(hdl, "%*s %16s", 16, qc_model);
+	for (; *line && strncmp(*line, "LPAR", 4); *line = qc_sysinfo_next_line(*line)) {
+		eol = strchrnul(*line, '\n');
+		if ((attr = qc_sysinfo_lookup(qc_sysinfo_cec_attrs, *line, eol, &val)) == NULL)
 			continue;
-		}
-		QC_SYSINFO_PARSE_LINE_STR(hdl, "Sequence Code: %16s", 16, qc_sequence_code);
-		QC_SYSINFO_PARSE_LINE_STR(hdl, "Plant: %4s", 4, qc_plant);
-		if (strncmp(*line, "Capacity ", 9) == 0) {
-			*line += 9;
-			QC_SYSINFO_PARSE_LINE_INT(hdl, "Adj. Ind.: %i", qc_capacity_adjustment_indication);
-			QC_SYSINFO_PARSE_LINE_INT(hdl, "Ch. Reason: %i", qc_capacity_change_reason);
-		}
-		if (strncmp(*line, "CPUs ", 5) == 0) {
-			*line += 5;
-			QC_SYSINFO_PARSE_LINE_INT(hdl, "Total: %i", qc_num_core_total);
-			QC_SYSINFO_PARSE_LINE_INT(hdl, "Configured: %i", qc_num_core_configured);
-			QC_SYSINFO_PARSE_LINE_INT(hdl, "Standby: %i", qc_num_core_standby);
-			QC_SYSINFO_PARSE_LINE_INT(hdl, "Reserved: %i", qc_num_core_reserved);
-			QC_SYSINFO_PARSE_LINE_INT_inc(hdl, "G-MTID: %i", qc_num_cp_threads, 1);
-			QC_SYSINFO_PARSE_LINE_INT_inc(hdl, "S-MTID: %i", qc_num_ifl_threads, 1);
-		}
-		QC_SYSINFO_PARSE_LINE_FLOAT(hdl, "Capability: %f", qc_capability);
-		QC_SYSINFO_PARSE_LINE_FLOAT(hdl, "Secondary Capability: %f", qc_secondary_capability);
+		if (qc_sysinfo_set_attr(hdl, attr, val, eol))
+			goto out_err;
 	}
 	rc = 0;
 	goto out;
@@ -419,9 +644,10 @@ out:
 	return rc;
 }
 
-static int qc_sysinfo_process(struct qc_handle *hdl, char *sysinfo) {
+static int qc_sysinfo_process(struct qc_handle *hdl, char *priv) {
+	char *sysinfo = priv ? ((struct sysinfo_priv *)priv)->data : NULL;
 	struct qc_handle *lparhdl = qc_hdl_get_lpar(hdl);
-	char *sysi = NULL, *start, *sptr, *line;
+	const char *line;
 	int rc = -1;
 
 	fflush(stdout);
@@ -431,21 +657,19 @@ static int qc_sysinfo_process(struct qc_handle *hdl, char *sysinfo) {
 		qc_debug(hdl, "qc_sysinfo_process() called with priv==NULL\n");
 		goto out;
 	}
-	// create a global copy which is parsed in one go across the functions. Therefore, pass on
-	// the strtok() saveptr and the last line parsed
-	if ((start = sysi = qc_copy_sysinfo(hdl, sysinfo)) == NULL)
-		goto out;
-	line = strtok_r(sysi, qc_sysinfo_delim, &sptr);
-	if (qc_fill_in_sysinfo_values_cec(hdl, &sptr, &line))
+	// sysinfo is parsed in one go across the functions, hence pass on the current line
+	for (line = sysinfo; *line == '\n'; line++);
+	if (!*line)
+		line = NULL;
+	if (qc_fill_in_sysinfo_values_cec(hdl, &line))
 		goto out;
-	if (qc_fill_in_sysinfo_values_lpar(lparhdl, &sptr, &line))
+	if (qc_fill_in_sysinfo_values_lpar(lparhdl, &line))
 		goto out;
-	if (line && qc_fill_in_sysinfo_values_vm(lparhdl, &sptr, &line))
+	if (line && qc_fill_in_sysinfo_values_vm(lparhdl, &line))
 		goto out;
 	rc = 0;
 
 out:
-	free(sysi);
 	qc_debug_indent_dec();
 
 	return rc;
@@ -455,5 +679,4 @@ struct qc_data_src sysinfo = {qc_sysinfo_open,
 			      qc_sysinfo_process,
 			      qc_sysinfo_dump,
 			      qc_sysinfo_close,
-			      qc_sysinfo_lgm_check,
-			      NULL};
+			      qc_sysinfo_lgm_check};
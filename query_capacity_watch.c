@@ -0,0 +1,157 @@
+/* Copyright IBM Corp. 2020 */
+
+#include <pthread.h>
+
+#include "query_capacity_int.h"
+
+
+/*
+ * A watcher refreshes its handle on a thread of its own. Since the handle is
+ * never exposed other than to the callback, which runs on the same thread,
+ * no further locking of the handle is required. 'lock' and 'cond' merely
+ * serve to interrupt the wait between refreshes when stopping.
+ * Running watchers are kept in 'qc_watches', so we can tell valid watchers
+ * from stale or bogus pointers passed to qc_watch_stop().
+ */
+struct qc_watch {
+	struct qc_watch	   *next;	// in 'qc_watches'
+	struct qc_handle   *hdl;
+	void		   *token;	// handle as passed to 'cb'
+	int		    interval;	// in milliseconds
+	int		    flags;	// see enum qc_refresh_flags
+	enum qc_attr_id	   *ids;	// attributes to report, or NULL for all
+	int		    num_ids;
+	qc_watch_cb	    cb;
+	void		   *data;	// passed to 'cb'
+	pthread_t	    thread;
+	pthread_mutex_t	    lock;
+	pthread_cond_t	    cond;	// signaled when 'stop' is set
+	int		    stop;
+};
+
+static struct qc_watch *qc_watches;
+static pthread_mutex_t qc_watches_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Waits for the next interval. Returns 1 if the watcher is to be stopped, 0 otherwise
+static int qc_watch_wait(struct qc_watch *watch) {
+	struct timespec ts;
+	int stop;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += watch->interval / 1000;
+	ts.tv_nsec += (watch->interval % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	pthread_mutex_lock(&watch->lock);
+	while (!watch->stop && pthread_cond_timedwait(&watch->cond, &watch->lock, &ts) != ETIMEDOUT)
+		;
+	stop = watch->stop;
+	pthread_mutex_unlock(&watch->lock);
+
+	return stop;
+}
+
+static void *qc_watch_run(void *arg) {
+	struct qc_watch *watch = arg;
+	struct qc_handle *hdl = watch->hdl, *saved;
+	struct qc_attr_change *changes;
+	int rc, changed, num;
+
+	while (!qc_watch_wait(watch)) {
+		rc = qc_refresh_hdl(hdl, watch->flags, &changed, &saved);
+		if (rc) {
+			qc_debug(hdl, "Watcher failed to refresh data, rc=%d, retrying in next interval\n", rc);
+			continue;
+		}
+		if (changed && qc_hdl_get_changes(hdl, saved, watch->ids, watch->num_ids, &changes, &num) == 0) {
+			if (num)
+				watch->cb(watch->token, changes, num, watch->data);
+			free(changes);
+		}
+		qc_hdl_release(hdl, saved);
+	}
+
+	return NULL;
+}
+
+int qc_watch_create(struct qc_watch **watch, struct qc_handle *hdl, void *token, int interval, int flags,
+		    const enum qc_attr_id *ids, int num_ids, qc_watch_cb cb, void *data) {
+	pthread_condattr_t attr;
+	struct qc_watch *w;
+	int rc = 0;
+
+	*watch = NULL;
+	if ((w = calloc(1, sizeof(struct qc_watch))) == NULL) {
+		qc_debug(hdl, "Error: Failed to allocate watcher\n");
+		return -ENOMEM;
+	}
+	w->hdl = hdl;
+	w->token = token;
+	w->interval = interval;
+	w->flags = flags;
+	w->cb = cb;
+	w->data = data;
+	if (ids) {
+		if ((w->ids = malloc(num_ids * sizeof(enum qc_attr_id))) == NULL) {
+			qc_debug(hdl, "Error: Failed to allocate attribute ids\n");
+			free(w);
+			return -ENOMEM;
+		}
+		memcpy(w->ids, ids, num_ids * sizeof(enum qc_attr_id));
+		w->num_ids = num_ids;
+	}
+	pthread_mutex_init(&w->lock, NULL);
+	// measure intervals independent of changes to the system time
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&w->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	if ((rc = pthread_create(&w->thread, NULL, qc_watch_run, w)) != 0) {
+		qc_debug(hdl, "Error: Failed to create watcher thread: %s\n", strerror(rc));
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->lock);
+		free(w->ids);
+		free(w);
+		return -rc;
+	}
+	pthread_mutex_lock(&qc_watches_lock);
+	w->next = qc_watches;
+	qc_watches = w;
+	pthread_mutex_unlock(&qc_watches_lock);
+	*watch = w;
+
+	return 0;
+}
+
+void *qc_watch_destroy(struct qc_watch *watch) {
+	struct qc_watch **w;
+	int found = 0;
+	void *token;
+
+	// remove first, so only one caller gets to destroy the watcher
+	pthread_mutex_lock(&qc_watches_lock);
+	for (w = &qc_watches; *w != NULL; w = &(*w)->next) {
+		if (*w == watch) {
+			*w = watch->next;
+			found = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&qc_watches_lock);
+	if (!found)
+		return NULL;
+	token = watch->token;
+	pthread_mutex_lock(&watch->lock);
+	watch->stop = 1;
+	pthread_cond_signal(&watch->cond);
+	pthread_mutex_unlock(&watch->lock);
+	pthread_join(watch->thread, NULL);
+	pthread_cond_destroy(&watch->cond);
+	pthread_mutex_destroy(&watch->lock);
+	free(watch->ids);
+	free(watch);
+
+	return token;
+}
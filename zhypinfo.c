@@ -1,7 +1,42 @@
 /* Copyright IBM Corp. 2020 */
 
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
 #include "zhypinfo.h"
 
+#define DEFAULT_INTERVAL	1	// seconds between refreshes in watch mode
+
+// Attributes that constitute the table, and are thus watched for changes
+static const struct {
+	enum qc_attr_id	 id;
+	const char	*name;
+} watch_attrs[] = {
+	{ qc_layer_type_num,		"layer_type_num" },
+	{ qc_layer_category_num,	"layer_category_num" },
+	{ qc_layer_type,		"layer_type" },
+	{ qc_layer_category,		"layer_category" },
+	{ qc_layer_name,		"layer_name" },
+	{ qc_num_cpu_total,		"num_cpu_total" },
+	{ qc_num_cp_total,		"num_cp_total" },
+	{ qc_num_ifl_total,		"num_ifl_total" },
+	{ qc_num_ziip_total,		"num_ziip_total" },
+	{ qc_num_core_total,		"num_core_total" },
+	{ qc_num_core_dedicated,	"num_core_dedicated" },
+	{ qc_num_core_shared,		"num_core_shared" },
+	{ qc_cp_absolute_capping,	"cp_absolute_capping" },
+	{ qc_ifl_absolute_capping,	"ifl_absolute_capping" },
+	{ qc_cp_capped_capacity,	"cp_capped_capacity" },
+	{ qc_ifl_capped_capacity,	"ifl_capped_capacity" },
+	{ qc_ziip_capped_capacity,	"ziip_capped_capacity" },
+};
+#define NUM_WATCH_ATTRS		(sizeof(watch_attrs) / sizeof(watch_attrs[0]))
+
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;	// serializes output in watch mode
+static int num_rows;	// number of rows of the table printed last
+
 static int get_max_level(void *hdl, int layers) {
 	int lvl = 0, cat;
 
@@ -70,10 +105,100 @@ static void print_cpu_counts(void *hdl, int layer, int id_ifl, int id_cp, int id
 	print_CPU(total);
 }
 
-static int print_layers(void *hdl, int print_lvls, int print_lays) {
-	int rc, layer, lvl, ifl, cp, type_num, total, cat;
+static void print_header() {
+	printf("  #  Layer_Type                  Lvl  Categ  Name       IFLs    CPs  Total\n");
+	printf("--------------------------------------------------------------------------\n");
+}
+
+// Print the row of 'layer', omitting the trailing newline
+static int print_row(void *hdl, int layer) {
+	int lvl, ifl, cp, type_num, total;
 	const char *layer_type, *name, *type;
 
+	lvl = get_max_level(hdl, layer);
+	if (lvl < 0 ||
+	    qc_get_attribute_string(hdl, qc_layer_type, layer, &layer_type) < 0 ||
+	    qc_get_attribute_string(hdl, qc_layer_category, layer, &type) < 0 ||
+	    qc_get_attribute_string(hdl, qc_layer_name, layer, &name) < 0 ||
+	    qc_get_attribute_int(hdl, qc_layer_type_num, layer, &type_num) < 0)
+		return -1;
+
+	printf("%3d  %-26s  %3d  %-5s  %-8s", layer, layer_type, lvl, type, name ? name : "   -");
+	// some layers don't have all CPU types or are very special
+	switch (type_num) {
+		case QC_LAYER_TYPE_LPAR_GROUP:
+			print_pool_cpu_counts(hdl, layer, qc_cp_absolute_capping, qc_ifl_absolute_capping);
+			break;
+		case QC_LAYER_TYPE_ZOS_TENANT_RESOURCE_GROUP:
+			print_pool_cpu_counts(hdl, layer, qc_cp_capped_capacity, qc_ziip_capped_capacity);
+			break;
+		case QC_LAYER_TYPE_ZVM_RESOURCE_POOL:
+			print_pool_cpu_counts(hdl, layer, qc_cp_capped_capacity, qc_ifl_capped_capacity);
+			break;
+		case QC_LAYER_TYPE_CEC:
+			// Getting the total is a bit more complicated
+			total = -1;
+			if (qc_get_attribute_int(hdl, qc_num_core_dedicated, layer, &ifl) > 0 &&
+			    qc_get_attribute_int(hdl, qc_num_core_shared, layer, &cp) > 0)
+				total = ifl + cp;
+			if (qc_get_attribute_int(hdl, qc_num_ifl_total, layer, &ifl) <= 0)
+				ifl = -1;
+			if (qc_get_attribute_int(hdl, qc_num_cp_total, layer, &cp) <= 0)
+				cp = -1;
+			print_CPU(ifl);
+			print_CPU(cp);
+			print_CPU(total);
+			break;
+		case QC_LAYER_TYPE_LPAR:
+			print_cpu_counts(hdl, layer, qc_num_ifl_total, qc_num_cp_total, -1);
+			break;
+		case QC_LAYER_TYPE_ZVM_HYPERVISOR:
+		case QC_LAYER_TYPE_KVM_HYPERVISOR:
+			print_cpu_counts(hdl, layer, qc_num_ifl_total, qc_num_cp_total, qc_num_core_total);
+			break;
+		case QC_LAYER_TYPE_KVM_GUEST:
+			if (qc_get_attribute_int(hdl, qc_num_ifl_total, layer, &ifl) <= 0)
+				ifl = -1;
+			print_CPU(ifl);
+			print_CPU(0);
+			print_CPU(ifl);
+			break;
+		case QC_LAYER_TYPE_ZOS_HYPERVISOR:
+			// we map zIIPs to IFLs for z/OS
+			print_cpu_counts(hdl, layer, qc_num_ziip_total, qc_num_cp_total, -1);
+			break;
+		case QC_LAYER_TYPE_ZOS_ZCX_SERVER:
+			// we map zIIPs to IFLs for z/OS
+			print_cpu_counts(hdl, layer, qc_num_ziip_total, qc_num_cp_total, -1);
+			break;
+		default:
+			print_cpu_counts(hdl, layer, qc_num_ifl_total, qc_num_cp_total, qc_num_cpu_total);
+			break;
+	}
+
+	return 0;
+}
+
+static int print_table(void *hdl) {
+	int rc, layer, layers;
+
+	layers = qc_get_num_layers(hdl, &rc);
+	if (rc)
+		return rc;
+	print_header();
+	for (layer = layers - 1; layer >= 0; layer--) {
+		if (print_row(hdl, layer))
+			return -1;
+		printf("\n");
+	}
+	num_rows = layers;
+
+	return 0;
+}
+
+static int print_layers(void *hdl, int print_lvls, int print_lays) {
+	int rc, layer, lvl;
+
 	layer = qc_get_num_layers(hdl, &rc) - 1;
 	if (rc)
 		return rc;
@@ -88,73 +213,124 @@ static int print_layers(void *hdl, int print_lvls, int print_lays) {
 		printf("%d\n", lvl + 1);
 		return 0;
 	}
-	printf("  #  Layer_Type                  Lvl  Categ  Name       IFLs    CPs  Total\n");
-	printf("--------------------------------------------------------------------------\n");
-	for (; layer >= 0; layer--) {
-		if (qc_get_attribute_string(hdl, qc_layer_type, layer, &layer_type) < 0 ||
-		    qc_get_attribute_string(hdl, qc_layer_category, layer, &type) < 0 ||
-		    qc_get_attribute_string(hdl, qc_layer_name, layer, &name) < 0 ||
-		    qc_get_attribute_int(hdl, qc_layer_category_num, layer, &cat) < 0 ||
-		    qc_get_attribute_int(hdl, qc_layer_type_num, layer, &type_num) < 0)
-			return -1;
 
-		printf("%3d  %-26s  %3d  %-5s  %-8s", layer, layer_type, lvl, type, name ? name : "   -");
-		// some layers don't have all CPU types or are very special
-		switch (type_num) {
-			case QC_LAYER_TYPE_LPAR_GROUP:
-				print_pool_cpu_counts(hdl, layer, qc_cp_absolute_capping, qc_ifl_absolute_capping);
-				break;
-			case QC_LAYER_TYPE_ZOS_TENANT_RESOURCE_GROUP:
-				print_pool_cpu_counts(hdl, layer, qc_cp_capped_capacity, qc_ziip_capped_capacity);
-				break;
-			case QC_LAYER_TYPE_ZVM_RESOURCE_POOL:
-				print_pool_cpu_counts(hdl, layer, qc_cp_capped_capacity, qc_ifl_capped_capacity);
-				break;
-			case QC_LAYER_TYPE_CEC:
-				// Getting the total is a bit more complicated
-				total = -1;
-				if (qc_get_attribute_int(hdl, qc_num_core_dedicated, layer, &ifl) > 0 &&
-				    qc_get_attribute_int(hdl, qc_num_core_shared, layer, &cp) > 0)
-					total = ifl + cp;
-				if (qc_get_attribute_int(hdl, qc_num_ifl_total, layer, &ifl) <= 0)
-					ifl = -1;
-				if (qc_get_attribute_int(hdl, qc_num_cp_total, layer, &cp) <= 0)
-					cp = -1;
-				print_CPU(ifl);
-				print_CPU(cp);
-				print_CPU(total);
-				break;
-			case QC_LAYER_TYPE_LPAR:
-				print_cpu_counts(hdl, layer, qc_num_ifl_total, qc_num_cp_total, -1);
-				break;
-			case QC_LAYER_TYPE_ZVM_HYPERVISOR:
-			case QC_LAYER_TYPE_KVM_HYPERVISOR:
-				print_cpu_counts(hdl, layer, qc_num_ifl_total, qc_num_cp_total, qc_num_core_total);
-				break;
-			case QC_LAYER_TYPE_KVM_GUEST:
-				if (qc_get_attribute_int(hdl, qc_num_ifl_total, layer, &ifl) <= 0)
-					ifl = -1;
-				print_CPU(ifl);
-				print_CPU(0);
-				print_CPU(ifl);
-				break;
-			case QC_LAYER_TYPE_ZOS_HYPERVISOR:
-				// we map zIIPs to IFLs for z/OS
-				print_cpu_counts(hdl, layer, qc_num_ziip_total, qc_num_cp_total, -1);
-				break;
-			case QC_LAYER_TYPE_ZOS_ZCX_SERVER:
-				// we map zIIPs to IFLs for z/OS
-				print_cpu_counts(hdl, layer, qc_num_ziip_total, qc_num_cp_total, -1);
-				break;
-			default:
-				print_cpu_counts(hdl, layer, qc_num_ifl_total, qc_num_cp_total, qc_num_cpu_total);
-				break;
-		}
+	return print_table(hdl);
+}
+
+static const char *attr_name(enum qc_attr_id id) {
+	unsigned int i;
+
+	for (i = 0; i < NUM_WATCH_ATTRS; i++)
+		if (watch_attrs[i].id == id)
+			return watch_attrs[i].name;
+
+	return "unknown";
+}
+
+static void print_value(enum qc_attr_type type, int set, const union qc_attr_value *value) {
+	if (!set)
+		printf("-");
+	else if (type == QC_ATTR_TYPE_INT)
+		printf("%d", value->i);
+	else if (type == QC_ATTR_TYPE_FLOAT)
+		printf("%f", value->f);
+	else
+		printf("'%s'", value->s);
+}
+
+// Print one line per change, prefixed by a timestamp
+static void print_changes(const struct qc_attr_change *changes, int num) {
+	char stamp[32];
+	struct tm tm;
+	time_t now;
+	int i;
+
+	now = time(NULL);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S%z", localtime_r(&now, &tm));
+	for (i = 0; i < num; i++) {
+		printf("%s layer=%d %s: ", stamp, changes[i].layer, attr_name(changes[i].id));
+		print_value(changes[i].type, changes[i].old_set, &changes[i].old_value);
+		printf(" -> ");
+		print_value(changes[i].type, changes[i].new_set, &changes[i].new_value);
 		printf("\n");
+	}
+}
 
-		if (cat == QC_LAYER_CAT_HOST)
-			lvl--;
+// Redraw the rows of all layers that changed, or the entire table if the layers changed
+static void redraw_table(void *hdl, const struct qc_attr_change *changes, int num) {
+	int i, rc, layers, lines, full = 0;
+
+	layers = qc_get_num_layers(hdl, &rc);
+	if (rc)
+		return;
+	full = !isatty(STDOUT_FILENO) || layers != num_rows;
+	for (i = 0; i < num && !full; i++) {
+		if (changes[i].id == qc_layer_type_num || changes[i].id == qc_layer_category_num)
+			full = 1;
 	}
+	if (full) {
+		if (isatty(STDOUT_FILENO))
+			printf("\033[%dA\033[J", num_rows + 2);	// move to the header and clear the screen below
+		else
+			printf("\n");
+		print_table(hdl);
+		return;
+	}
+	// rows are printed top-down, hence layer 'n' is n + 1 lines above the cursor
+	for (i = 0; i < num; i++) {
+		if (i > 0 && changes[i].layer == changes[i - 1].layer)
+			continue;
+		lines = changes[i].layer + 1;
+		printf("\033[%dA\r\033[K", lines);
+		print_row(hdl, changes[i].layer);
+		printf("\033[%dB\r", lines);
+	}
+}
+
+static void watch_cb(void *hdl, const struct qc_attr_change *changes, int num, void *data) {
+	pthread_mutex_lock(&out_lock);
+	if (*(int *)data)
+		print_changes(changes, num);
+	else
+		redraw_table(hdl, changes, num);
+	fflush(stdout);
+	pthread_mutex_unlock(&out_lock);
+}
+
+// Keep watching for changes until interrupted
+static int watch(void *hdl, double interval, int delta) {
+	enum qc_attr_id ids[NUM_WATCH_ATTRS];
+	unsigned int i;
+	void *watcher;
+	sigset_t set;
+	int rc, sig;
+
+	for (i = 0; i < NUM_WATCH_ATTRS; i++)
+		ids[i] = watch_attrs[i].id;
+	// handle termination in the main thread only, so we can stop the watcher gracefully
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	watcher = qc_watch_start(interval * 1000, QC_REFRESH_ALL, ids, NUM_WATCH_ATTRS, watch_cb, &delta, &rc);
+	if (!watcher) {
+		fprintf(stderr, "Error: Could not start watching for changes, rc=%d\n", rc);
+		return rc ? rc : 1;
+	}
+	if (!delta) {
+		// refresh after the watcher established its baseline, so no change goes unnoticed
+		pthread_mutex_lock(&out_lock);
+		if ((rc = qc_refresh(hdl, QC_REFRESH_ALL, NULL)) == 0)
+			rc = print_table(hdl);
+		fflush(stdout);
+		pthread_mutex_unlock(&out_lock);
+		if (rc) {
+			qc_watch_stop(watcher);
+			return rc;
+		}
+	}
+	sigwait(&set, &sig);
+	qc_watch_stop(watcher);
 
 	return 0;
 }
@@ -166,10 +342,14 @@ static void print_help() {
 	printf("Print information about virtualization layers on IBM Z.\n");
 	printf("\n");
 	printf("  -d, --debug          Increase debug level\n");
+	printf("  -D, --delta          Print changes line by line instead of redrawing the\n");
+	printf("                       table, implies --watch\n");
 	printf("  -h, --help           Print usage information and exit\n");
 	printf("  -j, --json           Dump all available data in JSON format\n");
 	printf("  -l, --layers         Print layer count\n");
 	printf("  -L, --levels         Print virtualization level count\n");
+	printf("  -w, --watch <SEC>    Refresh every SEC seconds, redrawing rows that changed\n");
+	printf("                       until interrupted. Default with --delta: %d\n", DEFAULT_INTERVAL);
 	printf("\n");
 }
 
@@ -179,24 +359,31 @@ static void print_version() {
 
 int main(int argc, char **argv) {
 	static struct option long_options[] = {
-		{ "debug",              no_argument, NULL, 'd'},
-		{ "help",		no_argument, NULL, 'h'},
-		{ "json",		no_argument, NULL, 'j'},
-		{ "layers",		no_argument, NULL, 'l'},
-		{ "levels",		no_argument, NULL, 'L'},
-		{ "version",            no_argument, NULL, 'v'},
-		{ 0,			0,	     0,    0  }
+		{ "debug",              no_argument,	   NULL, 'd'},
+		{ "delta",		no_argument,	   NULL, 'D'},
+		{ "help",		no_argument,	   NULL, 'h'},
+		{ "json",		no_argument,	   NULL, 'j'},
+		{ "layers",		no_argument,	   NULL, 'l'},
+		{ "levels",		no_argument,	   NULL, 'L'},
+		{ "version",            no_argument,	   NULL, 'v'},
+		{ "watch",		required_argument, NULL, 'w'},
+		{ 0,			0,		   0,    0  }
 	};
-	int layers, rc = 0, json = 0, lvls = 0, lays = 0, dbg = 0;
+	int layers, rc = 0, json = 0, lvls = 0, lays = 0, dbg = 0, delta = 0, watching = 0;
+	double interval = DEFAULT_INTERVAL;
 	void *hdl = NULL;
+	char *end;
 	int c;
 
 	setenv("QC_DEBUG_CONSOLE", "1", 1);
 
-	while ((c = getopt_long(argc, argv, "dhjlLv", long_options, NULL)) != EOF) {
+	while ((c = getopt_long(argc, argv, "dDhjlLvw:", long_options, NULL)) != EOF) {
 		switch (c) {
 		case 'd': dbg++;
 			  break;
+		case 'D': delta = 1;
+			  watching = 1;
+			  break;
 		case 'h': print_help();
 			  return 0;
 		case 'j': json = 1;
@@ -207,6 +394,13 @@ int main(int argc, char **argv) {
 			  break;
 		case 'v': print_version();
 			  return 0;
+		case 'w': watching = 1;
+			  interval = strtod(optarg, &end);
+			  if (*end != '\0' || interval < 0.001 || interval > 86400) {
+				fprintf(stderr, "Error: Invalid interval '%s'\n", optarg);
+				return 1;
+			  }
+			  break;
 		default:  print_help();
 			  return 1;
 		}
@@ -217,11 +411,15 @@ int main(int argc, char **argv) {
 		setenv("QC_DEBUG", "2", 1);
 	if ((rc = get_handle(&hdl, &layers)) != 0)
 		goto out;
-	if (json + lays + lvls > 1) {
-		fprintf(stderr, "Error: Only one of options --json, --layers and --levels is allowed\n");
+	if (json + lays + lvls + watching > 1) {
+		fprintf(stderr, "Error: Only one of options --json, --layers, --levels and --watch is allowed\n");
 		rc = 2;
 		goto out;
 	}
+	if (watching) {
+		rc = watch(hdl, interval, delta);
+		goto out;
+	}
 	if (json) {
 		qc_export_json(hdl);
 		rc = 0;